@@ -0,0 +1,822 @@
+// Headless benchmark for the CPU port of the simulation (cpu_simulation.h).
+// Usage: gpu-voxel-bench [size x] [size y] [size z] [steps] [threads]
+// After timing every layout and how stepping scales from 1 thread up to the number given, it measures how many steps a
+// dam break takes to settle with each liquid solver, and checks that no liquid was made or lost on the way, then lets
+// water and lava flow towards each other and checks that neither made or lost any other than what reacted (exits with
+// 1 if any was). It also checks the keys of the shader permutation cache. Every layout also labels its bodies of
+// liquid, once from scratch and once more after a step, when only chunks with liquid written need labelling again, and
+// prints the same world statistics VoxelSim reads back from the GPU.
+
+#include "cpu_simulation.h"
+#include "voxel_layout.h"
+#include "job_system.h"
+#include "fall_kernel.h"
+#include "chunk_streamer.h"
+#include "shader_permutation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Counts hardware cache misses while it's alive (only supported on Linux, reads -1 elsewhere or without permission)
+class CacheMissCounter
+{
+    public:
+
+    CacheMissCounter()
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+        if (fd >= 0) {close(fd);}
+#endif
+    }
+
+    long long Read()
+    {
+#ifdef __linux__
+        long long count = 0;
+        if (fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count)) {return count;}
+#endif
+        return -1;
+    }
+
+    private:
+
+    int fd = -1;
+};
+
+// Drops blocks of sand, stone, water and lava onto the floor of the world, so most rules get exercised
+template<typename Layout>
+void BuildScene(CpuSimulation<Layout>& sim)
+{
+    int3 size = sim.worldSize;
+
+    sim.Initialize();
+    sim.Fill({size.x / 8, size.y / 2, size.z / 8}, {size.x / 2, size.y * 3 / 4, size.z / 2}, Sand);
+    sim.Fill({size.x / 2, size.y / 4, size.z / 2}, {size.x * 7 / 8, size.y / 2, size.z * 7 / 8}, Water);
+    sim.Fill({size.x / 8, size.y / 4, size.z / 2}, {size.x / 2, size.y / 2, size.z * 7 / 8}, Lava);
+    sim.Fill({size.x / 2, size.y * 5 / 8, size.z / 8}, {size.x * 7 / 8, size.y * 3 / 4, size.z / 2}, Stone);
+}
+
+// Indicates if every material holds exactly the liquid it held at start, less what reactions have taken since (a liquid
+// flowing into a pool of another would move liquid from one material to the other)
+bool LiquidKept(const CpuWorldStats& start, const CpuWorldStats& end)
+{
+    for (int type = 0; type < materialCount; type++)
+    {
+        if (end.liquidCounts[type] + (end.reactedLiquid[type] - start.reactedLiquid[type]) != start.liquidCounts[type]) {return false;}
+    }
+
+    return true;
+}
+
+// Steps a scene until a step changes no voxel at all, and returns the number of steps it took (or -1 if it hasn't
+// settled after maxSteps). Once it has settled, it keeps stepping until the world is idle and checks that it stays that
+// way. start is set to the stats before the first step and end to the stats after the last one, and kept to whether
+// every material held exactly the liquid it started with, less what reactions took, after every step.
+template<typename Layout>
+int StepsToSettle(CpuSimulation<Layout>& sim, int maxSteps, CpuWorldStats& start, CpuWorldStats& end, bool& kept)
+{
+    start = sim.CollectStats();
+    end = start;
+    kept = true;
+
+    for (int step = 0; step < maxSteps; step++)
+    {
+        sim.Step(step * 8);
+
+        end = sim.CollectStats();
+        kept = kept && LiquidKept(start, end);
+
+        if (end.movedVoxels != 0) {continue;}
+
+        // Nothing changed, but something could still slide off before it falls asleep
+        for (int idleStep = step + 1; !sim.IsIdle() && idleStep < maxSteps; idleStep++)
+        {
+            sim.Step(idleStep * 8);
+            if (sim.CollectStats().movedVoxels != 0) {printf("dam break moved again after a step that moved nothing\n");}
+        }
+
+        return step + 1;
+    }
+
+    return -1;
+}
+
+// Steps a scene a number of times, setting start, end and kept the same way StepsToSettle() does
+template<typename Layout>
+void StepAndWatch(CpuSimulation<Layout>& sim, int steps, CpuWorldStats& start, CpuWorldStats& end, bool& kept)
+{
+    start = sim.CollectStats();
+    end = start;
+    kept = true;
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.Step(step * 8);
+
+        end = sim.CollectStats();
+        kept = kept && LiquidKept(start, end);
+    }
+}
+
+// Steps a dam break (a block of water held against one side of the world, let go all at once) with each liquid solver,
+// then water and lava held against opposite sides of the world with dry ground between them, with every chunk stepped
+// and with a quarter of them. Returns false if any material ever held more or less liquid than it started with, other
+// than what reactions took.
+bool RunSettle(int3 worldSize, JobSystem& jobs)
+{
+    bool conserved = true;
+    const int maxSteps = 4000;
+    const int twoDamSteps = 400;
+    const char* solverNames[2] = {"spread", "pipes"};
+    LiquidSolver solvers[2] = {LiquidSolver::Spread, LiquidSolver::Pipes};
+
+    // The last scene is the two dams again with a quarter of the chunks stepped per step, so liquid keeps reaching the
+    // edge of the columns covered by a step
+    for (int scene = 0; scene < 3; scene++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+            sim.liquidSolver = solvers[i];
+            if (scene == 2)
+            {
+                const int3& chunkCount = sim.chunks.chunkCount;
+                sim.chunks.budget = std::max(chunkCount.x * chunkCount.y * chunkCount.z / 4, 1);
+            }
+
+            sim.Initialize();
+            if (scene == 0)
+            {
+                sim.Fill({0, 3, 0}, {worldSize.x / 4, worldSize.y / 2, worldSize.z}, Water);
+            }
+            else
+            {
+                sim.Fill({0, 3, 0}, {worldSize.x / 4, worldSize.y / 2, worldSize.z}, Water);
+                sim.Fill({worldSize.x * 3 / 4, 3, 0}, {worldSize.x, worldSize.y / 2, worldSize.z}, Lava);
+            }
+
+            CpuWorldStats start = {};
+            CpuWorldStats end = {};
+            bool kept = true;
+            auto startTime = std::chrono::high_resolution_clock::now();
+
+            // Where water and lava meet they keep reacting now and then, so that scene never quite settles and is
+            // stepped a fixed number of times instead
+            int steps = -1;
+            if (scene == 0) {steps = StepsToSettle(sim, maxSteps, start, end, kept);}
+            else {StepAndWatch(sim, twoDamSteps, start, end, kept);}
+
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+            if (scene > 0)
+            {
+                printf("%-10s %-8s stepped %5d times (%8.1f ms", scene == 1 ? "two dams," : "sliced,", solverNames[i], twoDamSteps, elapsed.count() * 1000.0);
+            }
+            else if (steps >= 0)
+            {
+                printf("dam break, %-8s settled after %5d steps (%8.1f ms", solverNames[i], steps, elapsed.count() * 1000.0);
+            }
+            else
+            {
+                printf("dam break, %-8s not settled after %d steps (%8.1f ms", solverNames[i], maxSteps, elapsed.count() * 1000.0);
+            }
+
+            uint64_t reacted = 0;
+            for (int type = 0; type < materialCount; type++) {reacted += end.reactedLiquid[type];}
+
+            if (kept && reacted == 0) {printf(", all %llu liquid kept)\n", (unsigned long long)start.liquid);}
+            else if (kept) {printf(", all %llu liquid kept or taken by reactions, %llu of it)\n", (unsigned long long)start.liquid, (unsigned long long)reacted);}
+            else {printf(", %llu of %llu liquid left, not all of it accounted for by material)\n", (unsigned long long)end.liquid, (unsigned long long)start.liquid);}
+
+            conserved = conserved && kept;
+        }
+    }
+
+    return conserved;
+}
+
+template<typename Layout>
+void RunLayout(int3 worldSize, int steps, JobSystem& jobs)
+{
+    CpuSimulation<Layout> sim(worldSize, &jobs);
+    BuildScene(sim);
+
+    CacheMissCounter cacheMisses;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.Step(step * 8);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    long long misses = cacheMisses.Read();
+
+    // Mesh the final state once
+    std::vector<CpuFace> faces;
+    auto meshStart = std::chrono::high_resolution_clock::now();
+    sim.GenerateMesh(faces);
+    std::chrono::duration<double> meshElapsed = std::chrono::high_resolution_clock::now() - meshStart;
+
+    // World statistics straight from the column map, rather than scanning every voxel
+    const ColumnMap& columns = sim.GetColumns();
+    int usedColumns = 0;
+    int highest = -1;
+    for (int z = 0; z < columns.sizeZ; z++)
+    {
+        for (int x = 0; x < columns.sizeX; x++)
+        {
+            int top = columns.Top(x, z);
+            usedColumns += top >= 0 ? 1 : 0;
+            highest = top > highest ? top : highest;
+        }
+    }
+
+    double msPerStep = elapsed.count() * 1000.0 / steps;
+    double voxelsPerSecond = (double)worldSize.x * worldSize.y * worldSize.z * steps / elapsed.count();
+
+    printf("%-8s %10.3f ms/step %12.1f Mvoxels/s %10.3f ms/mesh (%zu faces) %6d columns used, highest %d", Layout::name, msPerStep, voxelsPerSecond / 1e6, meshElapsed.count() * 1000.0, faces.size(), usedColumns, highest);
+
+    if (misses >= 0)
+    {
+        printf(" %12.1f cache misses/step\n", (double)misses / steps);
+    }
+    else
+    {
+        printf(" %12s cache misses/step\n", "n/a");
+    }
+
+    CpuWorldStats stats = sim.CollectStats();
+    printf("%-8s %10u voxels moved in the last step %9u sand %9u water %9u lava %12llu liquid\n", "", stats.movedVoxels, stats.voxelCounts[Sand], stats.voxelCounts[Water], stats.voxelCounts[Lava], (unsigned long long)stats.liquid);
+
+    auto labelStart = std::chrono::high_resolution_clock::now();
+    sim.LabelLiquids();
+    std::chrono::duration<double> labelElapsed = std::chrono::high_resolution_clock::now() - labelStart;
+
+    sim.Step(steps * 8);
+    auto relabelStart = std::chrono::high_resolution_clock::now();
+    sim.LabelLiquids();
+    std::chrono::duration<double> relabelElapsed = std::chrono::high_resolution_clock::now() - relabelStart;
+
+    uint32_t largest = 0;
+    for (const CpuLiquidBody& body : sim.GetLiquidBodies())
+    {
+        largest = body.voxelCount > largest ? body.voxelCount : largest;
+    }
+
+    printf("%-8s %10zu liquid bodies, largest %u voxels, %8.3f ms to label, %8.3f ms to label again after a step\n", "", sim.GetLiquidBodies().size(), largest, labelElapsed.count() * 1000.0, relabelElapsed.count() * 1000.0);
+}
+
+// Steps the same scene with 1, 2, 4 and so on up to maxThreads threads, and prints the time per step of each next to
+// its speedup over a single thread
+void RunThreadScaling(int3 worldSize, int steps, uint32_t maxThreads)
+{
+    double singleThread = 0.0;
+    for (uint32_t threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        JobSystem jobs(threads);
+        CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+        BuildScene(sim);
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int step = 0; step < steps; step++)
+        {
+            sim.Step(step * 8);
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        double msPerStep = elapsed.count() * 1000.0 / steps;
+        if (threads == 1) {singleThread = msPerStep;}
+
+        printf("%-8s %10.3f ms/step with %3u threads, %5.2fx speedup (%5.1f%% per thread)\n", "scaling", msPerStep, threads, singleThread / msPerStep, 100.0 * singleThread / msPerStep / threads);
+        if (threads >= maxThreads) {break;}
+    }
+}
+
+// Steps the same scene with the checkerboard limited to a quarter of the world's chunks per step, picked around the
+// center of the world, and prints how many chunks were stepped per step on average
+void RunTimeSliced(int3 worldSize, int steps, JobSystem& jobs)
+{
+    CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+    const int3& chunkCount = sim.chunks.chunkCount;
+    int chunkTotal = chunkCount.x * chunkCount.y * chunkCount.z;
+    sim.chunks.budget = std::max(chunkTotal / 4, 1);
+    sim.chunks.focus = chunkCount / 2;
+    BuildScene(sim);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.Step(step * 8);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    // Every chunk's clock counts the steps it was simulated for, and Behind() the steps it still has to make up
+    uint64_t chunkSteps = 0;
+    uint32_t slowest = UINT32_MAX;
+    uint32_t lag = 0;
+    for (int i = 0; i < chunkTotal; i++)
+    {
+        uint32_t clock = sim.chunks.Clock(sim.chunks.Position(i));
+        chunkSteps += clock;
+        slowest = std::min(slowest, clock);
+        lag = std::max(lag, sim.chunks.Behind(i));
+    }
+
+    printf("%-8s %10.3f ms/step %12.1f chunks/step of %d (budget %u), fewest steps of a chunk %u, most behind %u\n", "sliced", elapsed.count() * 1000.0 / steps, (double)chunkSteps / steps, chunkTotal, sim.chunks.budget, slowest, lag);
+}
+
+// Steps the same scene with far chunks stepped less often, around one corner of the world for the first half of the
+// steps and the opposite corner for the rest, so chunks that come close have to catch up
+void RunLevelOfDetail(int3 worldSize, int steps, JobSystem& jobs)
+{
+    CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+    const int3& chunkCount = sim.chunks.chunkCount;
+    int chunkTotal = chunkCount.x * chunkCount.y * chunkCount.z;
+    sim.chunks.lodDistance = 1;
+    BuildScene(sim);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.chunks.focus = (step < steps / 2) ? int3{0, 0, 0} : chunkCount - int3{1, 1, 1};
+        sim.Step(step * 8);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    uint64_t chunkSteps = 0;
+    for (int i = 0; i < chunkTotal; i++)
+    {
+        chunkSteps += sim.chunks.Clock(sim.chunks.Position(i));
+    }
+
+    CpuWorldStats stats = sim.CollectStats();
+    printf("%-8s %10.3f ms/step %12.1f chunks/step of %d (lod distance %d) %12llu liquid\n", "lod", elapsed.count() * 1000.0 / steps, (double)chunkSteps / steps, chunkTotal, sim.chunks.lodDistance, (unsigned long long)stats.liquid);
+}
+
+// Saves the scene into a ChunkPool twice, once at the origin and once millions of voxels away, then loads the far copy
+// into a new world. Returns false if that doesn't hold the same voxels and liquid.
+bool RunChunkPool(int3 worldSize, int steps, JobSystem& jobs)
+{
+    CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+    BuildScene(sim);
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.Step(step * 8);
+    }
+
+    ChunkPool pool;
+    int3 farOrigin = {3000000, -1000000, -3000000};
+    auto start = std::chrono::high_resolution_clock::now();
+    sim.Save(pool, {0, 0, 0});
+    sim.Save(pool, farOrigin);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    // The saved chunks are all full until they go a Compact() without being written, so the far copy is loaded back
+    // from packed chunks
+    size_t fullBytes = pool.MemoryUsed();
+    start = std::chrono::high_resolution_clock::now();
+    pool.Compact();
+    pool.Compact();
+    std::chrono::duration<double> packing = std::chrono::high_resolution_clock::now() - start;
+
+    uint32_t bitHistogram[5] = {};
+    for (int3 chunk : {int3{0, 0, 0}, farOrigin / ChunkPool::chunkSize})
+    {
+        for (int y = 0; y < worldSize.y / ChunkPool::chunkSize; y++)
+        {
+            for (int z = 0; z < worldSize.z / ChunkPool::chunkSize; z++)
+            {
+                for (int x = 0; x < worldSize.x / ChunkPool::chunkSize; x++)
+                {
+                    uint32_t slot = pool.Find(chunk + int3{x, y, z});
+                    if (slot == ChunkPool::noSlot) {continue;}
+
+                    uint32_t bits = pool.BitsPerVoxel(slot);
+                    bitHistogram[bits == 0 ? 0 : bits == 1 ? 1 : bits == 2 ? 2 : bits <= 8 ? 3 : 4]++;
+                }
+            }
+        }
+    }
+
+    CpuSimulation<LinearLayout> loaded(worldSize, &jobs);
+    loaded.Initialize();
+    loaded.Load(pool, farOrigin);
+
+    CpuWorldStats saved = sim.CollectStats();
+    CpuWorldStats restored = loaded.CollectStats();
+    bool same = saved.liquid == restored.liquid && std::equal(saved.voxelCounts, saved.voxelCounts + materialCount, restored.voxelCounts);
+
+    // The pool holds the same fields as the dense arrays of type and liquid, for both copies
+    double denseBytes = 2.0 * worldSize.x * worldSize.y * worldSize.z * (sizeof(uint8_t) + sizeof(uint16_t));
+    uint32_t windowChunks = 2 * (uint32_t)(worldSize.x / ChunkPool::chunkSize) * (worldSize.y / ChunkPool::chunkSize) * (worldSize.z / ChunkPool::chunkSize);
+    printf("%-8s %10u of %u chunks stored %9.2f MB (%.2f MB dense) %8.3f ms to save both copies, far copy loaded back %s\n", "pool", pool.ChunkCount(), windowChunks, fullBytes / 1e6, denseBytes / 1e6, elapsed.count() * 1000.0, same ? "the same" : "different");
+    printf("%-8s %10u of %u chunks packed %9.2f MB (%.1fx smaller) %8.3f ms to pack, chunks by bits per voxel: 0: %u 1: %u 2: %u 4-8: %u full: %u\n", "packed", pool.PackedCount(), pool.ChunkCount(), pool.MemoryUsed() / 1e6, (double)fullBytes / pool.MemoryUsed(), packing.count() * 1000.0, bitHistogram[0], bitHistogram[1], bitHistogram[2], bitHistogram[3], bitHistogram[4]);
+    return same;
+}
+
+// Walks a ray through the world one voxel at a time, reading every voxel it passes (how Pick in picker.hlsl finds what
+// it hits), the same way OccupancyTree::Raycast() does without skipping anything
+RayHit DenseRaycast(const CpuSimulation<LinearLayout>& sim, const float origin[3], const float direction[3], float maxDistance)
+{
+    RayHit result = {false, {0, 0, 0}, {0, 0, 0}, 0.0f, 0};
+    const int size[3] = {sim.worldSize.x, sim.worldSize.y, sim.worldSize.z};
+
+    float enter = 0.0f;
+    float leave = maxDistance;
+    int enterAxis = -1;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (direction[axis] == 0.0f)
+        {
+            if (origin[axis] < 0.0f || origin[axis] >= (float)size[axis]) {return result;}
+            continue;
+        }
+
+        float near = (0.0f - origin[axis]) / direction[axis];
+        float far = ((float)size[axis] - origin[axis]) / direction[axis];
+        if (near > far) {std::swap(near, far);}
+        if (near > enter) {enter = near; enterAxis = axis;}
+        leave = std::min(leave, far);
+    }
+
+    if (enter > leave) {return result;}
+
+    int cell[3];
+    int normal[3] = {0, 0, 0};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cell[axis] = std::clamp((int)std::floor(origin[axis] + direction[axis] * enter), 0, size[axis] - 1);
+    }
+
+    if (enterAxis >= 0) {normal[enterAxis] = direction[enterAxis] > 0.0f ? -1 : 1;}
+
+    float distance = enter;
+    while (true)
+    {
+        result.steps++;
+
+        if (sim.GetVoxel({cell[0], cell[1], cell[2]}).type != Empty)
+        {
+            result.hit = true;
+            result.position = {cell[0], cell[1], cell[2]};
+            result.normal = {normal[0], normal[1], normal[2]};
+            result.distance = distance;
+            return result;
+        }
+
+        int exitAxis = 0;
+        float exitDistance = INFINITY;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (direction[axis] == 0.0f) {continue;}
+
+            float side = (float)(direction[axis] > 0.0f ? cell[axis] + 1 : cell[axis]);
+            float sideDistance = (side - origin[axis]) / direction[axis];
+            if (sideDistance < exitDistance) {exitDistance = sideDistance; exitAxis = axis;}
+        }
+
+        if (exitDistance > maxDistance) {return result;}
+
+        cell[exitAxis] += direction[exitAxis] > 0.0f ? 1 : -1;
+        if (cell[exitAxis] < 0 || cell[exitAxis] >= size[exitAxis]) {return result;}
+
+        normal[0] = normal[1] = normal[2] = 0;
+        normal[exitAxis] = direction[exitAxis] > 0.0f ? -1 : 1;
+        distance = exitDistance;
+    }
+}
+
+// Casts the same rays through the scene with the occupancy tree and with the dense walk, after building the tree from
+// scratch and updating it after a step. Returns false if any ray hits something different.
+bool RunRaycast(int3 worldSize, int steps, JobSystem& jobs)
+{
+    CpuSimulation<LinearLayout> sim(worldSize, &jobs);
+    BuildScene(sim);
+
+    for (int step = 0; step < steps; step++)
+    {
+        sim.Step(step * 8);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    sim.UpdateOccupancyTree();
+    std::chrono::duration<double> built = std::chrono::high_resolution_clock::now() - start;
+
+    sim.Step(steps * 8);
+    start = std::chrono::high_resolution_clock::now();
+    sim.UpdateOccupancyTree();
+    std::chrono::duration<double> updated = std::chrono::high_resolution_clock::now() - start;
+
+    // Rays from anywhere in the world in every direction, long enough to cross it
+    const int rayCount = 20000;
+    std::vector<float> rays(rayCount * 6);
+    uint32_t seed = 12345;
+    auto random = [&]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / (float)(1u << 24);
+    };
+
+    for (int i = 0; i < rayCount; i++)
+    {
+        float* ray = &rays[i * 6];
+        ray[0] = random() * worldSize.x;
+        ray[1] = random() * worldSize.y;
+        ray[2] = random() * worldSize.z;
+        for (int axis = 3; axis < 6; axis++) {ray[axis] = random() * 2.0f - 1.0f;}
+    }
+
+    float maxDistance = 2.0f * std::max(worldSize.x, std::max(worldSize.y, worldSize.z));
+    const OccupancyTree& tree = sim.GetOccupancyTree();
+    std::vector<RayHit> treeHits(rayCount);
+    std::vector<RayHit> denseHits(rayCount);
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rayCount; i++)
+    {
+        treeHits[i] = tree.Raycast(&rays[i * 6], &rays[i * 6 + 3], maxDistance);
+    }
+    std::chrono::duration<double> treeTime = std::chrono::high_resolution_clock::now() - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rayCount; i++)
+    {
+        denseHits[i] = DenseRaycast(sim, &rays[i * 6], &rays[i * 6 + 3], maxDistance);
+    }
+    std::chrono::duration<double> denseTime = std::chrono::high_resolution_clock::now() - start;
+
+    uint64_t treeSteps = 0;
+    uint64_t denseSteps = 0;
+    int hits = 0;
+    int different = 0;
+    for (int i = 0; i < rayCount; i++)
+    {
+        const RayHit& a = treeHits[i];
+        const RayHit& b = denseHits[i];
+        bool same = a.hit == b.hit && (!a.hit || (a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z));
+        different += same ? 0 : 1;
+        hits += a.hit ? 1 : 0;
+        treeSteps += a.steps;
+        denseSteps += b.steps;
+    }
+
+    printf("%-8s %10.3f ms to build %8.3f ms to update after a step %9.2f MB, %d levels\n", "tree", built.count() * 1000.0, updated.count() * 1000.0, tree.MemoryUsed() / 1e6, tree.levelCount);
+    printf("%-8s %10.2f Mrays/s (%.1f cells/ray) vs %.2f Mrays/s dense (%.1f cells/ray), %d of %d hit, %d different\n", "rays", rayCount / treeTime.count() / 1e6, (double)treeSteps / rayCount, rayCount / denseTime.count() / 1e6, (double)denseSteps / rayCount, hits, rayCount, different);
+    return different == 0;
+}
+
+// Fills region files with a rolling terrain (stone under sand, with water in the valleys) chunks wide and deep, and
+// 4 chunks high
+void WriteTerrain(ChunkStreamer& streamer, int chunks)
+{
+    int size = ChunkPool::chunkSize;
+    std::unique_ptr<ChunkPool::Chunk> chunk = std::make_unique<ChunkPool::Chunk>();
+
+    for (int cy = 0; cy < 4; cy++)
+    {
+        for (int cz = 0; cz < chunks; cz++)
+        {
+            for (int cx = 0; cx < chunks; cx++)
+            {
+                bool occupied = false;
+                for (int y = 0; y < size; y++)
+                {
+                    for (int z = 0; z < size; z++)
+                    {
+                        for (int x = 0; x < size; x++)
+                        {
+                            int3 position = int3{cx, cy, cz} * size + int3{x, y, z};
+                            int height = 24 + (int)(10.0 * sin(position.x * 0.05) * cos(position.z * 0.04));
+                            uint8_t type = (position.y < height - 4) ? Stone : (position.y < height) ? Sand : (position.y < 24) ? Water : Empty;
+
+                            int index = (y * size + z) * size + x;
+                            chunk->types[index] = type;
+                            chunk->liquidCounts[index] = (type == Water) ? CpuSimulation<LinearLayout>::maxLiquid : 0;
+                            occupied = occupied || type != Empty;
+                        }
+                    }
+                }
+
+                if (occupied) {streamer.WriteChunk({cx, cy, cz}, *chunk);}
+            }
+        }
+    }
+}
+
+// Checks the keys VoxelSim finds compiled shaders by (the cache doesn't depend on D3D11, so it's checked here): the
+// same defines give the same key whatever order they were set in, and different files, entry points, names or values
+// give different keys, even when a name or value holds one of the separators. Returns false if any check fails.
+bool RunPermutationCache()
+{
+    typedef PermutationCache<int> Cache;
+
+    ShaderDefines forward;
+    forward["WORLD_SIZE_X"] = "128";
+    forward["VOXEL_LAYOUT"] = "0";
+    forward["LIQUID_SOLVER"] = "1";
+
+    ShaderDefines backward;
+    backward["LIQUID_SOLVER"] = "1";
+    backward["VOXEL_LAYOUT"] = "0";
+    backward["WORLD_SIZE_X"] = "128";
+
+    ShaderDefines otherValue = forward;
+    otherValue["WORLD_SIZE_X"] = "64";
+
+    // Each pair would build the same key if separators (or, for the last pair, backslashes) weren't escaped
+    ShaderDefines joined = {{"A", "1;B=2"}};
+    ShaderDefines split = {{"A", "1"}, {"B", "2"}};
+    ShaderDefines backslashes = {{"A\\", "1\\"}, {"B", "2"}};
+    ShaderDefines separators = {{"A=1;B", "2"}};
+
+    const std::string file = "../shaders/simulation.hlsl";
+    std::string key = Cache::Key(file, "StepSimulation", forward);
+
+    int failed = 0;
+    failed += key != Cache::Key(file, "StepSimulation", backward);
+    failed += key == Cache::Key(file, "StepSimulation", otherValue);
+    failed += key == Cache::Key(file, "FallColumns", forward);
+    failed += key == Cache::Key("../shaders/picker.hlsl", "StepSimulation", forward);
+    failed += Cache::Key(file, "StepSimulation", joined) == Cache::Key(file, "StepSimulation", split);
+    failed += Cache::Key(file, "Step|A", {}) == Cache::Key(file + "|Step", "A", {});
+    failed += Cache::Key(file, "StepSimulation", backslashes) == Cache::Key(file, "StepSimulation", separators);
+
+    Cache cache;
+    failed += cache.Find(key) != nullptr;
+    failed += cache.Size() != 0;
+
+    cache.Insert(key, 1);
+    cache.Insert(Cache::Key(file, "StepSimulation", otherValue), 2);
+    failed += cache.Size() != 2;
+    failed += !cache.Find(key) || *cache.Find(key) != 1;
+    failed += !cache.Find(Cache::Key(file, "StepSimulation", backward)) || *cache.Find(Cache::Key(file, "StepSimulation", backward)) != 1;
+    failed += !cache.Find(Cache::Key(file, "StepSimulation", otherValue)) || *cache.Find(Cache::Key(file, "StepSimulation", otherValue)) != 2;
+    failed += cache.Find(Cache::Key(file, "StepSimulation", split)) != nullptr;
+
+    // Inserting under a key already stored replaces it
+    cache.Insert(key, 3);
+    failed += cache.Size() != 2 || *cache.Find(key) != 3;
+
+    printf("%-8s %10zu permutations cached, %d checks failed\n", "shaders", cache.Size(), failed);
+    return failed == 0;
+}
+
+// Flies a camera across a world streamed from region files, digging out the voxel under it every frame, once
+// predicting where it's heading and once not. Returns false if the dug out voxels aren't air once read back.
+bool RunStreaming()
+{
+    const int chunks = 48;
+    const uint32_t capacity = 2048;
+
+    // A directory of its own in the system's temporary directory, named after the clock so runs don't share one
+    std::error_code error;
+    std::filesystem::path temporary = std::filesystem::temp_directory_path(error);
+    std::filesystem::path directoryPath;
+    bool made = false;
+    for (int attempt = 0; !error && !made && attempt < 100; attempt++)
+    {
+        uint64_t stamp = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() + attempt;
+        directoryPath = temporary / ("gpu-voxel-regions-" + std::to_string(stamp));
+        made = std::filesystem::create_directory(directoryPath, error);
+    }
+
+    if (!made)
+    {
+        printf("couldn't make a directory for region files\n");
+        return false;
+    }
+    std::string directory = directoryPath.string();
+
+    {
+        ChunkStreamer streamer(directory, capacity);
+        WriteTerrain(streamer, chunks);
+    }
+
+    bool kept = true;
+    float lookaheads[2] = {1.0f, 0.0f};
+    for (float lookahead : lookaheads)
+    {
+        // 4 voxels per frame at 60 frames a second, each frame leaving the streaming thread 2 ms
+        int3 velocity = {240, 0, 0};
+        int3 position = {64, 40, chunks * ChunkPool::chunkSize / 2};
+        int frames = (chunks * ChunkPool::chunkSize - 128) / 4;
+
+        ChunkStreamer streamer(directory, capacity);
+        streamer.lookahead = lookahead;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            streamer.Update(position, velocity);
+            streamer.SetVoxel(position - int3{0, 20, 0}, {Empty, 0});
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            position = position + int3{4, 0, 0};
+        }
+
+        const StreamStats& stats = streamer.stats;
+        printf("%-8s %9.1f%% hit rate (lookahead %.1f s) %6llu chunks loaded (%.2f MB read) %6llu evicted (%llu written back) %4llu stalls %8.3f ms/update, %u resident (%.2f MB)\n", "stream", 100.0 * stats.hits / stats.wanted, lookahead, (unsigned long long)stats.loads, stats.bytesRead / 1e6, (unsigned long long)stats.evictions, (unsigned long long)stats.writeBacks, (unsigned long long)stats.stalls, stats.updateSeconds * 1000.0 / frames, streamer.ResidentCount(), streamer.Pool().MemoryUsed() / 1e6);
+    }
+
+    // Whatever was dug out has been written back by now
+    ChunkStreamer streamer(directory, capacity);
+    for (int x = 64; x < chunks * ChunkPool::chunkSize - 64; x += 4)
+    {
+        kept = kept && streamer.GetVoxel({x, 20, chunks * ChunkPool::chunkSize / 2}).type == Empty;
+    }
+
+    std::filesystem::remove_all(directory);
+    return kept;
+}
+
+int main(int argc, char** argv)
+{
+    int3 worldSize = {128, 128, 128};
+    if (argc > 3) {worldSize = {atoi(argv[1]), atoi(argv[2]), atoi(argv[3])};}
+    int steps = (argc > 4) ? atoi(argv[4]) : 100;
+    uint32_t threads = (argc > 5) ? (uint32_t)atoi(argv[5]) : std::thread::hardware_concurrency();
+
+    if (worldSize.x <= 0 || worldSize.y <= 0 || worldSize.z <= 0 || worldSize.x % 4 != 0 || worldSize.y % 4 != 0 || worldSize.z % 4 != 0)
+    {
+        printf("world size must be a positive multiple of 4 on every axis\n");
+        return 1;
+    }
+
+    JobSystem jobs(threads);
+
+    printf("world %dx%dx%d, %d steps, %u threads, %s fall kernel\n", worldSize.x, worldSize.y, worldSize.z, steps, jobs.ThreadCount(), SupportsAvx2() ? "avx2" : "scalar");
+    RunLayout<LinearLayout>(worldSize, steps, jobs);
+    RunLayout<MortonLayout>(worldSize, steps, jobs);
+    RunLayout<TiledLayout>(worldSize, steps, jobs);
+    RunThreadScaling(worldSize, steps, jobs.ThreadCount());
+    RunTimeSliced(worldSize, steps, jobs);
+    RunLevelOfDetail(worldSize, steps, jobs);
+    if (!RunChunkPool(worldSize, steps, jobs))
+    {
+        printf("chunk pool didn't load back what was saved\n");
+        return 1;
+    }
+
+    if (!RunRaycast(worldSize, steps, jobs))
+    {
+        printf("rays through the occupancy tree didn't hit what the dense walk hit\n");
+        return 1;
+    }
+
+    if (!RunPermutationCache())
+    {
+        printf("shader permutation keys weren't unique\n");
+        return 1;
+    }
+
+    if (!RunStreaming())
+    {
+        printf("streamed chunks weren't written back\n");
+        return 1;
+    }
+
+    if (!RunSettle(worldSize, jobs))
+    {
+        printf("liquid wasn't conserved\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -20,6 +20,7 @@ void CameraController::Init()
 void CameraController::Update(float &dt)
 {
     bool updateMVP = false;
+    float3 previousPosition = cam.GetPosition();
 
     if (Input::GetKey('W'))
     {
@@ -82,6 +83,8 @@ void CameraController::Update(float &dt)
         updateMVP = true;
     }
 
+    if (dt > 0) {velocity = (cam.GetPosition() - previousPosition) / dt;}
+
     // Update MVP buffer
     if (updateMVP)
     {
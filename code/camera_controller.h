@@ -23,6 +23,9 @@ class CameraController
 
     static inline ConstBuffer<float4x4>* mvpBuffer;
 
+    // How far the camera moved per second over the last Update(), for predicting where it's heading (see ChunkStreamer)
+    static inline float3 velocity = float3(0, 0, 0);
+
     static inline float movementSpeed = 20.0f;
     
     static inline float mouseSensitivity = .01f;
@@ -0,0 +1,355 @@
+#include "chunk_pool.h"
+#include <algorithm>
+#include <iterator>
+
+StoredVoxel ChunkPool::GetVoxel(int3 position) const
+{
+    uint32_t slot = Find(ChunkOf(position));
+    if (slot == noSlot) {return {Empty, 0};}
+
+    return VoxelAt(slots[slot], VoxelIndex(LocalOf(position)));
+}
+
+void ChunkPool::SetVoxel(int3 position, StoredVoxel voxel)
+{
+    int3 chunkPosition = ChunkOf(position);
+    uint32_t slot = Find(chunkPosition);
+
+    // Air needs no chunk
+    if (slot == noSlot)
+    {
+        if (voxel.type == Empty) {return;}
+        slot = Allocate(chunkPosition);
+    }
+
+    // Writes go to full chunks, the chunk is packed again once it's left alone
+    if (slots[slot].full == noSlot) {Unpack(slot);}
+
+    Slot& stored = slots[slot];
+    Chunk& chunk = FullChunk(stored.full);
+    int index = VoxelIndex(LocalOf(position));
+    bool wasOccupied = chunk.types[index] != Empty;
+    bool isOccupied = voxel.type != Empty;
+
+    chunk.types[index] = voxel.type;
+    chunk.liquidCounts[index] = isOccupied ? voxel.liquidCount : 0;
+    stored.occupied += (uint32_t)isOccupied - (uint32_t)wasOccupied;
+    stored.written = true;
+
+    if (stored.occupied == 0) {Free(slot);}
+}
+
+void ChunkPool::StoreChunk(int3 chunk, const Chunk& data)
+{
+    uint32_t occupied = 0;
+    for (int i = 0; i < chunkVolume; i++)
+    {
+        occupied += data.types[i] != Empty ? 1 : 0;
+    }
+
+    uint32_t slot = Find(chunk);
+    if (occupied == 0)
+    {
+        if (slot != noSlot) {Free(slot);}
+        return;
+    }
+
+    if (slot == noSlot) {slot = Allocate(chunk);}
+    if (slots[slot].full == noSlot) {Unpack(slot);}
+
+    Chunk& stored = FullChunk(slots[slot].full);
+    std::copy(std::begin(data.types), std::end(data.types), std::begin(stored.types));
+    std::copy(std::begin(data.liquidCounts), std::end(data.liquidCounts), std::begin(stored.liquidCounts));
+    slots[slot].occupied = occupied;
+    slots[slot].written = false;
+    Pack(slot);
+}
+
+void ChunkPool::RemoveChunk(int3 chunk)
+{
+    uint32_t slot = Find(chunk);
+    if (slot != noSlot) {Free(slot);}
+}
+
+void ChunkPool::CopyChunk(uint32_t slot, Chunk& data) const
+{
+    const Slot& stored = slots[slot];
+    if (stored.full != noSlot)
+    {
+        data = FullChunk(stored.full);
+        return;
+    }
+
+    for (int i = 0; i < chunkVolume; i++)
+    {
+        StoredVoxel voxel = VoxelAt(stored, i);
+        data.types[i] = voxel.type;
+        data.liquidCounts[i] = voxel.liquidCount;
+    }
+}
+
+void ChunkPool::Compact()
+{
+    for (auto& [key, slot] : slotsByKey)
+    {
+        if (slots[slot].full != noSlot && !slots[slot].written) {Pack(slot);}
+        slots[slot].written = false;
+    }
+}
+
+uint32_t ChunkPool::Find(int3 chunk) const
+{
+    auto found = slotsByKey.find(Key(chunk));
+    return found == slotsByKey.end() ? noSlot : found->second;
+}
+
+uint32_t ChunkPool::Neighbor(uint32_t slot, int3 direction) const
+{
+    return neighbors[slot][NeighborIndex(direction)];
+}
+
+StoredVoxel ChunkPool::Read(uint32_t slot, int3 local) const
+{
+    int3 direction = {(local.x >= chunkSize) - (local.x < 0), (local.y >= chunkSize) - (local.y < 0), (local.z >= chunkSize) - (local.z < 0)};
+    uint32_t neighbor = Neighbor(slot, direction);
+    if (neighbor == noSlot) {return {Empty, 0};}
+
+    return VoxelAt(slots[neighbor], VoxelIndex(local - direction * chunkSize));
+}
+
+uint32_t ChunkPool::BitsPerVoxel(uint32_t slot) const
+{
+    return slots[slot].full != noSlot ? 24 : slots[slot].bits;
+}
+
+int3 ChunkPool::ChunkOf(int3 position)
+{
+    // Rounds down for negative positions too
+    int3 offset = {position.x < 0 ? chunkSize - 1 : 0, position.y < 0 ? chunkSize - 1 : 0, position.z < 0 ? chunkSize - 1 : 0};
+    return (position - offset) / chunkSize;
+}
+
+int3 ChunkPool::LocalOf(int3 position)
+{
+    return position - ChunkOf(position) * chunkSize;
+}
+
+uint32_t ChunkPool::ChunkCount() const
+{
+    return (uint32_t)slotsByKey.size();
+}
+
+uint32_t ChunkPool::PackedCount() const
+{
+    return packedCount;
+}
+
+size_t ChunkPool::MemoryUsed() const
+{
+    size_t bytes = 0;
+    for (const std::unique_ptr<Chunk[]>& page : pages)
+    {
+        if (page) {bytes += sizeof(Chunk) * chunksPerPage;}
+    }
+
+    for (const Slot& slot : slots)
+    {
+        bytes += sizeof(Slot) + slot.palette.capacity() * sizeof(StoredVoxel) + slot.indices.capacity() * sizeof(uint64_t);
+    }
+
+    // Roughly a node per entry and a pointer per bucket
+    bytes += slotsByKey.size() * (sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(void*)) + slotsByKey.bucket_count() * sizeof(void*);
+    bytes += neighbors.size() * sizeof(neighbors[0]) + (freeSlots.capacity() + freeFull.capacity()) * sizeof(uint32_t);
+    return bytes;
+}
+
+uint32_t ChunkPool::Allocate(int3 chunk)
+{
+    if (freeSlots.empty())
+    {
+        freeSlots.push_back((uint32_t)slots.size());
+        slots.emplace_back();
+        neighbors.emplace_back();
+    }
+
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    Slot& stored = slots[slot];
+    stored.position = chunk;
+    stored.occupied = 0;
+    stored.full = AllocateFull();
+    stored.written = true;
+
+    Chunk& data = FullChunk(stored.full);
+    std::fill(std::begin(data.types), std::end(data.types), (uint8_t)Empty);
+    std::fill(std::begin(data.liquidCounts), std::end(data.liquidCounts), (uint16_t)0);
+    slotsByKey[Key(chunk)] = slot;
+
+    // Link both ways with every chunk around it
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int z = -1; z <= 1; z++)
+        {
+            for (int x = -1; x <= 1; x++)
+            {
+                int index = NeighborIndex({x, y, z});
+                uint32_t neighbor = (index == 13) ? slot : Find(chunk + int3{x, y, z});
+                neighbors[slot][index] = neighbor;
+                if (neighbor != noSlot) {neighbors[neighbor][26 - index] = slot;}
+            }
+        }
+    }
+
+    return slot;
+}
+
+void ChunkPool::Free(uint32_t slot)
+{
+    for (int index = 0; index < 27; index++)
+    {
+        uint32_t neighbor = neighbors[slot][index];
+        if (neighbor != noSlot) {neighbors[neighbor][26 - index] = noSlot;}
+    }
+
+    Slot& stored = slots[slot];
+    if (stored.full != noSlot) {FreeFull(stored.full);}
+    else {packedCount--;}
+
+    stored.full = noSlot;
+    stored.palette = {};
+    stored.indices = {};
+    slotsByKey.erase(Key(stored.position));
+    freeSlots.push_back(slot);
+}
+
+void ChunkPool::Unpack(uint32_t slot)
+{
+    uint32_t full = AllocateFull();
+    CopyChunk(slot, FullChunk(full));
+
+    Slot& stored = slots[slot];
+    stored.full = full;
+    stored.palette = {};
+    stored.indices = {};
+    packedCount--;
+}
+
+void ChunkPool::Pack(uint32_t slot)
+{
+    Slot& stored = slots[slot];
+    const Chunk& chunk = FullChunk(stored.full);
+
+    // Chunks are mostly one to three materials, so a linear search of the palette is quickest
+    std::vector<StoredVoxel> palette;
+    std::vector<uint8_t> entries(chunkVolume);
+    for (int i = 0; i < chunkVolume; i++)
+    {
+        size_t entry = 0;
+        while (entry < palette.size() && (palette[entry].type != chunk.types[i] || palette[entry].liquidCount != chunk.liquidCounts[i]))
+        {
+            entry++;
+        }
+
+        if (entry == palette.size())
+        {
+            if (palette.size() == 256) {return;}
+            palette.push_back({chunk.types[i], chunk.liquidCounts[i]});
+        }
+
+        entries[i] = (uint8_t)entry;
+    }
+
+    // Fewest bits that tell the palette's voxels apart, as a power of 2 so no index spans two words
+    uint8_t bits = 0;
+    while ((1u << bits) < palette.size())
+    {
+        bits = bits ? bits * 2 : 1;
+    }
+
+    std::vector<uint64_t> indices(chunkVolume * bits / 64, 0);
+    for (int i = 0; bits && i < chunkVolume; i++)
+    {
+        int bit = i * bits;
+        indices[bit / 64] |= (uint64_t)entries[i] << (bit % 64);
+    }
+
+    FreeFull(stored.full);
+    stored.full = noSlot;
+    stored.bits = bits;
+    stored.palette = std::move(palette);
+    stored.indices = std::move(indices);
+    packedCount++;
+}
+
+uint32_t ChunkPool::AllocateFull()
+{
+    // Grow by a page when every full chunk is taken
+    if (freeFull.empty())
+    {
+        uint32_t firstFull = (uint32_t)pages.size() * chunksPerPage;
+        pages.push_back(nullptr);
+        pageChunks.push_back(0);
+        for (uint32_t full = firstFull + chunksPerPage; full > firstFull; full--)
+        {
+            freeFull.push_back(full - 1);
+        }
+    }
+
+    uint32_t full = freeFull.back();
+    freeFull.pop_back();
+
+    uint32_t page = full / chunksPerPage;
+    if (!pages[page]) {pages[page] = std::make_unique<Chunk[]>(chunksPerPage);}
+    pageChunks[page]++;
+    return full;
+}
+
+void ChunkPool::FreeFull(uint32_t full)
+{
+    freeFull.push_back(full);
+
+    uint32_t page = full / chunksPerPage;
+    if (--pageChunks[page] == 0) {pages[page].reset();}
+}
+
+ChunkPool::Chunk& ChunkPool::FullChunk(uint32_t full)
+{
+    return pages[full / chunksPerPage][full % chunksPerPage];
+}
+
+const ChunkPool::Chunk& ChunkPool::FullChunk(uint32_t full) const
+{
+    return pages[full / chunksPerPage][full % chunksPerPage];
+}
+
+StoredVoxel ChunkPool::VoxelAt(const Slot& slot, int index) const
+{
+    if (slot.full != noSlot)
+    {
+        const Chunk& chunk = FullChunk(slot.full);
+        return {chunk.types[index], chunk.liquidCounts[index]};
+    }
+
+    if (slot.bits == 0) {return slot.palette[0];}
+
+    int bit = index * slot.bits;
+    uint64_t entry = (slot.indices[bit / 64] >> (bit % 64)) & ((1ull << slot.bits) - 1);
+    return slot.palette[entry];
+}
+
+uint64_t ChunkPool::Key(int3 chunk)
+{
+    const uint64_t mask = (1ull << 21) - 1;
+    return ((uint64_t)chunk.x & mask) | (((uint64_t)chunk.y & mask) << 21) | (((uint64_t)chunk.z & mask) << 42);
+}
+
+int ChunkPool::NeighborIndex(int3 direction)
+{
+    return ((direction.y + 1) * 3 + direction.z + 1) * 3 + direction.x + 1;
+}
+
+int ChunkPool::VoxelIndex(int3 local)
+{
+    return (local.y * chunkSize + local.z) * chunkSize + local.x;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include "materials.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// What a ChunkPool keeps for one voxel (CpuVoxel without the per step flag)
+struct StoredVoxel
+{
+    uint8_t type;
+    uint16_t liquidCount;
+};
+
+// Sparse, unbounded voxel storage: only chunks holding at least one voxel that isn't air take memory. Chunks are
+// chunkSize voxels wide along every axis, found by their chunk coordinates through a hash map. A chunk gets a slot the
+// first time a voxel is set in it, and gives it back when its last voxel is cleared. Every slot keeps the slots of the
+// 26 chunks around it, so reads that cross into a neighboring chunk don't go through the hash map.
+// Chunk coordinates can be anywhere within +-2^20 on every axis.
+// A chunk is kept one of two ways. Chunks being written are full: every field of every voxel, in a pool that grows a
+// page of chunks at a time (a page is freed once none of its chunks are used). Chunks at rest are packed: a palette of
+// the distinct voxels in the chunk, and an index into it per voxel of 0 bits (the whole chunk is one voxel), 1, 2, 4
+// or 8 bits. Writing to a packed chunk unpacks it, and Compact() packs the chunks that weren't written since it was
+// last called. Chunks put in with StoreChunk() start out packed.
+class ChunkPool
+{
+    public:
+
+    // Width, height, and depth of a chunk in voxels (the same chunks ChunkScheduler steps)
+    static constexpr int chunkSize = 16;
+
+    static constexpr int chunkVolume = chunkSize * chunkSize * chunkSize;
+
+    // Full chunks allocated at once
+    static constexpr uint32_t chunksPerPage = 64;
+
+    // Slot of a chunk that isn't stored (all air)
+    static constexpr uint32_t noSlot = UINT32_MAX;
+
+    // Voxels of one chunk, one array per field, running along x, then z, then y
+    struct Chunk
+    {
+        uint8_t types[chunkVolume];
+        uint16_t liquidCounts[chunkVolume];
+    };
+
+    // Returns the voxel at a position (air where no chunk is stored)
+    StoredVoxel GetVoxel(int3 position) const;
+
+    // Sets the voxel at a position, allocating its chunk if it isn't stored and freeing it if it's now all air
+    void SetVoxel(int3 position, StoredVoxel voxel);
+
+    // Replaces every voxel of a chunk with the voxels of data and packs it, freeing the chunk if they're all air
+    void StoreChunk(int3 chunk, const Chunk& data);
+
+    // Turns every voxel of a chunk to air
+    void RemoveChunk(int3 chunk);
+
+    // Copies every voxel of a stored chunk into data, full or packed
+    void CopyChunk(uint32_t slot, Chunk& data) const;
+
+    // Packs every full chunk that wasn't written since the last call
+    void Compact();
+
+    // Returns the slot of the chunk at the given chunk coordinates, noSlot if it isn't stored
+    uint32_t Find(int3 chunk) const;
+
+    // Returns the slot of the chunk next to a stored one, direction is -1, 0 or 1 along every axis
+    uint32_t Neighbor(uint32_t slot, int3 direction) const;
+
+    // Returns a voxel relative to a stored chunk, local can reach up to a chunk past it on every axis
+    StoredVoxel Read(uint32_t slot, int3 local) const;
+
+    // Bits of index per voxel of a packed chunk, 24 for a full one (a type and a liquid count)
+    uint32_t BitsPerVoxel(uint32_t slot) const;
+
+    // Returns the chunk coordinates holding a position, and the position inside that chunk
+    static int3 ChunkOf(int3 position);
+    static int3 LocalOf(int3 position);
+
+    // Packs chunk coordinates into one number, 21 bits per axis (the key chunks are found by)
+    static uint64_t Key(int3 chunk);
+
+    // Number of chunks stored, and how many of those are packed
+    uint32_t ChunkCount() const;
+    uint32_t PackedCount() const;
+
+    // Bytes held by pages of full chunks, slots with the palettes and indices of packed chunks, the hash map and the
+    // neighbor table
+    size_t MemoryUsed() const;
+
+    private:
+
+    // Everything kept for one stored chunk
+    struct Slot
+    {
+        // Chunk coordinates
+        int3 position;
+
+        // Voxels that aren't Empty, the chunk is freed when this reaches 0
+        uint32_t occupied;
+
+        // Where the chunk is in pages while it's full, noSlot while it's packed
+        uint32_t full;
+
+        // Set by writes, cleared by Compact()
+        bool written;
+
+        // Bits per voxel in indices while packed
+        uint8_t bits;
+
+        std::vector<StoredVoxel> palette;
+        std::vector<uint64_t> indices;
+    };
+
+    // Takes a free slot for a chunk (full and all air) and links it up with the chunks around it
+    uint32_t Allocate(int3 chunk);
+
+    // Unlinks a chunk from the chunks around it, and gives back its slot and whatever it's kept in
+    void Free(uint32_t slot);
+
+    // Gives a packed chunk full storage again
+    void Unpack(uint32_t slot);
+
+    // Builds a full chunk's palette and indices and gives back its full storage (chunks with more than 256 distinct
+    // voxels stay full)
+    void Pack(uint32_t slot);
+
+    // Takes a full chunk from the pages, adding a page if they're all used, and gives one back
+    uint32_t AllocateFull();
+    void FreeFull(uint32_t full);
+
+    Chunk& FullChunk(uint32_t full);
+    const Chunk& FullChunk(uint32_t full) const;
+
+    // Returns a voxel of a stored chunk by its index in the chunk
+    StoredVoxel VoxelAt(const Slot& slot, int index) const;
+
+    // Returns where a direction is in a slot's neighbors, its opposite is at 26 minus that
+    static int NeighborIndex(int3 direction);
+
+    static int VoxelIndex(int3 local);
+
+    // Every slot, used or not
+    std::vector<Slot> slots;
+
+    // Slots that can be allocated, taken from the back
+    std::vector<uint32_t> freeSlots;
+
+    // Pages of chunksPerPage full chunks, null once none of their chunks are used
+    std::vector<std::unique_ptr<Chunk[]>> pages;
+
+    // Full chunks used in every page
+    std::vector<uint32_t> pageChunks;
+
+    // Full chunks that can be allocated, taken from the back (so recently freed ones, in pages still held, go first)
+    std::vector<uint32_t> freeFull;
+
+    // Slot of every stored chunk, by Key()
+    std::unordered_map<uint64_t, uint32_t> slotsByKey;
+
+    // Slots of the 27 chunks around every slot (itself in the middle), noSlot where no chunk is stored
+    std::vector<std::array<uint32_t, 27>> neighbors;
+
+    uint32_t packedCount = 0;
+};
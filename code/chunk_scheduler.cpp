@@ -0,0 +1,220 @@
+#include "chunk_scheduler.h"
+#include <algorithm>
+#include <cstdlib>
+
+ChunkScheduler::ChunkScheduler(int3 chunkCount, bool tracksChanges)
+    : chunkCount(chunkCount), tracksChanges(tracksChanges)
+{
+    uint32_t chunkTotal = (uint32_t)chunkCount.x * chunkCount.y * chunkCount.z;
+    clocks.resize(chunkTotal, 0);
+    waited.resize(chunkTotal, 0);
+    skippedSteps.resize(chunkTotal, 0);
+    starvedSteps.resize(chunkTotal, 0);
+    simulatedAt.resize(chunkTotal, 0);
+    quietSteps.resize(chunkTotal, 0);
+    changedLastStep.resize(chunkTotal, 0);
+    changed = std::make_unique<std::atomic<uint8_t>[]>(chunkTotal);
+    for (uint32_t i = 0; i < chunkTotal; i++)
+    {
+        changed[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+const std::vector<uint32_t>& ChunkScheduler::Schedule()
+{
+    uint32_t chunkTotal = (uint32_t)clocks.size();
+
+    // Chunks that changed since they were last looked at (or had a voxel set between steps) wake up, along with the
+    // chunks around them, since a change on the side of a chunk can let voxels next door move
+    for (uint32_t i = 0; i < chunkTotal; i++)
+    {
+        if (!changed[i].load(std::memory_order_relaxed)) {continue;}
+        changed[i].store(0, std::memory_order_relaxed);
+        changedLastStep[i] = 1;
+
+        int3 chunk = Position(i);
+        for (int y = std::max(chunk.y - 1, 0); y <= std::min(chunk.y + 1, chunkCount.y - 1); y++)
+        {
+            for (int z = std::max(chunk.z - 1, 0); z <= std::min(chunk.z + 1, chunkCount.z - 1); z++)
+            {
+                for (int x = std::max(chunk.x - 1, 0); x <= std::min(chunk.x + 1, chunkCount.x - 1); x++)
+                {
+                    quietSteps[Index({x, y, z})] = 0;
+                }
+            }
+        }
+    }
+
+    // Chunks further from the focus are due less often, on steps spread out by their index so the work stays even
+    candidates.clear();
+    for (uint32_t i = 0; i < chunkTotal; i++)
+    {
+        if (quietSteps[i] < restSteps && (tick + i) % Interval(Position(i)) == 0) {candidates.push_back(i);}
+    }
+
+    if (budget == 0 || candidates.size() <= budget)
+    {
+        scheduled = candidates;
+        return scheduled;
+    }
+
+    // Steps waited count for more close to the focus (by chunks along the furthest axis) and in chunks that are changing
+    std::vector<float> priorities(chunkTotal, 0.0f);
+    for (uint32_t i : candidates)
+    {
+        int3 offset = Position(i) - focus;
+        int distance = std::max(std::abs(offset.x), std::max(std::abs(offset.y), std::abs(offset.z)));
+        priorities[i] = (float)(waited[i] + 1) * (changedLastStep[i] ? 2.0f : 1.0f) / (float)(1 + distance);
+    }
+
+    std::nth_element(candidates.begin(), candidates.begin() + budget, candidates.end(), [&](uint32_t a, uint32_t b)
+    {
+        return priorities[a] != priorities[b] ? priorities[a] > priorities[b] : a < b;
+    });
+
+    // Simulated in order, so neighboring chunks stay close in memory
+    scheduled.assign(candidates.begin(), candidates.begin() + budget);
+    std::sort(scheduled.begin(), scheduled.end());
+    return scheduled;
+}
+
+void ChunkScheduler::Finish()
+{
+    // Resting chunks don't miss anything by not being simulated, so the step is skipped rather than missed
+    for (uint32_t i = 0; i < (uint32_t)clocks.size(); i++)
+    {
+        if (quietSteps[i] >= restSteps) {skippedSteps[i]++;}
+    }
+
+    tick++;
+
+    for (uint32_t i : candidates)
+    {
+        waited[i]++;
+    }
+
+    for (uint32_t i : scheduled)
+    {
+        waited[i] = 0;
+        clocks[i]++;
+        simulatedAt[i] = tick;
+
+        // Chunks that changed have their count reset by the next Schedule()
+        changedLastStep[i] = 0;
+        if (tracksChanges && !changed[i].load(std::memory_order_relaxed)) {quietSteps[i]++;}
+    }
+
+    // Chunks left out by the budget miss the step, and make it up through CatchUp() once they're picked
+    for (uint32_t i : candidates)
+    {
+        if (waited[i] > 0) {starvedSteps[i]++;}
+    }
+
+    CloseRotation();
+}
+
+void ChunkScheduler::MarkChanged(int3 chunk)
+{
+    std::atomic<uint8_t>& flag = changed[Index(chunk)];
+    if (!flag.load(std::memory_order_relaxed)) {flag.store(1, std::memory_order_relaxed);}
+}
+
+const std::vector<uint32_t>& ChunkScheduler::CatchUp()
+{
+    // Far chunks only make up the steps the budget left them out of, so they still aren't stepped more than they're due
+    catchingUp.clear();
+    for (uint32_t i = 0; i < (uint32_t)clocks.size(); i++)
+    {
+        if (Behind(i) == 0) {continue;}
+        bool justSimulated = simulatedAt[i] == tick && starvedSteps[i] > 0;
+        if (Interval(Position(i)) == 1 || justSimulated) {catchingUp.push_back(i);}
+    }
+
+    if (budget > 0 && catchingUp.size() > budget)
+    {
+        std::nth_element(catchingUp.begin(), catchingUp.begin() + budget, catchingUp.end(), [&](uint32_t a, uint32_t b)
+        {
+            return Behind(a) != Behind(b) ? Behind(a) > Behind(b) : a < b;
+        });
+        catchingUp.resize(budget);
+        std::sort(catchingUp.begin(), catchingUp.end());
+    }
+
+    for (uint32_t i : catchingUp)
+    {
+        clocks[i]++;
+        simulatedAt[i] = tick;
+        if (starvedSteps[i] > 0) {starvedSteps[i]--;}
+    }
+
+    CloseRotation();
+    return catchingUp;
+}
+
+uint32_t ChunkScheduler::Interval(int3 chunk) const
+{
+    if (lodDistance <= 0) {return 1;}
+
+    int3 offset = chunk - focus;
+    int distance = std::max(std::abs(offset.x), std::max(std::abs(offset.y), std::abs(offset.z)));
+
+    uint32_t interval = 1;
+    for (int ring = lodDistance; distance > ring && interval < maxInterval; ring *= 2)
+    {
+        interval *= 2;
+    }
+
+    return interval;
+}
+
+uint32_t ChunkScheduler::Clock(int3 chunk) const
+{
+    return clocks[Index(chunk)];
+}
+
+uint32_t ChunkScheduler::Behind(uint32_t index) const
+{
+    return tick - clocks[index] - skippedSteps[index];
+}
+
+uint32_t ChunkScheduler::Steps() const
+{
+    return tick;
+}
+
+uint32_t ChunkScheduler::Rotations(int64_t first, int64_t last) const
+{
+    uint32_t count = 0;
+    for (const Rotation& rotation : rotations)
+    {
+        count += (rotation.first >= first && rotation.last <= last) ? 1 : 0;
+    }
+
+    return count;
+}
+
+void ChunkScheduler::CloseRotation()
+{
+    // simulatedAt is one past the step, so a chunk simulated on the first step of the rotation has rotationStart + 1
+    for (uint32_t i = 0; i < (uint32_t)clocks.size(); i++)
+    {
+        if (quietSteps[i] < restSteps && simulatedAt[i] <= rotationStart) {return;}
+    }
+
+    rotations.push_back({rotationStart, tick - 1});
+    if (rotations.size() > rotationsKept) {rotations.pop_front();}
+    rotationStart = tick;
+}
+
+uint32_t ChunkScheduler::Index(int3 chunk) const
+{
+    return ((uint32_t)chunk.y * chunkCount.z + chunk.z) * chunkCount.x + chunk.x;
+}
+
+int3 ChunkScheduler::Position(uint32_t index) const
+{
+    int x = (int)(index % (uint32_t)chunkCount.x);
+    int z = (int)((index / (uint32_t)chunkCount.x) % (uint32_t)chunkCount.z);
+    int y = (int)(index / ((uint32_t)chunkCount.x * chunkCount.z));
+    return {x, y, z};
+}
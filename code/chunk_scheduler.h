@@ -0,0 +1,146 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Picks which chunks of the world get simulated each step, so a step costs about the same however big the world is.
+// Chunks are chunkSize voxels wide along every axis. A chunk that hasn't changed for restSteps of its own steps in a
+// row is left out until it or a chunk next to it changes. When more chunks are awake than the budget allows, the ones
+// picked are those that have waited longest, where a step waited counts for more the closer a chunk is to the focus
+// and if it changed the last time it was stepped, so every awake chunk gets its turn (far ones just less often).
+// With lodDistance set, chunks further from the focus are only due every 2nd, 4th or 8th step. Every chunk keeps its own
+// clock of the steps it has been simulated for, and once the focus comes close, a far chunk catches up on every step it
+// wasn't due on, a few passes per step. Steps the budget left a chunk out of are missed too, and it catches up on
+// those whenever it's picked again.
+// Steps are split into rotations, each ending once every awake chunk has been simulated since it began, so an idle
+// check can tell a world that stopped changing from one whose changing chunks just weren't picked.
+class ChunkScheduler
+{
+    public:
+
+    // If tracksChanges is false, nothing reports which chunks changed (the GPU doesn't read that back), so chunks never rest
+    ChunkScheduler(int3 chunkCount, bool tracksChanges);
+
+    // Picks the chunks to simulate in the next step (every awake chunk when there's no budget or it covers them all)
+    const std::vector<uint32_t>& Schedule();
+
+    // Moves the clocks of the chunks picked by Schedule() forward, and puts to rest the ones that changed nothing
+    void Finish();
+
+    // Picks the chunks that are behind on steps (see Behind()) and either near the focus or just simulated with steps
+    // left out by the budget still to make up, for one more pass of the checkerboard after Finish(), and moves their
+    // clocks forward. The most behind go first when they don't fit the budget (empty once they've all caught up).
+    const std::vector<uint32_t>& CatchUp();
+
+    // Steps between the steps a chunk is due on, from its distance to the focus
+    uint32_t Interval(int3 chunk) const;
+
+    // Notes that a voxel of a chunk changed, so it and the chunks next to it are awake for the next Schedule()
+    // (can be called from any thread)
+    void MarkChanged(int3 chunk);
+
+    // Steps a chunk has been simulated for
+    uint32_t Clock(int3 chunk) const;
+
+    // Steps a chunk missed by not being due or by being left out by the budget: every step Finish() was called for, less
+    // its clock and the steps it was left out of while resting
+    uint32_t Behind(uint32_t index) const;
+
+    // Steps Finish() has been called for (the step the next Schedule() picks chunks for, counting from 0)
+    uint32_t Steps() const;
+
+    // Number of rotations that began at step first or later and ended by step last (only the last rotationsKept
+    // rotations are remembered, so this never counts more than that)
+    uint32_t Rotations(int64_t first, int64_t last) const;
+
+    // Returns a chunk's position in the per chunk arrays, chunks run along x, then z, then y
+    uint32_t Index(int3 chunk) const;
+
+    int3 Position(uint32_t index) const;
+
+    // Width, height, and depth of a chunk in voxels
+    static constexpr int chunkSize = 16;
+
+    // Steps in a row a chunk can change nothing before it's left out, longer than it takes a voxel to fall asleep
+    static constexpr uint32_t restSteps = 16;
+
+    // Most steps apart a chunk is due on
+    static constexpr uint32_t maxInterval = 8;
+
+    // Passes of the checkerboard a step can add to catch chunks up (each one catches a chunk up by one step, so a chunk
+    // far behind takes several steps to catch up, but none of the steps it missed are dropped)
+    static constexpr int catchUpPasses = 2;
+
+    // Rotations remembered for Rotations()
+    static constexpr uint32_t rotationsKept = 64;
+
+    // Chunks along each axis
+    const int3 chunkCount;
+
+    // Most chunks to simulate per step, and per CatchUp() pass, 0 simulates every awake chunk
+    uint32_t budget = 0;
+
+    // Chunk the camera is in, chunks close to it are picked more often
+    int3 focus = {0, 0, 0};
+
+    // Chunks from the focus (along the furthest axis) that are due every step, every doubling of that distance halves
+    // how often a chunk is due, 0 makes every chunk due every step
+    int lodDistance = 0;
+
+    private:
+
+    // First and last step of a rotation
+    struct Rotation
+    {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    // Ends the current rotation if every awake chunk has been simulated since it began
+    void CloseRotation();
+
+    const bool tracksChanges;
+
+    // Chunks picked by the last Schedule()
+    std::vector<uint32_t> scheduled;
+
+    // Chunks picked by the last CatchUp()
+    std::vector<uint32_t> catchingUp;
+
+    // Steps Finish() has been called for
+    uint32_t tick = 0;
+
+    // Chunks that were awake at the last Schedule(), partly sorted by priority when they don't all fit
+    std::vector<uint32_t> candidates;
+
+    std::vector<uint32_t> clocks;
+
+    // Steps every chunk has waited since it was last simulated
+    std::vector<uint32_t> waited;
+
+    // Steps every chunk was left out of while resting, which it doesn't miss
+    std::vector<uint32_t> skippedSteps;
+
+    // Steps every chunk was due on but left out of by the budget, and hasn't caught up on yet
+    std::vector<uint32_t> starvedSteps;
+
+    // Step every chunk was last simulated in plus 1, 0 if it never was
+    std::vector<uint32_t> simulatedAt;
+
+    // Step the current rotation began on, and the last rotationsKept rotations that ended, oldest first
+    uint32_t rotationStart = 0;
+    std::deque<Rotation> rotations;
+
+    // Steps in a row every chunk has been simulated without changing
+    std::vector<uint32_t> quietSteps;
+
+    // Set when a voxel of a chunk changes, cleared when the chunk is simulated
+    std::unique_ptr<std::atomic<uint8_t>[]> changed;
+
+    // Whether each chunk changed the last time it was simulated
+    std::vector<uint8_t> changedLastStep;
+};
@@ -0,0 +1,272 @@
+#include "chunk_streamer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+ChunkStreamer::ChunkStreamer(const std::string& directory, uint32_t capacity)
+    : capacity(capacity), directory(directory)
+{
+    thread = std::thread([this]() {Stream();});
+}
+
+ChunkStreamer::~ChunkStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+
+    for (auto& [key, resident] : residents)
+    {
+        if (resident.changed) {WriteBack(resident.position);}
+    }
+}
+
+void ChunkStreamer::Update(int3 position, int3 velocity)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    tick++;
+
+    int3 chunk = ChunkPool::ChunkOf(position);
+    int3 predicted = ChunkPool::ChunkOf(position + int3{(int)(velocity.x * lookahead), (int)(velocity.y * lookahead), (int)(velocity.z * lookahead)});
+
+    // Every chunk within radius of where the camera is, and of points along the way to where it's heading (close
+    // enough that their boxes overlap). Chunks already seen in an earlier box are skipped.
+    int3 path = predicted - chunk;
+    int pathLength = std::max(std::abs(path.x), std::max(std::abs(path.y), std::abs(path.z)));
+    int centerCount = 1 + (pathLength + radius - 1) / std::max(radius, 1);
+
+    std::vector<int3> missing;
+    std::unordered_set<uint64_t> seen;
+    for (int center = 0; center < centerCount; center++)
+    {
+        int3 centerChunk = chunk + path * center / std::max(centerCount - 1, 1);
+
+        for (int y = -radius; y <= radius; y++)
+        {
+            for (int z = -radius; z <= radius; z++)
+            {
+                for (int x = -radius; x <= radius; x++)
+                {
+                    int3 wanted = centerChunk + int3{x, y, z};
+                    if (!seen.insert(ChunkPool::Key(wanted)).second) {continue;}
+
+                    // Only chunks around the camera count towards the hit rate, they're the ones needed now
+                    auto resident = residents.find(ChunkPool::Key(wanted));
+                    stats.wanted += (center == 0) ? 1 : 0;
+                    if (resident != residents.end())
+                    {
+                        stats.hits += (center == 0) ? 1 : 0;
+                        resident->second.lastUse = tick;
+                    }
+                    else
+                    {
+                        missing.push_back(wanted);
+                    }
+                }
+            }
+        }
+    }
+
+    // Nearest to the camera first
+    std::sort(missing.begin(), missing.end(), [&](int3 a, int3 b)
+    {
+        int3 offsetA = a - chunk;
+        int3 offsetB = b - chunk;
+        return offsetA.x * offsetA.x + offsetA.y * offsetA.y + offsetA.z * offsetA.z < offsetB.x * offsetB.x + offsetB.y * offsetB.y + offsetB.z * offsetB.z;
+    });
+
+    std::vector<LoadedChunk> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Queued chunks that aren't wanted anymore are dropped, chunks already loading or loaded are left to finish
+        for (int3 queued : requests)
+        {
+            pending.erase(ChunkPool::Key(queued));
+        }
+        requests.clear();
+
+        for (int3 wanted : missing)
+        {
+            if (pending.insert(ChunkPool::Key(wanted)).second) {requests.push_back(wanted);}
+        }
+
+        // Loaded chunks are taken nearest first, the rest wait for the next Update()
+        std::sort(loaded.begin(), loaded.end(), [&](const LoadedChunk& a, const LoadedChunk& b)
+        {
+            int3 offsetA = a.position - chunk;
+            int3 offsetB = b.position - chunk;
+            return offsetA.x * offsetA.x + offsetA.y * offsetA.y + offsetA.z * offsetA.z < offsetB.x * offsetB.x + offsetB.y * offsetB.y + offsetB.z * offsetB.z;
+        });
+
+        size_t count = (budget == 0) ? loaded.size() : std::min(loaded.size(), (size_t)budget);
+        std::move(loaded.begin(), loaded.begin() + count, std::back_inserter(done));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+        for (LoadedChunk& waiting : loaded)
+        {
+            stats.overBudget += waiting.heldBack ? 0 : 1;
+            waiting.heldBack = true;
+        }
+
+        stats.loads = streamedChunks;
+        stats.bytesRead = streamedBytes;
+    }
+    wake.notify_one();
+
+    for (LoadedChunk& chunkLoaded : done)
+    {
+        pending.erase(ChunkPool::Key(chunkLoaded.position));
+        Install(chunkLoaded);
+    }
+
+    Evict();
+
+    // Chunks that weren't written since the last Update() are packed
+    pool.Compact();
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    stats.updateSeconds += elapsed.count();
+}
+
+StoredVoxel ChunkStreamer::GetVoxel(int3 position)
+{
+    int3 chunk = ChunkPool::ChunkOf(position);
+    if (!IsResident(chunk)) {LoadNow(chunk);}
+    return pool.GetVoxel(position);
+}
+
+void ChunkStreamer::SetVoxel(int3 position, StoredVoxel voxel)
+{
+    int3 chunk = ChunkPool::ChunkOf(position);
+    if (!IsResident(chunk)) {LoadNow(chunk);}
+
+    pool.SetVoxel(position, voxel);
+    Resident& resident = residents[ChunkPool::Key(chunk)];
+    resident.lastUse = tick;
+    resident.changed = true;
+}
+
+void ChunkStreamer::WriteChunk(int3 chunk, const ChunkPool::Chunk& data)
+{
+    RegionFor(chunk).Write(RegionFile::Index(chunk), &data);
+}
+
+bool ChunkStreamer::IsResident(int3 chunk) const
+{
+    return residents.count(ChunkPool::Key(chunk)) != 0;
+}
+
+uint32_t ChunkStreamer::ResidentCount() const
+{
+    return (uint32_t)residents.size();
+}
+
+const ChunkPool& ChunkStreamer::Pool() const
+{
+    return pool;
+}
+
+void ChunkStreamer::Stream()
+{
+    while (true)
+    {
+        int3 chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() {return stopping || !requests.empty();});
+            if (stopping) {return;}
+
+            chunk = requests.front();
+            requests.pop_front();
+        }
+
+        LoadedChunk chunkLoaded = {chunk, std::make_unique<ChunkPool::Chunk>(), false};
+        size_t bytes = RegionFor(chunk).Read(RegionFile::Index(chunk), *chunkLoaded.data);
+        chunkLoaded.stored = bytes > 0;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        streamedChunks++;
+        streamedBytes += bytes;
+        loaded.push_back(std::move(chunkLoaded));
+    }
+}
+
+void ChunkStreamer::LoadNow(int3 chunk)
+{
+    stats.stalls++;
+
+    LoadedChunk chunkLoaded = {chunk, std::make_unique<ChunkPool::Chunk>(), false};
+    chunkLoaded.stored = RegionFor(chunk).Read(RegionFile::Index(chunk), *chunkLoaded.data) > 0;
+    Install(chunkLoaded);
+}
+
+void ChunkStreamer::Install(LoadedChunk& chunkLoaded)
+{
+    // Loaded on the spot in the meantime (and maybe changed since), so this copy is stale
+    uint64_t key = ChunkPool::Key(chunkLoaded.position);
+    if (residents.count(key)) {return;}
+
+    if (chunkLoaded.stored) {pool.StoreChunk(chunkLoaded.position, *chunkLoaded.data);}
+    residents[key] = {chunkLoaded.position, tick, false};
+    stats.installed++;
+}
+
+void ChunkStreamer::Evict()
+{
+    if (residents.size() <= capacity) {return;}
+
+    // Chunks loaded on the spot while a load of them was still on its way stay until that load is thrown away, so it
+    // can't come back over what was written
+    std::vector<Resident> oldest;
+    for (auto& [key, resident] : residents)
+    {
+        if (resident.lastUse < tick && !pending.count(key)) {oldest.push_back(resident);}
+    }
+
+    size_t count = std::min(oldest.size(), residents.size() - capacity);
+    std::partial_sort(oldest.begin(), oldest.begin() + count, oldest.end(), [](const Resident& a, const Resident& b)
+    {
+        return a.lastUse < b.lastUse;
+    });
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int3 chunk = oldest[i].position;
+        if (oldest[i].changed)
+        {
+            WriteBack(chunk);
+            stats.writeBacks++;
+        }
+
+        pool.RemoveChunk(chunk);
+        residents.erase(ChunkPool::Key(chunk));
+        stats.evictions++;
+    }
+}
+
+void ChunkStreamer::WriteBack(int3 chunk)
+{
+    uint32_t slot = pool.Find(chunk);
+    if (slot == ChunkPool::noSlot)
+    {
+        RegionFor(chunk).Write(RegionFile::Index(chunk), nullptr);
+        return;
+    }
+
+    std::unique_ptr<ChunkPool::Chunk> data = std::make_unique<ChunkPool::Chunk>();
+    pool.CopyChunk(slot, *data);
+    RegionFor(chunk).Write(RegionFile::Index(chunk), data.get());
+}
+
+RegionFile& ChunkStreamer::RegionFor(int3 chunk)
+{
+    int3 region = RegionFile::RegionOf(chunk);
+
+    std::lock_guard<std::mutex> lock(regionMutex);
+    std::unique_ptr<RegionFile>& file = regions[ChunkPool::Key(region)];
+    if (!file) {file = std::make_unique<RegionFile>(directory + "/" + RegionFile::Name(region));}
+    return *file;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "chunk_pool.h"
+#include "region_file.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Counts kept by a ChunkStreamer since it was made
+struct StreamStats
+{
+    // Chunks within radius of the camera at every Update(), and how many of those were already resident
+    uint64_t wanted;
+    uint64_t hits;
+
+    // Chunks read from region files by the streaming thread, and the bytes read for them (as of the last Update())
+    uint64_t loads;
+    uint64_t bytesRead;
+
+    // Chunks put in the pool by Update(), and chunks that finished loading but had to wait for a later Update() (each
+    // counted once, however many Updates it waited through)
+    uint64_t installed;
+    uint64_t overBudget;
+
+    // Chunks evicted, and how many of those had changed and were written back
+    uint64_t evictions;
+    uint64_t writeBacks;
+
+    // Chunks GetVoxel() or SetVoxel() had to load on the spot because they weren't resident
+    uint64_t stalls;
+
+    // Time spent inside Update()
+    double updateSeconds;
+};
+
+// Keeps the chunks around a moving camera resident in a ChunkPool, out of a directory of RegionFiles holding a world
+// too big to keep in memory. Every Update() asks for the chunks within radius of the camera and of the way to where it
+// will be lookahead seconds later at its current velocity, nearest first. A background thread reads them from the
+// region files, and Update() puts up to budget of the ones done into the pool. Once more than capacity chunks are
+// resident, the ones used least recently are evicted, and written back first if they were changed. Chunks come into the
+// pool packed, are unpacked when written, and are packed again by the first Update() they go unwritten through.
+class ChunkStreamer
+{
+    public:
+
+    ChunkStreamer(const std::string& directory, uint32_t capacity);
+
+    // Stops the streaming thread and writes back every changed chunk
+    ~ChunkStreamer();
+
+    // Requests the chunks around the camera (positions in voxels, velocity in voxels per second), puts loaded chunks
+    // in the pool and evicts chunks over capacity
+    void Update(int3 position, int3 velocity);
+
+    // Returns a voxel, loading its chunk first if it isn't resident
+    StoredVoxel GetVoxel(int3 position);
+
+    // Sets a voxel, loading its chunk first if it isn't resident, and marks the chunk to be written back
+    void SetVoxel(int3 position, StoredVoxel voxel);
+
+    // Writes a chunk straight into its region file, for filling the world before streaming it (the chunk must not
+    // be resident)
+    void WriteChunk(int3 chunk, const ChunkPool::Chunk& data);
+
+    // Indicates if a chunk is in the pool (or known to be all air)
+    bool IsResident(int3 chunk) const;
+
+    // Chunks that are resident, and the pool holding the ones that aren't all air
+    uint32_t ResidentCount() const;
+    const ChunkPool& Pool() const;
+
+    StreamStats stats = {};
+
+    // Chunks from the camera, along the furthest axis, kept resident
+    int radius = 3;
+
+    // Seconds ahead the camera's position is predicted to stream chunks in before it gets there
+    float lookahead = 1.0f;
+
+    // Most loaded chunks put in the pool per Update(), 0 puts in all of them
+    uint32_t budget = 64;
+
+    // Most chunks resident before the least recently used ones are evicted
+    const uint32_t capacity;
+
+    private:
+
+    // A chunk read by the streaming thread, waiting to be put in the pool
+    struct LoadedChunk
+    {
+        int3 position;
+        std::unique_ptr<ChunkPool::Chunk> data;
+        bool stored;
+
+        // Set once an Update() has left it waiting, so it's only counted in stats.overBudget once
+        bool heldBack = false;
+    };
+
+    struct Resident
+    {
+        int3 position;
+
+        // Update() the chunk was last wanted by or written in
+        uint64_t lastUse;
+
+        bool changed;
+    };
+
+    // Body of the streaming thread
+    void Stream();
+
+    // Loads a chunk right away (when it's read or written without being resident)
+    void LoadNow(int3 chunk);
+
+    // Puts a loaded chunk in the pool, unless it's become resident since it was asked for
+    void Install(LoadedChunk& loaded);
+
+    // Evicts least recently used chunks down to capacity (chunks used in this Update() are kept)
+    void Evict();
+
+    // Writes a resident chunk to its region file
+    void WriteBack(int3 chunk);
+
+    // Returns the region file of a chunk, opening it the first time (can be called from any thread)
+    RegionFile& RegionFor(int3 chunk);
+
+    const std::string directory;
+
+    ChunkPool pool;
+
+    // Every resident chunk, by ChunkPool::Key()
+    std::unordered_map<uint64_t, Resident> residents;
+
+    // Chunks asked for and not yet put in the pool, whether they're queued, loading or loaded
+    std::unordered_set<uint64_t> pending;
+
+    // Number of Update() calls so far
+    uint64_t tick = 0;
+
+    // Shared with the streaming thread, guarded by mutex: chunks to load (nearest first) and chunks loaded
+    std::deque<int3> requests;
+    std::vector<LoadedChunk> loaded;
+    uint64_t streamedChunks = 0;
+    uint64_t streamedBytes = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    std::unordered_map<uint64_t, std::unique_ptr<RegionFile>> regions;
+    std::mutex regionMutex;
+
+    std::thread thread;
+};
@@ -0,0 +1,50 @@
+#include "column_map.h"
+
+// Raises an atomic height to a value if it's below it
+static void AtomicMax(std::atomic<int32_t>& height, int32_t value)
+{
+    int32_t current = height.load(std::memory_order_relaxed);
+    while (current < value && !height.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+ColumnMap::ColumnMap(int sizeX, int sizeZ)
+    : sizeX(sizeX), sizeZ(sizeZ)
+{
+    uint32_t columnCount = (uint32_t)sizeX * sizeZ;
+    topSolids = std::make_unique<std::atomic<int32_t>[]>(columnCount);
+    topLiquids = std::make_unique<std::atomic<int32_t>[]>(columnCount);
+
+    for (uint32_t i = 0; i < columnCount; i++)
+    {
+        topSolids[i].store(-1, std::memory_order_relaxed);
+        topLiquids[i].store(-1, std::memory_order_relaxed);
+    }
+}
+
+int ColumnMap::TopSolid(int x, int z) const
+{
+    return topSolids[z * sizeX + x].load(std::memory_order_relaxed);
+}
+
+int ColumnMap::TopLiquid(int x, int z) const
+{
+    return topLiquids[z * sizeX + x].load(std::memory_order_relaxed);
+}
+
+int ColumnMap::Top(int x, int z) const
+{
+    int topSolid = TopSolid(x, z);
+    int topLiquid = TopLiquid(x, z);
+    return topSolid > topLiquid ? topSolid : topLiquid;
+}
+
+void ColumnMap::Raise(int x, int z, int y, bool isLiquid)
+{
+    AtomicMax(isLiquid ? topLiquids[z * sizeX + x] : topSolids[z * sizeX + x], y);
+}
+
+void ColumnMap::Set(int x, int z, int topSolid, int topLiquid)
+{
+    topSolids[z * sizeX + x].store(topSolid, std::memory_order_relaxed);
+    topLiquids[z * sizeX + x].store(topLiquid, std::memory_order_relaxed);
+}
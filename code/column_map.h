@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Height of the topmost solid voxel of every (x, z) column of the world, and of the topmost liquid voxel above it,
+// -1 when there isn't one (Column in column_map.hlsl). CpuSimulation sets every column exactly once a step, and in
+// between only ever raises them as voxels are written, so the top of a column can look higher than it is, but never lower.
+// Columns are changed atomically, so voxels in the same column can be written from different threads.
+class ColumnMap
+{
+    public:
+
+    ColumnMap(int sizeX, int sizeZ);
+
+    int TopSolid(int x, int z) const;
+
+    int TopLiquid(int x, int z) const;
+
+    // Height of the topmost voxel of either kind, -1 when the column is empty
+    int Top(int x, int z) const;
+
+    // Raises the topmost solid or liquid of a column to y if it's below it
+    void Raise(int x, int z, int y, bool isLiquid);
+
+    // Replaces both heights of a column
+    void Set(int x, int z, int topSolid, int topLiquid);
+
+    // Width and depth of the world
+    const int sizeX;
+
+    const int sizeZ;
+
+    private:
+
+    std::unique_ptr<std::atomic<int32_t>[]> topSolids;
+
+    std::unique_ptr<std::atomic<int32_t>[]> topLiquids;
+};
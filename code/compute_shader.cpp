@@ -1,11 +1,31 @@
 #include "compute_shader.h"
 #include "d3dcompiler.h"
 #include "debug.h"
+#include <vector>
 
-ComputeShader::ComputeShader(LPCWSTR filePath, LPCSTR functionName)
+ComputeShader::ComputeShader(LPCWSTR filePath, LPCSTR functionName, const ShaderDefines& defines)
 {
     const LPCSTR featureLevel = "cs_5_0";
 
+    // If this permutation was already compiled, reuse it
+    char narrowFilePath[MAX_PATH] = {};
+    WideCharToMultiByte(CP_UTF8, 0, filePath, -1, narrowFilePath, MAX_PATH, nullptr, nullptr);
+    std::string key = PermutationCache<ID3D11ComputeShader*>::Key(narrowFilePath, functionName, defines);
+
+    if (ID3D11ComputeShader** cached = permutations.Find(key))
+    {
+        shaderPtr = *cached;
+        return;
+    }
+
+    // Defines, terminated by a null entry
+    std::vector<D3D_SHADER_MACRO> macros;
+    for (const auto& define : defines)
+    {
+        macros.push_back({define.first.c_str(), define.second.c_str()});
+    }
+    macros.push_back({nullptr, nullptr});
+
     // Blobs
     ID3DBlob* errorBlob = nullptr;
     ID3DBlob* computeBlob = nullptr;
@@ -17,7 +37,7 @@ ComputeShader::ComputeShader(LPCWSTR filePath, LPCSTR functionName)
     // Compile compute shader
     HRESULT HR = D3DCompileFromFile(
         filePath,
-        nullptr, // Defines (using none for now)
+        macros.data(),
         D3D_COMPILE_STANDARD_FILE_INCLUDE,
         functionName,
         featureLevel,
@@ -33,6 +53,8 @@ ComputeShader::ComputeShader(LPCWSTR filePath, LPCSTR functionName)
 
     // Set private data
     shaderPtr->SetPrivateData(WKPDID_D3DDebugObjectName, lstrlenA(functionName), functionName);
+
+    permutations.Insert(key, shaderPtr);
 };
 
 void ComputeShader::Dispatch(UINT x, UINT y, UINT z)
@@ -41,3 +63,10 @@ void ComputeShader::Dispatch(UINT x, UINT y, UINT z)
     Graphics::context->Dispatch(x, y, z);
     Graphics::context->CSSetShader(nullptr, nullptr, 0);
 }
+
+void ComputeShader::DispatchIndirect(ID3D11Buffer* argBuffer, UINT offset)
+{
+    Graphics::context->CSSetShader(shaderPtr, nullptr, 0);
+    Graphics::context->DispatchIndirect(argBuffer, offset);
+    Graphics::context->CSSetShader(nullptr, nullptr, 0);
+}
@@ -1,24 +1,24 @@
 #pragma once
 
 #include "graphics.h"
+#include "shader_permutation.h"
 
 class ComputeShader
 {
     public:
 
-    ComputeShader(LPCWSTR filePath, LPCSTR functionName = "Compute");
+    // Defines are passed to the shader's preprocessor, each set of defines compiles (and caches) its own permutation
+    ComputeShader(LPCWSTR filePath, LPCSTR functionName = "Compute", const ShaderDefines& defines = {});
 
     void Dispatch(UINT x, UINT y, UINT z);
 
+    // Dispatches with thread group counts read from a buffer on the GPU (3 uints starting at offset bytes)
+    void DispatchIndirect(ID3D11Buffer* argBuffer, UINT offset = 0);
+
     private:
 
     ID3D11ComputeShader* shaderPtr = nullptr;
-};
 
-// TODO: make a way to set defines, like so:
-// const D3D_SHADER_MACRO defines[] = 
-// {
-//     "USE_STRUCTURED_BUFFERS", "1",
-//     "TEST_DOUBLE", "1",
-//     nullptr, nullptr
-// };
\ No newline at end of file
+    // Every permutation compiled so far, shared by all compute shaders
+    static inline PermutationCache<ID3D11ComputeShader*> permutations;
+};
@@ -0,0 +1,1674 @@
+#ifndef CPU_SIMULATION_CPP
+#define CPU_SIMULATION_CPP
+
+#include "cpu_simulation.h"
+#include <algorithm>
+#include <cmath>
+
+template <typename Layout>
+CpuSimulation<Layout>::CpuSimulation(int3 worldSize, JobSystem* jobs)
+    : worldSize(worldSize), paddedWorldSize(worldSize + int3{2 * WORLD_BORDER, 2 * WORLD_BORDER, 2 * WORLD_BORDER}),
+      chunks((worldSize + int3{chunkSize - 1, chunkSize - 1, chunkSize - 1}) / chunkSize, true),
+      occupancy(paddedWorldSize), awake(paddedWorldSize), tree(worldSize), columns(worldSize.x, worldSize.z), jobs(jobs)
+{
+    uint32_t voxelCount = (uint32_t)paddedWorldSize.x * paddedWorldSize.y * paddedWorldSize.z;
+    types.resize(voxelCount, Empty);
+    updated.resize(voxelCount, 0);
+    liquid.resize(voxelCount, 0);
+    quiet.resize(voxelCount, 0);
+    fallSpeed.resize(voxelCount, 0);
+
+    buckets.resize((jobs ? jobs->ThreadCount() : 1) * materialClassCount);
+    changedVoxels.resize((jobs ? jobs->ThreadCount() : 1) * changedStride, 0);
+    reactedLiquid.resize((jobs ? jobs->ThreadCount() : 1) * materialCount, 0);
+
+    uint32_t columnCount = (uint32_t)worldSize.x * worldSize.z;
+    pools.resize(columnCount);
+    pipeX.resize(columnCount, 0);
+    pipeZ.resize(columnCount, 0);
+
+    // Everything starts awake
+    for (int y = 0; y < paddedWorldSize.y; y++)
+    {
+        for (int z = 0; z < paddedWorldSize.z; z++)
+        {
+            for (int word = 0; word < awake.wordsPerRow; word++)
+            {
+                awake.Update(y, z, word, ~0ull, 0);
+            }
+        }
+    }
+
+    // Every label chunk starts out dirty, so the first LabelLiquids() labels the whole world
+    uint32_t labelChunkTotal = (uint32_t)chunks.chunkCount.x * chunks.chunkCount.y * chunks.chunkCount.z;
+    chunkLabels.resize((size_t)labelChunkTotal * chunkSize * chunkSize * chunkSize, 0);
+    chunkBodies.resize(labelChunkTotal);
+    firstChunkBody.resize(labelChunkTotal, 0);
+    dirtyLabelChunks = std::make_unique<std::atomic<uint8_t>[]>(labelChunkTotal);
+    for (uint32_t i = 0; i < labelChunkTotal; i++)
+    {
+        dirtyLabelChunks[i].store(1, std::memory_order_relaxed);
+    }
+
+    // The same for the occupancy tree, the first UpdateOccupancyTree() reads the whole world
+    dirtyTreeChunks = std::make_unique<std::atomic<uint8_t>[]>(labelChunkTotal);
+    for (uint32_t i = 0; i < labelChunkTotal; i++)
+    {
+        dirtyTreeChunks[i].store(1, std::memory_order_relaxed);
+    }
+
+    insideRow.resize(occupancy.wordsPerRow, 0);
+    for (int x = WORLD_BORDER; x < worldSize.x + WORLD_BORDER; x++)
+    {
+        insideRow[x >> 6] |= 1ull << (x & 63);
+    }
+
+    SelectColumns(nullptr);
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Initialize()
+{
+    int border = WORLD_BORDER;
+
+    for (int y = -border; y < worldSize.y + border; y++)
+    {
+        for (int z = -border; z < worldSize.z + border; z++)
+        {
+            for (int x = -border; x < worldSize.x + border; x++)
+            {
+                int3 voxelPos = {x, y, z};
+
+                if (!InBounds(voxelPos))
+                {
+                    StoreVoxel(voxelPos, {Wall, false, 0});
+                }
+
+                else if (voxelPos.y < 3)
+                {
+                    StoreVoxel(voxelPos, {Sand, false, 0});
+                }
+            }
+        }
+    }
+
+    SelectColumns(nullptr);
+    SummarizeColumns();
+
+    // The walls and sand are stored without being counted as changes, so the next mesh is made no matter what
+    changesAtLastMesh = UINT64_MAX;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Fill(int3 min, int3 max, VoxelType type)
+{
+    uint16_t liquidCount = IsLiquid(type) ? maxLiquid : 0;
+
+    for (int y = min.y; y < max.y; y++)
+    {
+        for (int z = min.z; z < max.z; z++)
+        {
+            for (int x = min.x; x < max.x; x++)
+            {
+                if (InBounds({x, y, z}))
+                {
+                    SetVoxel({x, y, z}, {type, false, liquidCount});
+                }
+            }
+        }
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Save(ChunkPool& pool, int3 origin) const
+{
+    for (int y = 0; y < worldSize.y; y++)
+    {
+        for (int z = 0; z < worldSize.z; z++)
+        {
+            for (int x = 0; x < worldSize.x; x++)
+            {
+                CpuVoxel voxel = GetVoxel({x, y, z});
+                pool.SetVoxel(origin + int3{x, y, z}, {voxel.type, voxel.liquidCount});
+            }
+        }
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Load(const ChunkPool& pool, int3 origin)
+{
+    for (int y = 0; y < worldSize.y; y++)
+    {
+        for (int z = 0; z < worldSize.z; z++)
+        {
+            for (int x = 0; x < worldSize.x; x++)
+            {
+                StoredVoxel voxel = pool.GetVoxel(origin + int3{x, y, z});
+                SetVoxel({x, y, z}, {voxel.type, false, voxel.liquidCount});
+            }
+        }
+    }
+
+    // Voxels cleared by the load may have lowered columns, which SetVoxel() never does
+    SelectColumns(nullptr);
+    SummarizeColumns();
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Step(int time)
+{
+    this->time = time;
+
+    // Chunks due this step are picked first, so the column passes only cover the columns they're in (the rest of the
+    // world keeps its summary and pools from the last step it was in)
+    const std::vector<uint32_t>& scheduled = chunks.Schedule();
+    SelectColumns(&scheduled);
+
+    // The common case of solids falling through air doesn't need the checkerboard, it's done column by column first,
+    // and the moved voxels are marked as updated so StepVoxelAs skips them
+    FallSolids();
+
+    // Columns are exact from here on, until voxels are written above them (the same point FallColumns writes them)
+    SummarizeColumns();
+
+    if (liquidSolver == LiquidSolver::Pipes)
+    {
+        FlowPipes();
+    }
+
+    // Run the checkerboard over the chunks due this step
+    StepCheckerboard(scheduled);
+    chunks.Finish();
+
+    // Chunks that came close to the focus make up for the steps they missed while far away, one pass at a time. Every
+    // pass is a step of its own for them, so their voxels can be updated again.
+    for (int pass = 0; pass < ChunkScheduler::catchUpPasses; pass++)
+    {
+        const std::vector<uint32_t>& behind = chunks.CatchUp();
+        if (behind.empty()) {break;}
+
+        std::fill(updated.begin(), updated.end(), 0);
+        StepCheckerboard(behind);
+    }
+
+    // Reset the updated status of all voxels (ResetUpdatedStatus)
+    std::fill(updated.begin(), updated.end(), 0);
+
+    // Voxels set between steps count towards the step after them, like edits on the GPU (PrepareMesh)
+    uint64_t changes = CountedChanges();
+    lastStepChanges = (uint32_t)(changes - changesAtLastStep);
+    changesAtLastStep = changes;
+    unchangedSteps = (lastStepChanges == 0) ? unchangedSteps + 1 : 0;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::StepCheckerboard(const std::vector<uint32_t>& chunkList)
+{
+    int gap = 4;
+    bool allChunks = chunkList.size() == (size_t)chunks.chunkCount.x * chunks.chunkCount.y * chunks.chunkCount.z;
+
+    // Same list CompactActive builds on the GPU: adds the occupied, awake voxels of a word that are in mask to the
+    // buckets, leaving out voxels already updated this step, and static voxels that don't react with anything. Nothing
+    // a voxel does reaches another voxel of the same phase, so each word is read once.
+    auto listWord = [&](std::vector<int3>* threadBuckets, int y, int z, int word, uint64_t mask)
+    {
+        uint64_t bits = occupancy.Word(y + WORLD_BORDER, z + WORLD_BORDER, word) & awake.Word(y + WORLD_BORDER, z + WORLD_BORDER, word) & insideRow[word] & mask;
+
+        while (bits)
+        {
+            int x = word * 64 + LowestBit(bits) - WORLD_BORDER;
+            bits &= bits - 1;
+
+            uint32_t index = PositionToIndex({x, y, z});
+            if (updated[index]) {continue;}
+
+            uint8_t type = types[index];
+            MaterialClass materialClass = materialClasses[type];
+            if (materialClass == MaterialClass::Static && materials[type].reactsWith == Empty) {continue;}
+
+            threadBuckets[(int)materialClass].push_back({x, y, z});
+        }
+    };
+
+    // Every bucket is stepped by the copy of the rules made for its class, so the rules don't branch on type
+    auto stepBuckets = [&](std::vector<int3>* threadBuckets)
+    {
+        StepBucket<MaterialClass::Static>(threadBuckets[(int)MaterialClass::Static]);
+        StepBucket<MaterialClass::Solid>(threadBuckets[(int)MaterialClass::Solid]);
+        StepBucket<MaterialClass::Granular>(threadBuckets[(int)MaterialClass::Granular]);
+        StepBucket<MaterialClass::Liquid>(threadBuckets[(int)MaterialClass::Liquid]);
+    };
+
+    // Run simulation in checkerboard pattern, in the same order as VoxelSim::Step(). Like the GPU dispatches, voxels
+    // in the same phase are gap apart, and every phase has to finish before the next one starts.
+    for (int offsetX = 0; offsetX < gap; offsetX++)
+    {
+        for (int offsetY = 0; offsetY < gap; offsetY++)
+        {
+            for (int offsetZ = 0; offsetZ < gap; offsetZ++)
+            {
+                // Bits of an occupancy word this phase updates (64 is a multiple of gap, so it's the same for every word)
+                uint64_t phaseBits = 0;
+                for (int bit = 0; bit < 64; bit++)
+                {
+                    if (((bit - WORLD_BORDER - offsetX) % gap + gap) % gap == 0) {phaseBits |= 1ull << bit;}
+                }
+
+                // Voxels in a phase never reach each other, so stepping them out of order of x changes nothing
+                if (allChunks)
+                {
+                    // Number of rows this phase updates along y and z
+                    int3 count = {1, (worldSize.y - offsetY + gap - 1) / gap, (worldSize.z - offsetZ + gap - 1) / gap};
+
+                    // Every block of rows is a job, its voxels are sorted into one bucket per material class
+                    ForEachBlock(count, {1, 4, 4}, [&](int3 blockMin, int3 blockMax)
+                    {
+                        std::vector<int3>* threadBuckets = &buckets[(jobs ? JobSystem::ThreadIndex() : 0) * materialClassCount];
+
+                        for (int y = offsetY + blockMin.y * gap; y < offsetY + blockMax.y * gap; y += gap)
+                        {
+                            for (int z = offsetZ + blockMin.z * gap; z < offsetZ + blockMax.z * gap; z += gap)
+                            {
+                                for (int word = 0; word < occupancy.wordsPerRow; word++)
+                                {
+                                    listWord(threadBuckets, y, z, word, phaseBits);
+                                }
+                            }
+                        }
+
+                        stepBuckets(threadBuckets);
+                    });
+                }
+                else
+                {
+                    // Every chunk in the list is a job, and only the bits of its own part of each row are listed
+                    ForEachBlock({(int)chunkList.size(), 1, 1}, {1, 1, 1}, [&](int3 blockMin, int3 blockMax)
+                    {
+                        std::vector<int3>* threadBuckets = &buckets[(jobs ? JobSystem::ThreadIndex() : 0) * materialClassCount];
+
+                        for (int i = blockMin.x; i < blockMax.x; i++)
+                        {
+                            int3 chunkMin = chunks.Position(chunkList[i]) * chunkSize;
+                            int3 chunkMax = chunkMin + int3{chunkSize, chunkSize, chunkSize};
+                            chunkMax = {std::min(chunkMax.x, worldSize.x), std::min(chunkMax.y, worldSize.y), std::min(chunkMax.z, worldSize.z)};
+
+                            // Stored x range of the chunk, which can straddle two words
+                            int firstX = chunkMin.x + WORLD_BORDER;
+                            int lastX = chunkMax.x - 1 + WORLD_BORDER;
+
+                            for (int y = chunkMin.y + ((offsetY - chunkMin.y) % gap + gap) % gap; y < chunkMax.y; y += gap)
+                            {
+                                for (int z = chunkMin.z + ((offsetZ - chunkMin.z) % gap + gap) % gap; z < chunkMax.z; z += gap)
+                                {
+                                    for (int word = firstX / 64; word <= lastX / 64; word++)
+                                    {
+                                        int lowBit = std::max(firstX - word * 64, 0);
+                                        int highBit = std::min(lastX - word * 64, 63);
+                                        uint64_t chunkBits = (highBit == 63 ? ~0ull : (1ull << (highBit + 1)) - 1) & ~((1ull << lowBit) - 1);
+
+                                        listWord(threadBuckets, y, z, word, chunkBits & phaseBits);
+                                    }
+                                }
+                            }
+                        }
+
+                        stepBuckets(threadBuckets);
+                    });
+                }
+            }
+        }
+    }
+
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::SelectColumns(const std::vector<uint32_t>* chunkList)
+{
+    const int3& chunkCount = chunks.chunkCount;
+    selectedChunkColumns.assign((size_t)chunkCount.x * chunkCount.z, chunkList ? 0 : 1);
+    if (chunkList)
+    {
+        for (uint32_t chunk : *chunkList)
+        {
+            int3 position = chunks.Position(chunk);
+            selectedChunkColumns[position.z * chunkCount.x + position.x] = 1;
+        }
+    }
+
+    selectedRows.assign((size_t)chunkCount.z * occupancy.wordsPerRow, 0);
+    for (int chunkZ = 0; chunkZ < chunkCount.z; chunkZ++)
+    {
+        uint64_t* row = &selectedRows[chunkZ * occupancy.wordsPerRow];
+        for (int chunkX = 0; chunkX < chunkCount.x; chunkX++)
+        {
+            if (!selectedChunkColumns[chunkZ * chunkCount.x + chunkX]) {continue;}
+
+            for (int x = chunkX * chunkSize; x < std::min((chunkX + 1) * chunkSize, worldSize.x); x++)
+            {
+                int storedX = x + WORLD_BORDER;
+                row[storedX >> 6] |= 1ull << (storedX & 63);
+            }
+        }
+    }
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::ColumnSelected(int x, int z) const
+{
+    return selectedChunkColumns[(z / chunkSize) * chunks.chunkCount.x + x / chunkSize] != 0;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::FallSolids()
+{
+    // Columns don't affect each other, so blocks of rows along z run in parallel. Each block walks up from the bottom,
+    // so a whole column of sand falls together, and a voxel falling several voxels only lands in rows already done.
+    ForEachBlock({1, 1, worldSize.z}, {1, 1, 4}, [&](int3 blockMin, int3 blockMax)
+    {
+        for (int y = 0; y < worldSize.y; y++)
+        {
+            for (int z = blockMin.z; z < blockMax.z; z++)
+            {
+                int storedY = y + WORLD_BORDER;
+                int storedZ = z + WORLD_BORDER;
+                const uint64_t* selected = &selectedRows[(z / chunkSize) * occupancy.wordsPerRow];
+
+                // Only rows with something sitting on air in a selected column can have anything fall
+                bool anyOnAir = false;
+                for (int word = 0; word < occupancy.wordsPerRow && !anyOnAir; word++)
+                {
+                    anyOnAir = (occupancy.Word(storedY, storedZ, word) & ~occupancy.Word(storedY - 1, storedZ, word) & selected[word]) != 0;
+                }
+                if (!anyOnAir) {continue;}
+
+                uint32_t index = PositionToIndex({0, y, z});
+                uint32_t belowIndex = PositionToIndex({0, y - 1, z});
+
+                // Voxels already falling go first (every voxel on air without contiguous rows), one at a time
+                for (int word = 0; word < occupancy.wordsPerRow; word++)
+                {
+                    uint64_t onAir = occupancy.Word(storedY, storedZ, word) & ~occupancy.Word(storedY - 1, storedZ, word) & selected[word];
+
+                    while (onAir)
+                    {
+                        int3 voxelPos = {word * 64 + LowestBit(onAir) - WORLD_BORDER, y, z};
+                        onAir &= onAir - 1;
+
+                        uint32_t voxelIndex = PositionToIndex(voxelPos);
+                        MaterialClass materialClass = materialClasses[types[voxelIndex]];
+                        if (materialClass != MaterialClass::Solid && materialClass != MaterialClass::Granular) {continue;}
+
+                        if (!Layout::contiguousRows || fallSpeed[voxelIndex] != 0) {FallVoxel(voxelPos);}
+                    }
+                }
+
+                if constexpr (!Layout::contiguousRows) {continue;}
+
+                // Then every solid that was resting on air moves down one with fallKernel, a run of selected columns at a time
+                const uint8_t* selectedChunks = &selectedChunkColumns[(z / chunkSize) * chunks.chunkCount.x];
+                for (int chunkX = 0; chunkX < chunks.chunkCount.x; chunkX++)
+                {
+                    if (!selectedChunks[chunkX]) {continue;}
+
+                    int runStart = chunkX;
+                    while (chunkX + 1 < chunks.chunkCount.x && selectedChunks[chunkX + 1]) {chunkX++;}
+
+                    int first = runStart * chunkSize;
+                    int last = std::min((chunkX + 1) * chunkSize, worldSize.x);
+                    fallKernel(&types[index + first], &types[belowIndex + first], &updated[belowIndex + first], &liquid[index + first], &liquid[belowIndex + first], last - first);
+                }
+
+                // Move the occupancy bits of voxels that fell (liquids on air are left for StepVoxelAs)
+                for (int word = 0; word < occupancy.wordsPerRow; word++)
+                {
+                    uint64_t onAir = occupancy.Word(storedY, storedZ, word) & ~occupancy.Word(storedY - 1, storedZ, word) & selected[word];
+                    uint64_t fell = 0;
+
+                    // Voxels that still have air below them after falling keep falling next step
+                    uint64_t stillOnAir = ~occupancy.Word(storedY - 2, storedZ, word);
+
+                    while (onAir)
+                    {
+                        int bit = LowestBit(onAir);
+                        onAir &= onAir - 1;
+
+                        if (types[index + word * 64 + bit - WORLD_BORDER] == Empty)
+                        {
+                            fell |= 1ull << bit;
+
+                            // Both ends of every move changed
+                            int x = word * 64 + bit - WORLD_BORDER;
+                            CountChanges({x, y, z}, 1);
+                            CountChanges({x, y - 1, z}, 1);
+
+                            uint32_t toIndex = belowIndex + word * 64 + bit - WORLD_BORDER;
+                            quiet[toIndex] = 0;
+                            fallSpeed[toIndex] = (stillOnAir >> bit) & 1;
+                        }
+                    }
+
+                    if (!fell) {continue;}
+
+                    occupancy.Update(storedY, storedZ, word, 0, fell);
+                    occupancy.Update(storedY - 1, storedZ, word, fell, 0);
+
+                    // Same as SetVoxel() on both ends of every move
+                    WakeBits(storedY, storedZ, word, fell);
+                    WakeBits(storedY - 1, storedZ, word, fell);
+                }
+            }
+        }
+    });
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::SummarizeColumns()
+{
+    ForEachBlock({1, 1, worldSize.z}, {1, 1, 4}, [&](int3 blockMin, int3 blockMax)
+    {
+        for (int z = blockMin.z; z < blockMax.z; z++)
+        {
+            int storedZ = z + WORLD_BORDER;
+            const uint64_t* selected = &selectedRows[(z / chunkSize) * occupancy.wordsPerRow];
+
+            for (int word = 0; word < occupancy.wordsPerRow; word++)
+            {
+                if (!selected[word]) {continue;}
+
+                int topSolid[64];
+                int topLiquid[64];
+                std::fill(topSolid, topSolid + 64, -1);
+                std::fill(topLiquid, topLiquid + 64, -1);
+
+                // Columns outside the world or not selected are done from the start, and every other one is done once its
+                // topmost solid is found. Air is skipped a word at a time, so only voxels down to the ground have their
+                // type read.
+                uint64_t done = ~selected[word];
+                for (int y = worldSize.y - 1; y >= 0 && done != ~0ull; y--)
+                {
+                    uint64_t bits = occupancy.Word(y + WORLD_BORDER, storedZ, word) & ~done;
+
+                    while (bits)
+                    {
+                        int bit = LowestBit(bits);
+                        bits &= bits - 1;
+
+                        if (IsLiquid(types[PositionToIndex({word * 64 + bit - WORLD_BORDER, y, z})]))
+                        {
+                            if (topLiquid[bit] < 0) {topLiquid[bit] = y;}
+                        }
+                        else
+                        {
+                            topSolid[bit] = y;
+                            done |= 1ull << bit;
+                        }
+                    }
+                }
+
+                uint64_t inside = selected[word];
+                while (inside)
+                {
+                    int bit = LowestBit(inside);
+                    inside &= inside - 1;
+
+                    columns.Set(word * 64 + bit - WORLD_BORDER, z, topSolid[bit], topLiquid[bit]);
+                }
+            }
+        }
+    });
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::FlowPipes()
+{
+    // Every step of the pipe model only writes to its own column, so each runs over the selected columns of chunks in
+    // parallel. Columns that aren't selected keep their pools and pipes from the last step they were, and are left
+    // alone: pipes to them stay closed, like pipes past the edge of the world.
+    auto forEachColumn = [&](auto function)
+    {
+        ForEachBlock({chunks.chunkCount.x, 1, chunks.chunkCount.z}, {1, 1, 1}, [&](int3 blockMin, int3 blockMax)
+        {
+            if (!selectedChunkColumns[blockMin.z * chunks.chunkCount.x + blockMin.x]) {return;}
+
+            for (int z = blockMin.z * chunkSize; z < std::min(blockMax.z * chunkSize, worldSize.z); z++)
+            {
+                for (int x = blockMin.x * chunkSize; x < std::min(blockMax.x * chunkSize, worldSize.x); x++)
+                {
+                    function(x, z, z * worldSize.x + x);
+                }
+            }
+        });
+    };
+
+    forEachColumn([&](int x, int z, int column)
+    {
+        pools[column] = FindPool(x, z);
+    });
+
+    forEachColumn([&](int x, int z, int column)
+    {
+        pools[column].accepts = AcceptedType(x, z);
+    });
+
+    // Pipes past the edge of the world stay closed
+    forEachColumn([&](int x, int z, int column)
+    {
+        if (x + 1 < worldSize.x && ColumnSelected(x + 1, z)) {UpdatePipe(pools[column], pools[column + 1], pipeX[column]);}
+        else {pipeX[column] = 0;}
+
+        if (z + 1 < worldSize.z && ColumnSelected(x, z + 1)) {UpdatePipe(pools[column], pools[column + worldSize.x], pipeZ[column]);}
+        else {pipeZ[column] = 0;}
+    });
+
+    forEachColumn([&](int x, int z, int column)
+    {
+        const LiquidPool& pool = pools[column];
+
+        // Liquid flowing in from each neighbor
+        int inflow[4] =
+        {
+            x > 0 && ColumnSelected(x - 1, z) ? pipeX[column - 1] : 0,
+            z > 0 && ColumnSelected(x, z - 1) ? pipeZ[column - worldSize.x] : 0,
+            -pipeX[column],
+            -pipeZ[column],
+        };
+
+        // Pipes are only open between pools taking the same liquid, so whatever flowed in is that liquid
+        int flow = inflow[0] + inflow[1] + inflow[2] + inflow[3];
+        if (flow != 0) {FillPool(x, z, pool, pool.accepts, pool.liquid + flow);}
+    });
+}
+
+template <typename Layout>
+LiquidPool CpuSimulation<Layout>::FindPool(int x, int z) const
+{
+    int ground = columns.TopSolid(x, z);
+    LiquidPool pool = {ground, ground, Empty, Empty, 0, 0};
+
+    // Liquid voxels right above the ground, until the first voxel that isn't more of the same liquid
+    int y = pool.ground + 1;
+    for (; y < worldSize.y; y++)
+    {
+        CpuVoxel voxel = GetVoxel({x, y, z});
+        if (!IsLiquid(voxel.type) || (pool.type != Empty && voxel.type != pool.type)) {break;}
+
+        pool.top = y;
+        pool.type = voxel.type;
+        pool.liquid += voxel.liquidCount;
+        pool.room += maxLiquid - voxel.liquidCount;
+    }
+
+    // Then the air above it, which the pool can rise into
+    for (int rise = 0; rise < pipeMaxRise && y < worldSize.y && IsEmpty({x, y, z}); rise++, y++)
+    {
+        pool.room += maxLiquid;
+    }
+
+    return pool;
+}
+
+template <typename Layout>
+uint8_t CpuSimulation<Layout>::AcceptedType(int x, int z) const
+{
+    const LiquidPool& pool = pools[z * worldSize.x + x];
+    if (pool.type != Empty) {return pool.type;}
+
+    // Ties go to the first neighbor in this order, so both sides of every pipe pick the same
+    int3 neighbors[4] = {{x - 1, 0, z}, {x, 0, z - 1}, {x + 1, 0, z}, {x, 0, z + 1}};
+    uint8_t type = Empty;
+    int highest = INT32_MIN;
+    for (int3 neighbor : neighbors)
+    {
+        if (neighbor.x < 0 || neighbor.x >= worldSize.x || neighbor.z < 0 || neighbor.z >= worldSize.z) {continue;}
+        if (!ColumnSelected(neighbor.x, neighbor.z)) {continue;}
+
+        const LiquidPool& neighborPool = pools[neighbor.z * worldSize.x + neighbor.x];
+        int height = (neighborPool.ground + 1) * maxLiquid + neighborPool.liquid;
+        if (neighborPool.type != Empty && height > highest)
+        {
+            highest = height;
+            type = neighborPool.type;
+        }
+    }
+
+    return type;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::UpdatePipe(const LiquidPool& pool, const LiquidPool& neighbor, int& flow) const
+{
+    // Pipes only join pools taking the same liquid, a dry column only takes one liquid per step
+    if (pool.accepts == Empty || pool.accepts != neighbor.accepts)
+    {
+        flow = 0;
+        return;
+    }
+
+    // Height of each surface, in the same units as liquid (maxLiquid per voxel)
+    int height = (pool.ground + 1) * maxLiquid + pool.liquid;
+    int neighborHeight = (neighbor.ground + 1) * maxLiquid + neighbor.liquid;
+
+    // Flow speeds up towards the lower surface, and keeps some of what it had, so surfaces level out like a wave
+    // rather than a voxel at a time. Both sides move the same whole units, so none is made or lost.
+    flow = (int)(pipeDamping * flow + pipeAcceleration * (height - neighborHeight));
+
+    // No pipe takes more than a quarter of the liquid on its side, or fills more than a quarter of the room on the other,
+    // so no pool ever goes below empty or above the room it has, whatever its other pipes do
+    if (flow > 0) {flow = std::min(flow, std::min(pool.liquid, neighbor.room) / 4);}
+    else {flow = std::max(flow, -std::min(neighbor.liquid, pool.room) / 4);}
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::FillPool(int x, int z, const LiquidPool& pool, uint8_t type, int liquidCount)
+{
+    // Goes up from the ground until the liquid runs out and every voxel of the old pool has been rewritten
+    for (int y = pool.ground + 1; y < worldSize.y; y++)
+    {
+        if (liquidCount <= 0 && y > pool.top) {break;}
+
+        CpuVoxel voxel = GetVoxel({x, y, z});
+
+        uint16_t amount = (uint16_t)std::min(liquidCount, (int)maxLiquid);
+        liquidCount -= amount;
+
+        CpuVoxel filled = amount > 0 ? CpuVoxel{type, voxel.updatedThisStep, amount} : CpuVoxel{Empty, voxel.updatedThisStep, 0};
+        if (filled.type != voxel.type || filled.liquidCount != voxel.liquidCount)
+        {
+            SetVoxel({x, y, z}, filled);
+        }
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::FallVoxel(int3 voxelPos)
+{
+    uint32_t index = PositionToIndex(voxelPos);
+
+    int speed = std::min(fallSpeed[index] + 1, (int)maxFallSpeed);
+    int distance = FreeBelow(voxelPos, speed);
+    int3 toPos = voxelPos - int3{0, distance, 0};
+    uint32_t toIndex = PositionToIndex(toPos);
+
+    // Switch places with the air, which can hold liquid left behind by Flow() (the same as fallKernel)
+    std::swap(liquid[index], liquid[toIndex]);
+    types[toIndex] = types[index];
+    types[index] = Empty;
+    updated[toIndex] = 1;
+    quiet[toIndex] = 0;
+
+    // It keeps its speed unless it landed on something
+    fallSpeed[toIndex] = IsEmpty(toPos - int3{0, 1, 0}) ? (uint8_t)speed : 0;
+    fallSpeed[index] = 0;
+
+    occupancy.Set(voxelPos + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER}, false);
+    occupancy.Set(toPos + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER}, true);
+
+    Wake(voxelPos);
+    Wake(toPos);
+    CountChanges(voxelPos, 1);
+    CountChanges(toPos, 1);
+}
+
+template <typename Layout>
+int CpuSimulation<Layout>::FreeBelow(int3 position, int limit) const
+{
+    // Below the world is a wall, so this always stops inside the stored voxels
+    int distance = 0;
+    while (distance < limit && IsEmpty(position - int3{0, distance + 1, 0}))
+    {
+        distance++;
+    }
+
+    return distance;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::GenerateMesh(std::vector<CpuFace>& faces)
+{
+    // Nothing changed, so the faces from last time are still right
+    uint64_t changes = CountedChanges();
+    if (changes == changesAtLastMesh) {return;}
+    changesAtLastMesh = changes;
+
+    // Every thread pushes into its own list, so no locking is needed
+    std::vector<std::vector<CpuFace>> threadFaces(jobs ? jobs->ThreadCount() : 1);
+
+    ForEachBlock({1, worldSize.y, worldSize.z}, {1, 4, 4}, [&](int3 blockMin, int3 blockMax)
+    {
+        std::vector<CpuFace>& out = threadFaces[jobs ? JobSystem::ThreadIndex() : 0];
+
+        for (int y = blockMin.y; y < blockMax.y; y++)
+        {
+            for (int z = blockMin.z; z < blockMax.z; z++)
+            {
+                MeshRow(y, z, out);
+            }
+        }
+    });
+
+    faces.clear();
+    for (const std::vector<CpuFace>& list : threadFaces)
+    {
+        faces.insert(faces.end(), list.begin(), list.end());
+    }
+
+    faceCount = (uint32_t)faces.size();
+}
+
+template <typename Layout>
+template <typename Function>
+void CpuSimulation<Layout>::ForEachBlock(int3 count, int3 grainSize, const Function& function)
+{
+    if (jobs)
+    {
+        jobs->ParallelFor({0, 0, 0}, count, grainSize, function);
+    }
+    else
+    {
+        function({0, 0, 0}, count);
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::MeshRow(int y, int z, std::vector<CpuFace>& faces) const
+{
+    int storedY = y + WORLD_BORDER;
+    int storedZ = z + WORLD_BORDER;
+
+    // Occupied voxels inside the world in a neighboring row, rows in the border are all walls, which count as air here
+    auto insideWord = [&](int rowY, int rowZ, int word)
+    {
+        if (rowY < WORLD_BORDER || rowY >= worldSize.y + WORLD_BORDER || rowZ < WORLD_BORDER || rowZ >= worldSize.z + WORLD_BORDER) {return 0ull;}
+        if (word < 0 || word >= occupancy.wordsPerRow) {return 0ull;}
+        return (unsigned long long)(occupancy.Word(rowY, rowZ, word) & insideRow[word]);
+    };
+
+    for (int word = 0; word < occupancy.wordsPerRow; word++)
+    {
+        uint64_t occupied = insideWord(storedY, storedZ, word);
+        if (!occupied) {continue;}
+
+        // Bit i of each neighbor word is the neighbor of voxel i, in the same order as FACE_X_POS through FACE_Z_NEG
+        uint64_t neighbors[6] =
+        {
+            (occupied >> 1) | (insideWord(storedY, storedZ, word + 1) << 63),
+            (occupied << 1) | (insideWord(storedY, storedZ, word - 1) >> 63),
+            insideWord(storedY + 1, storedZ, word),
+            insideWord(storedY - 1, storedZ, word),
+            insideWord(storedY, storedZ + 1, word),
+            insideWord(storedY, storedZ - 1, word),
+        };
+
+        // Sides facing air or the world border are visible
+        for (int direction = 0; direction < 6; direction++)
+        {
+            uint64_t visible = occupied & ~neighbors[direction];
+
+            while (visible)
+            {
+                int3 voxelPos = {word * 64 + LowestBit(visible) - WORLD_BORDER, y, z};
+                visible &= visible - 1;
+
+                faces.push_back({voxelPos, direction, types[PositionToIndex(voxelPos)]});
+            }
+        }
+    }
+}
+
+template <typename Layout>
+CpuVoxel CpuSimulation<Layout>::GetVoxel(int3 position) const
+{
+    uint32_t index = PositionToIndex(position);
+    return {types[index], updated[index] != 0, liquid[index]};
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::SetVoxel(int3 position, CpuVoxel voxel)
+{
+    uint32_t index = PositionToIndex(position);
+    uint16_t previousLiquid = liquid[index];
+    bool wasLiquid = previousLiquid != 0;
+    uint8_t previousType = types[index];
+
+    StoreVoxel(position, voxel);
+
+    if (previousType != voxel.type || previousLiquid != voxel.liquidCount) {CountChanges(position, 1);}
+
+    // Any change to liquid can join, split or resize a body, so its label chunk is labelled again next time
+    if ((wasLiquid || voxel.liquidCount != 0) && InBounds(position))
+    {
+        std::atomic<uint8_t>& dirty = dirtyLabelChunks[chunks.Index(position / chunkSize)];
+        if (!dirty.load(std::memory_order_relaxed)) {dirty.store(1, std::memory_order_relaxed);}
+    }
+
+    // Only a different type, or liquid appearing or running out, can let a sleeping neighbor move (SetVoxel in voxel_helpers.hlsl)
+    if (previousType != voxel.type || wasLiquid != (voxel.liquidCount != 0))
+    {
+        // Whatever is here now starts counting again, and is no longer falling freely (see FallSolids)
+        quiet[index] = 0;
+        fallSpeed[index] = 0;
+
+        Wake(position);
+
+        if (voxel.type != Empty && voxel.type < materialCount && InBounds(position))
+        {
+            columns.Raise(position.x, position.z, position.y, IsLiquid(voxel.type));
+        }
+    }
+}
+
+template <typename Layout>
+const ColumnMap& CpuSimulation<Layout>::GetColumns() const
+{
+    return columns;
+}
+
+template <typename Layout>
+CpuWorldStats CpuSimulation<Layout>::CollectStats()
+{
+    // Every thread counts into its own copy, added up at the end
+    std::vector<CpuWorldStats> threadStats(jobs ? jobs->ThreadCount() : 1, CpuWorldStats{});
+
+    ForEachBlock({1, worldSize.y, worldSize.z}, {1, 4, 4}, [&](int3 blockMin, int3 blockMax)
+    {
+        CpuWorldStats& out = threadStats[jobs ? JobSystem::ThreadIndex() : 0];
+
+        for (int y = blockMin.y; y < blockMax.y; y++)
+        {
+            for (int z = blockMin.z; z < blockMax.z; z++)
+            {
+                // Only occupied voxels are read, whatever isn't occupied is Empty
+                for (int word = 0; word < occupancy.wordsPerRow; word++)
+                {
+                    uint64_t bits = occupancy.Word(y + WORLD_BORDER, z + WORLD_BORDER, word) & insideRow[word];
+
+                    while (bits)
+                    {
+                        uint32_t index = PositionToIndex({word * 64 + LowestBit(bits) - WORLD_BORDER, y, z});
+                        bits &= bits - 1;
+
+                        uint8_t type = types[index];
+                        if (type >= materialCount) {continue;}
+
+                        out.voxelCounts[type]++;
+                        if (IsLiquid(type)) {out.liquidCounts[type] += liquid[index];}
+                    }
+                }
+            }
+        }
+    });
+
+    CpuWorldStats stats = {};
+    uint32_t occupied = 0;
+    for (const CpuWorldStats& partial : threadStats)
+    {
+        for (int type = 0; type < materialCount; type++)
+        {
+            stats.voxelCounts[type] += partial.voxelCounts[type];
+            stats.liquidCounts[type] += partial.liquidCounts[type];
+            stats.liquid += partial.liquidCounts[type];
+            occupied += partial.voxelCounts[type];
+        }
+    }
+
+    for (size_t i = 0; i < reactedLiquid.size(); i++)
+    {
+        stats.reactedLiquid[i % materialCount] += reactedLiquid[i];
+    }
+
+    stats.voxelCounts[Empty] = (uint32_t)worldSize.x * worldSize.y * worldSize.z - occupied;
+
+    stats.movedVoxels = lastStepChanges;
+    stats.faceCount = faceCount;
+    stats.unchangedSteps = unchangedSteps;
+    return stats;
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::IsIdle() const
+{
+    // With a budget or lodDistance, a step only covers some chunks, so the steps that changed nothing have to hold
+    // idleSteps whole rotations of the scheduler (every awake chunk stepped idleSteps times without a change)
+    int64_t steps = chunks.Steps();
+    return unchangedSteps >= idleSteps && CountedChanges() == changesAtLastStep && chunks.Rotations(steps - unchangedSteps, steps - 1) >= idleSteps;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::CountChanges(int3 position, uint32_t count)
+{
+    changedVoxels[(jobs ? JobSystem::ThreadIndex() : 0) * changedStride] += count;
+    if (!InBounds(position)) {return;}
+
+    int3 chunk = position / chunkSize;
+    chunks.MarkChanged(chunk);
+
+    std::atomic<uint8_t>& dirty = dirtyTreeChunks[chunks.Index(chunk)];
+    if (!dirty.load(std::memory_order_relaxed)) {dirty.store(1, std::memory_order_relaxed);}
+}
+
+template <typename Layout>
+uint64_t CpuSimulation<Layout>::CountedChanges() const
+{
+    uint64_t changes = 0;
+    for (size_t i = 0; i < changedVoxels.size(); i += changedStride)
+    {
+        changes += changedVoxels[i];
+    }
+
+    return changes;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::UpdateOccupancyTree()
+{
+    // Each chunk only sets its own bricks, so dirty chunks are read in parallel
+    ForEachBlock(chunks.chunkCount, {1, 1, 1}, [&](int3 blockMin, int3 blockMax)
+    {
+        for (int chunkY = blockMin.y; chunkY < blockMax.y; chunkY++)
+        {
+            for (int chunkZ = blockMin.z; chunkZ < blockMax.z; chunkZ++)
+            {
+                for (int chunkX = blockMin.x; chunkX < blockMax.x; chunkX++)
+                {
+                    int3 chunk = {chunkX, chunkY, chunkZ};
+                    if (!dirtyTreeChunks[chunks.Index(chunk)].exchange(0, std::memory_order_relaxed)) {continue;}
+
+                    int3 origin = chunk * chunkSize;
+                    int3 end = {std::min(origin.x + chunkSize, worldSize.x), std::min(origin.y + chunkSize, worldSize.y), std::min(origin.z + chunkSize, worldSize.z)};
+
+                    for (int brickY = origin.y; brickY < end.y; brickY += 4)
+                    {
+                        for (int brickZ = origin.z; brickZ < end.z; brickZ += 4)
+                        {
+                            for (int brickX = origin.x; brickX < end.x; brickX += 4)
+                            {
+                                // 4 bits of every row of the brick, which can span two words of the occupancy grid
+                                int storedX = brickX + WORLD_BORDER;
+                                int word = storedX >> 6;
+                                int shift = storedX & 63;
+                                uint64_t bits = 0;
+                                for (int y = 0; y < 4; y++)
+                                {
+                                    for (int z = 0; z < 4; z++)
+                                    {
+                                        int storedY = brickY + y + WORLD_BORDER;
+                                        int storedZ = brickZ + z + WORLD_BORDER;
+                                        uint64_t row = occupancy.Word(storedY, storedZ, word) >> shift;
+                                        if (shift > 60) {row |= occupancy.Word(storedY, storedZ, word + 1) << (64 - shift);}
+                                        bits |= (row & 0xF) << ((y * 4 + z) * 4);
+                                    }
+                                }
+
+                                tree.SetBrick(int3{brickX, brickY, brickZ} / 4, bits);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    tree.Refresh();
+}
+
+template <typename Layout>
+const OccupancyTree& CpuSimulation<Layout>::GetOccupancyTree() const
+{
+    return tree;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::LabelLiquids()
+{
+    // Dirty chunks are labelled again, each on its own, so they're spread across threads
+    ForEachBlock(chunks.chunkCount, {1, 1, 1}, [&](int3 blockMin, int3 blockMax)
+    {
+        std::vector<uint16_t> parents;
+
+        for (int y = blockMin.y; y < blockMax.y; y++)
+        {
+            for (int z = blockMin.z; z < blockMax.z; z++)
+            {
+                for (int x = blockMin.x; x < blockMax.x; x++)
+                {
+                    if (dirtyLabelChunks[chunks.Index({x, y, z})].exchange(0, std::memory_order_relaxed))
+                    {
+                        LabelChunk({x, y, z}, parents);
+                    }
+                }
+            }
+        }
+    });
+
+    // Number the bodies of every chunk one after another, then join the ones touching across the sides of chunks with
+    // a union-find over all of them (only voxels on the sides of chunks are read)
+    uint32_t chunkBodyCount = 0;
+    for (size_t i = 0; i < chunkBodies.size(); i++)
+    {
+        firstChunkBody[i] = chunkBodyCount;
+        chunkBodyCount += (uint32_t)chunkBodies[i].size();
+    }
+
+    std::vector<uint32_t> parents(chunkBodyCount);
+    for (uint32_t i = 0; i < chunkBodyCount; i++) {parents[i] = i;}
+
+    auto find = [&](uint32_t body)
+    {
+        while (parents[body] != body)
+        {
+            parents[body] = parents[parents[body]];
+            body = parents[body];
+        }
+        return body;
+    };
+
+    int3 axes[3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+    for (int y = 0; y < chunks.chunkCount.y; y++)
+    {
+        for (int z = 0; z < chunks.chunkCount.z; z++)
+        {
+            for (int x = 0; x < chunks.chunkCount.x; x++)
+            {
+                int3 chunk = {x, y, z};
+                int3 origin = chunk * chunkSize;
+
+                for (const int3& axis : axes)
+                {
+                    int3 neighbor = chunk + axis;
+                    if (neighbor.x >= chunks.chunkCount.x || neighbor.y >= chunks.chunkCount.y || neighbor.z >= chunks.chunkCount.z) {continue;}
+
+                    // Walks the last layer of the chunk along the axis, next to the first layer of the neighbor
+                    int3 side = {axis.x ? 1 : chunkSize, axis.y ? 1 : chunkSize, axis.z ? 1 : chunkSize};
+                    int3 last = origin + axis * (chunkSize - 1);
+
+                    for (int v = 0; v < side.y; v++)
+                    {
+                        for (int w = 0; w < side.z; w++)
+                        {
+                            for (int u = 0; u < side.x; u++)
+                            {
+                                int3 position = last + int3{u, v, w};
+                                if (!InBounds(position)) {continue;}
+
+                                uint16_t label = chunkLabels[ChunkLabelIndex(position)];
+                                uint16_t neighborLabel = chunkLabels[ChunkLabelIndex(position + axis)];
+                                if (!label || !neighborLabel || types[PositionToIndex(position)] != types[PositionToIndex(position + axis)]) {continue;}
+
+                                uint32_t root = find(firstChunkBody[chunks.Index(chunk)] + label - 1);
+                                uint32_t neighborRoot = find(firstChunkBody[chunks.Index(neighbor)] + neighborLabel - 1);
+                                if (root != neighborRoot) {parents[std::max(root, neighborRoot)] = std::min(root, neighborRoot);}
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Every set of joined chunk bodies is one body
+    liquidBodies.clear();
+    bodyOfChunkLabel.assign(chunkBodyCount, noLiquidBody);
+
+    for (size_t chunk = 0; chunk < chunkBodies.size(); chunk++)
+    {
+        for (size_t i = 0; i < chunkBodies[chunk].size(); i++)
+        {
+            const CpuLiquidBody& part = chunkBodies[chunk][i];
+            uint32_t chunkBody = firstChunkBody[chunk] + (uint32_t)i;
+            uint32_t root = find(chunkBody);
+
+            if (bodyOfChunkLabel[root] == noLiquidBody)
+            {
+                bodyOfChunkLabel[root] = (uint32_t)liquidBodies.size();
+                liquidBodies.push_back({part.type, 0, 0, part.min, part.max});
+            }
+
+            CpuLiquidBody& body = liquidBodies[bodyOfChunkLabel[root]];
+            body.voxelCount += part.voxelCount;
+            body.liquid += part.liquid;
+            body.min = {std::min(body.min.x, part.min.x), std::min(body.min.y, part.min.y), std::min(body.min.z, part.min.z)};
+            body.max = {std::max(body.max.x, part.max.x), std::max(body.max.y, part.max.y), std::max(body.max.z, part.max.z)};
+
+            bodyOfChunkLabel[chunkBody] = bodyOfChunkLabel[root];
+        }
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::LabelChunk(int3 chunk, std::vector<uint16_t>& parents)
+{
+    int3 origin = chunk * chunkSize;
+    int3 end = {std::min(origin.x + chunkSize, worldSize.x), std::min(origin.y + chunkSize, worldSize.y), std::min(origin.z + chunkSize, worldSize.z)};
+    std::vector<CpuLiquidBody>& bodies = chunkBodies[chunks.Index(chunk)];
+
+    // Labels start at 1, so parents[0] is never used
+    parents.assign(1, 0);
+
+    auto find = [&](uint16_t label)
+    {
+        while (parents[label] != label)
+        {
+            parents[label] = parents[parents[label]];
+            label = parents[label];
+        }
+        return label;
+    };
+
+    // First pass: every liquid voxel takes the label of a neighbor of the same liquid before it (-x, -z, -y inside the
+    // chunk), joining the labels of the others, or a new label if there isn't one
+    for (int y = origin.y; y < end.y; y++)
+    {
+        for (int z = origin.z; z < end.z; z++)
+        {
+            for (int x = origin.x; x < end.x; x++)
+            {
+                int3 position = {x, y, z};
+                uint32_t labelIndex = ChunkLabelIndex(position);
+                uint8_t type = types[PositionToIndex(position)];
+
+                if (!IsLiquid(type))
+                {
+                    chunkLabels[labelIndex] = 0;
+                    continue;
+                }
+
+                int3 before[3] = {{x - 1, y, z}, {x, y, z - 1}, {x, y - 1, z}};
+                bool inChunk[3] = {x > origin.x, z > origin.z, y > origin.y};
+                uint16_t label = 0;
+
+                for (int i = 0; i < 3; i++)
+                {
+                    if (!inChunk[i] || types[PositionToIndex(before[i])] != type) {continue;}
+
+                    uint16_t root = find(chunkLabels[ChunkLabelIndex(before[i])]);
+                    if (!label) {label = root;}
+                    else if (root != label)
+                    {
+                        parents[std::max(root, label)] = std::min(root, label);
+                        label = std::min(root, label);
+                    }
+                }
+
+                if (!label)
+                {
+                    label = (uint16_t)parents.size();
+                    parents.push_back(label);
+                }
+
+                chunkLabels[labelIndex] = label;
+            }
+        }
+    }
+
+    // Second pass: every voxel takes the label of its set, numbered in order from 1, and is counted towards its body
+    std::vector<uint16_t> bodyOfLabel(parents.size(), 0);
+    bodies.clear();
+
+    for (int y = origin.y; y < end.y; y++)
+    {
+        for (int z = origin.z; z < end.z; z++)
+        {
+            for (int x = origin.x; x < end.x; x++)
+            {
+                int3 position = {x, y, z};
+                uint32_t labelIndex = ChunkLabelIndex(position);
+                if (!chunkLabels[labelIndex]) {continue;}
+
+                uint16_t root = find(chunkLabels[labelIndex]);
+                uint32_t index = PositionToIndex(position);
+
+                if (!bodyOfLabel[root])
+                {
+                    bodies.push_back({types[index], 0, 0, position, position});
+                    bodyOfLabel[root] = (uint16_t)bodies.size();
+                }
+
+                CpuLiquidBody& body = bodies[bodyOfLabel[root] - 1];
+                body.voxelCount++;
+                body.liquid += liquid[index];
+                body.min = {std::min(body.min.x, x), std::min(body.min.y, y), std::min(body.min.z, z)};
+                body.max = {std::max(body.max.x, x), std::max(body.max.y, y), std::max(body.max.z, z)};
+
+                chunkLabels[labelIndex] = bodyOfLabel[root];
+            }
+        }
+    }
+}
+
+template <typename Layout>
+uint32_t CpuSimulation<Layout>::ChunkLabelIndex(int3 position) const
+{
+    int3 chunk = position / chunkSize;
+    int3 local = position - chunk * chunkSize;
+    return ((chunks.Index(chunk) * chunkSize + local.y) * chunkSize + local.z) * chunkSize + local.x;
+}
+
+template <typename Layout>
+const std::vector<CpuLiquidBody>& CpuSimulation<Layout>::GetLiquidBodies() const
+{
+    return liquidBodies;
+}
+
+template <typename Layout>
+uint32_t CpuSimulation<Layout>::LiquidBodyAt(int3 position) const
+{
+    if (!InBounds(position)) {return noLiquidBody;}
+
+    uint16_t label = chunkLabels[ChunkLabelIndex(position)];
+    if (!label) {return noLiquidBody;}
+
+    return bodyOfChunkLabel[firstChunkBody[chunks.Index(position / chunkSize)] + label - 1];
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::StoreVoxel(int3 position, CpuVoxel voxel)
+{
+    uint32_t index = PositionToIndex(position);
+    types[index] = voxel.type;
+    updated[index] = voxel.updatedThisStep;
+    liquid[index] = voxel.liquidCount;
+
+    occupancy.Set(position + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER}, voxel.type != Empty);
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::Wake(int3 position)
+{
+    int3 storedPos = position + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER};
+    WakeBits(storedPos.y, storedPos.z, storedPos.x >> 6, 1ull << (storedPos.x & 63));
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::WakeBits(int y, int z, int word, uint64_t bits)
+{
+    // Sets bits of a row, skipping the atomic when they're all set already (most neighbors are already awake)
+    auto wakeRow = [&](int rowY, int rowZ, int rowWord, uint64_t rowBits)
+    {
+        if (!rowBits || rowY >= paddedWorldSize.y || rowZ < 0 || rowZ >= paddedWorldSize.z || rowWord < 0 || rowWord >= awake.wordsPerRow) {return;}
+        if ((awake.Word(rowY, rowZ, rowWord) & rowBits) != rowBits) {awake.Update(rowY, rowZ, rowWord, rowBits, 0);}
+    };
+
+    for (int rowY = y; rowY <= y + 1; rowY++)
+    {
+        // Along x, carrying into the words on either side
+        wakeRow(rowY, z, word - 1, bits << 63);
+        wakeRow(rowY, z, word, bits | (bits << 1) | (bits >> 1));
+        wakeRow(rowY, z, word + 1, bits >> 63);
+
+        wakeRow(rowY, z - 1, word, bits);
+        wakeRow(rowY, z + 1, word, bits);
+    }
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::SwitchVoxels(int3 position1, int3 position2)
+{
+    CpuVoxel voxel1 = GetVoxel(position1);
+    CpuVoxel voxel2 = GetVoxel(position2);
+
+    SetVoxel(position2, voxel1);
+    SetVoxel(position1, voxel2);
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::InBounds(int3 position) const
+{
+    return !(
+        position.x > worldSize.x - 1 ||
+        position.x < 0 ||
+        position.y > worldSize.y - 1 ||
+        position.y < 0 ||
+        position.z > worldSize.z - 1 ||
+        position.z < 0
+    );
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::IsEmpty(int3 position) const
+{
+    return !occupancy.Get(position + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER});
+}
+
+template <typename Layout>
+uint32_t CpuSimulation<Layout>::PositionToIndex(int3 position) const
+{
+    return Layout::Index(position + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER}, paddedWorldSize);
+}
+
+template <typename Layout>
+float CpuSimulation<Layout>::PseudoRandom(float seed)
+{
+    float value = std::sin(seed) * 43758.5453f;
+    return value - std::floor(value);
+}
+
+// The rules below are straight ports of the functions with the same names in simulation.hlsl
+
+template <typename Layout>
+bool CpuSimulation<Layout>::Flow(int3 fromPos, int3 toPos)
+{
+    CpuVoxel fromVoxel = GetVoxel(fromPos);
+    CpuVoxel toVoxel = GetVoxel(toPos);
+
+    // If fromVoxel doesn't contain liquid, flow fails
+    if (fromVoxel.liquidCount == 0) {return false;}
+
+    // If toVoxel isn't empty, and isn't same liquid type, flow fails (this includes walls)
+    if (toVoxel.type != Empty && toVoxel.type != fromVoxel.type) {return false;}
+
+    int combinedLiquid = fromVoxel.liquidCount + toVoxel.liquidCount;
+    toVoxel.type = fromVoxel.type;
+
+    // If their combined fluid is above max allowable per voxel
+    if (combinedLiquid > maxLiquid)
+    {
+        // Put max liquid into toVoxel
+        toVoxel.liquidCount = maxLiquid;
+        SetVoxel(toPos, toVoxel);
+
+        // Put remaining liquid into fromVoxel
+        fromVoxel.liquidCount = (uint16_t)(combinedLiquid - maxLiquid);
+        SetVoxel(fromPos, fromVoxel);
+    }
+
+    // Otherwise, their combined fluid can fit into toVoxel
+    else
+    {
+        toVoxel.liquidCount = (uint16_t)combinedLiquid;
+        SetVoxel(toPos, toVoxel);
+        SetVoxel(fromPos, {Empty, false, 0});
+    }
+
+    return true;
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::Displace(int3 fromPos, int3 toPos)
+{
+    CpuVoxel fromVoxel = GetVoxel(fromPos);
+    CpuVoxel toVoxel = GetVoxel(toPos);
+
+    // If voxel to displace is liquid, displace fails
+    if (fromVoxel.liquidCount > 0) {return false;}
+
+    // If voxel to displace doesn't contain any liquid, displace fails
+    if (toVoxel.liquidCount == 0) {return false;}
+
+    int3 adjacent[4] = {{1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    // Have liquid flow into all adjacent neighbors from toVoxel
+    for (int i = 0; i < 4; i++)
+    {
+        Flow(toPos, toPos + adjacent[i]);
+        toVoxel = GetVoxel(toPos);
+
+        // If no liquid left in toVoxel, no need to keep flowing
+        if (toVoxel.liquidCount == 0)
+        {
+            break;
+        }
+    }
+
+    SetVoxel(toPos, fromVoxel);
+
+    // If there is still liquid left in toVoxel after all flowing, force it into fromPos
+    if (toVoxel.liquidCount > 0)
+    {
+        SetVoxel(fromPos, toVoxel);
+    }
+
+    // Otherwise, if no water left, then set fromPos to empty
+    else
+    {
+        SetVoxel(fromPos, {Empty, false, 0});
+    }
+
+    return true;
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::Spread(int3 voxelPos)
+{
+    CpuVoxel voxel = GetVoxel(voxelPos);
+
+    // If liquid level isn't sufficient, don't spread (the liquid may have already moved, air's viscosity stops it here)
+    if (voxel.liquidCount < materials[voxel.type].viscosity) {return false;}
+
+    // The current voxel comes first, so it's the first to get any liquid left over after averaging
+    int3 neighborPositions[5] = {{0, 0, 0}, {1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+    int neighborLiquid = 0;
+    int validNeighbors = 0;
+    int lowestLiquid = maxLiquid;
+    int highestLiquid = 0;
+
+    // Count all liquid in current and adjacent voxels (walls are neither liquid nor empty, so they're ignored)
+    for (int i = 0; i < 5; i++)
+    {
+        CpuVoxel curVoxel = GetVoxel(voxelPos + neighborPositions[i]);
+
+        if (curVoxel.type == voxel.type || curVoxel.type == Empty)
+        {
+            validNeighbors += 1;
+            neighborLiquid += curVoxel.liquidCount;
+            lowestLiquid = std::min(lowestLiquid, (int)curVoxel.liquidCount);
+            highestLiquid = std::max(highestLiquid, (int)curVoxel.liquidCount);
+        }
+    }
+
+    // Levels a unit apart are as even as whole units get, spreading them would only move the leftover around forever
+    if (highestLiquid - lowestLiquid <= 1) {return false;}
+
+    // Find the average liquid among current and adjacent voxel, and what's left over after it's shared out evenly
+    int averageLiquid = neighborLiquid / validNeighbors;
+    int leftover = neighborLiquid % validNeighbors;
+
+    // If every voxel gets some liquid, set the average as the liquid value for all adjacent liquid voxels (and current
+    // voxel), with one more unit in each of the first ones until the leftover runs out
+    if (averageLiquid > 0)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            CpuVoxel curVoxel = GetVoxel(voxelPos + neighborPositions[i]);
+
+            if (curVoxel.type == voxel.type || curVoxel.type == Empty)
+            {
+                curVoxel.type = voxel.type;
+                curVoxel.liquidCount = (uint16_t)(averageLiquid + (leftover > 0 ? 1 : 0));
+                leftover--;
+                SetVoxel(voxelPos + neighborPositions[i], curVoxel);
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::Fall(int3 voxelPos)
+{
+    int3 belowPos = voxelPos + int3{0, -1, 0};
+
+    // If below is empty, voxel moves there (below the world is a wall, so fall fails there)
+    if (IsEmpty(belowPos))
+    {
+        SwitchVoxels(voxelPos, belowPos);
+        return true;
+    }
+
+    // If below is liquid and voxel is liquid, voxel flows there
+    if (Flow(voxelPos, belowPos))
+    {
+        return true;
+    }
+
+    // If below is liquid and voxel is solid, voxel falls and displaces liquid
+    if (Displace(voxelPos, belowPos))
+    {
+        return true;
+    }
+
+    return false;
+}
+
+template <typename Layout>
+bool CpuSimulation<Layout>::Slide(int3 voxelPos)
+{
+    // Random number between 0 and 3, used to pick random position to slide to
+    int rand = (int)(PseudoRandom((float)time) * 4.0f);
+
+    int3 belowAdjacent[4] = {{1, -1, 0}, {-1, -1, 0}, {0, -1, 1}, {0, -1, -1}};
+    int3 adjacent[4] = {{1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    // If adjacent isn't empty, slide fails (outside the world is a wall, so it's never empty)
+    if (!IsEmpty(voxelPos + adjacent[rand]))
+    {
+        return false;
+    }
+
+    // If belowAdjacent is empty, move voxel there
+    if (IsEmpty(voxelPos + belowAdjacent[rand]))
+    {
+        SwitchVoxels(voxelPos, voxelPos + belowAdjacent[rand]);
+        return true;
+    }
+
+    // If belowAdjacent is liquid, try to flow there
+    if (Flow(voxelPos, voxelPos + belowAdjacent[rand]))
+    {
+        return true;
+    }
+
+    return false;
+}
+
+template <typename Layout>
+template <uint32_t Flags>
+bool CpuSimulation<Layout>::StepLiquid(int3 voxelPos, uint8_t type)
+{
+    if constexpr ((Flags & MATERIAL_FALLS) != 0) {Fall(voxelPos);}
+
+    if constexpr ((Flags & MATERIAL_SLIDES) != 0) {Slide(voxelPos);}
+
+    // The pipe solver levels out liquid lying on the ground in FlowPipes, liquid under anything is still spread
+    if (liquidSolver == LiquidSolver::Spread || voxelPos.y < columns.TopSolid(voxelPos.x, voxelPos.z)) {Spread(voxelPos);}
+
+    // Get updated liquid value, stop if no liquid left
+    if (GetVoxel(voxelPos).liquidCount == 0) {return false;}
+
+    int3 adjacent[4] = {{1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    // Move voxel to each adjacent position and try to slide from there, below must not be the same liquid.
+    // The trial move is undone when the slide fails, so only a slide that worked wakes anything.
+    if (GetVoxel(voxelPos + int3{0, -1, 0}).type != type)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (IsEmpty(voxelPos + adjacent[i]))
+            {
+                CpuVoxel voxel = GetVoxel(voxelPos);
+                CpuVoxel empty = GetVoxel(voxelPos + adjacent[i]);
+
+                StoreVoxel(voxelPos + adjacent[i], voxel);
+                StoreVoxel(voxelPos, empty);
+                if (Slide(voxelPos + adjacent[i]))
+                {
+                    // The slide woke around where the liquid went, but not where it came from
+                    Wake(voxelPos);
+                    return false;
+                }
+
+                StoreVoxel(voxelPos + adjacent[i], empty);
+                StoreVoxel(voxelPos, voxel);
+            }
+        }
+    }
+
+    // Get updated liquid value, stop if no liquid left
+    return GetVoxel(voxelPos).liquidCount != 0;
+}
+
+template <typename Layout>
+void CpuSimulation<Layout>::React(int3 voxelPos, const Material& material)
+{
+    if (material.reactsWith == Empty) {return;}
+
+    int3 adjacentAndUpDown[6] = {{0, 1, 0}, {0, -1, 0}, {1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (GetVoxel(voxelPos + adjacentAndUpDown[i]).type == material.reactsWith)
+        {
+            // Equal chance to turn the neighbor, rather than this voxel
+            int3 turned = (PseudoRandom((float)time) < .5f) ? voxelPos + adjacentAndUpDown[i] : voxelPos;
+
+            // Whatever liquid it held is gone, which CollectStats() reports so liquid can still be accounted for
+            CpuVoxel voxel = GetVoxel(turned);
+            if (voxel.type < materialCount) {reactedLiquid[(jobs ? JobSystem::ThreadIndex() : 0) * materialCount + voxel.type] += voxel.liquidCount;}
+
+            SetVoxel(turned, {material.reactionProduct, false, 0});
+        }
+    }
+}
+
+template <typename Layout>
+template <MaterialClass Class>
+void CpuSimulation<Layout>::StepBucket(std::vector<int3>& bucket)
+{
+    for (int3 voxelPos : bucket)
+    {
+        StepVoxelAs<Class>(voxelPos);
+    }
+
+    bucket.clear();
+}
+
+template <typename Layout>
+template <MaterialClass Class>
+void CpuSimulation<Layout>::StepVoxelAs(int3 voxelPos)
+{
+    constexpr uint32_t flags = ClassFlags(Class);
+
+    CpuVoxel voxel = GetVoxel(voxelPos);
+
+    // If the current voxel is air or has already been updated, ignore it (sleeping voxels never make it into a bucket)
+    uint32_t index = PositionToIndex(voxelPos);
+    if (voxel.type == Empty || voxel.updatedThisStep) {return;}
+
+    // Mark current voxel as updated (written directly, so it doesn't wake its neighbors)
+    updated[index] = 1;
+
+    if constexpr ((flags & MATERIAL_LIQUID) != 0)
+    {
+        if (!StepLiquid<flags>(voxelPos, voxel.type)) {return;}
+    }
+
+    else
+    {
+        if constexpr ((flags & MATERIAL_FALLS) != 0)
+        {
+            if (Fall(voxelPos)) {return;}
+        }
+
+        if constexpr ((flags & MATERIAL_SLIDES) != 0)
+        {
+            if (Slide(voxelPos)) {return;}
+        }
+
+        // The voxel couldn't move, count towards falling asleep (static voxels are only stepped to react, so they don't)
+        if constexpr (flags != 0)
+        {
+            if (++quiet[index] == sleepSteps)
+            {
+                quiet[index] = 0;
+                awake.Set(voxelPos + int3{WORLD_BORDER, WORLD_BORDER, WORLD_BORDER}, false);
+            }
+        }
+    }
+
+    React(voxelPos, materials[voxel.type]);
+}
+
+#endif
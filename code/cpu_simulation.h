@@ -0,0 +1,421 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include "materials.h"
+#include "job_system.h"
+#include "fall_kernel.h"
+#include "occupancy_grid.h"
+#include "occupancy_tree.h"
+#include "column_map.h"
+#include "chunk_scheduler.h"
+#include "chunk_pool.h"
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Everything the CPU simulation keeps for one voxel (the GPU's Voxel without its unused fields)
+struct CpuVoxel
+{
+    uint8_t type;
+    bool updatedThisStep;
+    uint16_t liquidCount;
+};
+
+// How liquid levels out sideways (LIQUID_SOLVER in simulation.hlsl)
+enum class LiquidSolver
+{
+    Spread, // Each liquid voxel averages with its 4 neighbors when it's stepped
+    Pipes   // Liquid flows between the pools of neighboring columns through virtual pipes that keep their flow (FlowPipes)
+};
+
+// One visible side of a voxel (Face in mesh_generation.hlsl), direction uses the same FACE_ order
+struct CpuFace
+{
+    int3 position;
+    int direction;
+    int voxelType;
+};
+
+// The liquid lying on the topmost solid of a column, which the pipe solver moves between columns
+struct LiquidPool
+{
+    // Height of the topmost solid (-1 when there isn't one), the pool starts right above it
+    int ground;
+
+    // Height of the topmost voxel of the pool, ground when the column is dry
+    int top;
+
+    // Liquid the pool is made of, Empty when the column is dry
+    uint8_t type;
+
+    // Liquid the pool takes in this step: its own, or for a dry column the liquid of the neighboring pool with the
+    // highest surface, so two liquids never flow into the same dry column at once (Empty when none can)
+    uint8_t accepts;
+
+    // Liquid in the pool, and room left for more in it and in the air right above it
+    int liquid;
+    int room;
+};
+
+// One connected body of liquid: voxels of the same liquid that touch on a side (LiquidBody in liquid_labels.hlsl)
+struct CpuLiquidBody
+{
+    uint8_t type;
+    uint32_t voxelCount;
+    uint64_t liquid;
+
+    // Smallest box holding every voxel of the body, from min up to and including max
+    int3 min;
+    int3 max;
+};
+
+// Everything counted about the world after a step (WorldStats in world_stats.hlsl, with liquid in one number)
+struct CpuWorldStats
+{
+    // Voxels of every material in the world, indexed by type
+    uint32_t voxelCounts[materialCount];
+
+    uint64_t liquid;
+
+    // Liquid held by the voxels of every material, indexed by type (liquid is the sum of them)
+    uint64_t liquidCounts[materialCount];
+
+    // Liquid of every material that reactions have turned into something else since the simulation was made, so
+    // liquid can be checked to be kept one material at a time
+    uint64_t reactedLiquid[materialCount];
+
+    // Voxels whose type or liquid changed during the last Step(), or were set since the one before it (a voxel moving
+    // changes 2)
+    uint32_t movedVoxels;
+
+    // Faces made by the last GenerateMesh()
+    uint32_t faceCount;
+
+    // Steps in a row, up to the last one, that changed no voxel
+    uint32_t unchangedSteps;
+};
+
+// CPU port of simulation.hlsl and mesh_generation.hlsl, so the simulation can be run and measured without a GPU.
+// Voxels are stored as one array per field, ordered by Layout (see voxel_layout.h), and
+// surrounded by the same WORLD_BORDER of walls as voxelBuffer. An OccupancyGrid is kept next to them, so air is
+// skipped and neighbors are tested 64 voxels at a time.
+template<typename Layout>
+class CpuSimulation
+{
+    public:
+
+    // If jobs is given, every checkerboard phase and the mesh generation are spread across its threads
+    CpuSimulation(int3 worldSize, JobSystem* jobs = nullptr);
+
+    // Fills the border with walls and the bottom 3 layers of the world with sand (InitializeSimulation)
+    void Initialize();
+
+    // Sets every voxel from min up to (not including) max to the given type, liquids are filled to maxLiquid
+    void Fill(int3 min, int3 max, VoxelType type);
+
+    // Advances the simulation forward once; time seeds random numbers the same way timeBuffer does
+    void Step(int time);
+
+    // Replaces faces with every visible side of every voxel (Compute in mesh_generation.hlsl). When no voxel has changed
+    // since the last call, faces is left as it is (PrepareMesh in simulation.hlsl), so pass the same list every time.
+    void GenerateMesh(std::vector<CpuFace>& faces);
+
+    // Returns a voxel at a given position (positions inside the wall border are valid)
+    CpuVoxel GetVoxel(int3 position) const;
+
+    // Sets a voxel at a given position, and wakes it and its neighbors if it changed in a way that might let them move
+    void SetVoxel(int3 position, CpuVoxel voxel);
+
+    // Copies the world into a ChunkPool with the world's corner at origin, so the stored world can be far bigger than
+    // the part being simulated (air clears voxels of the pool, freeing the chunks that end up empty)
+    void Save(ChunkPool& pool, int3 origin) const;
+
+    // Sets every voxel of the world to the voxels of a ChunkPool from origin on (the border stays walls)
+    void Load(const ChunkPool& pool, int3 origin);
+
+    // Returns the topmost solid and liquid of every column of the world (exact after each Step(), raised by SetVoxel())
+    const ColumnMap& GetColumns() const;
+
+    // Counts every voxel of the world by material and adds up its liquid, 64 voxels at a time (ClearStats and
+    // CountVoxels in world_stats.hlsl)
+    CpuWorldStats CollectStats();
+
+    // Indicates if the last idleSteps steps of every awake chunk changed nothing, and nothing was set since, so stepping
+    // would do nothing (VoxelSim::IsIdle)
+    bool IsIdle() const;
+
+    // Steps in a row that have to change nothing before the world counts as idle, longer than sleepSteps so anything
+    // that could still slide has either moved or fallen asleep by then
+    static constexpr uint32_t idleSteps = 16;
+
+    // Finds every connected body of liquid in the world. Only label chunks with liquid written since the last call are
+    // labelled again (in parallel), then bodies are joined across the sides of chunks.
+    void LabelLiquids();
+
+    // Returns the bodies found by the last LabelLiquids()
+    const std::vector<CpuLiquidBody>& GetLiquidBodies() const;
+
+    // Returns the index into GetLiquidBodies() of the body a voxel was part of at the last LabelLiquids(), or
+    // noLiquidBody if it wasn't liquid
+    uint32_t LiquidBodyAt(int3 position) const;
+
+    static constexpr uint32_t noLiquidBody = UINT32_MAX;
+
+    // Brings the occupancy tree up to date, only chunks with a voxel changed since the last call are read again (in
+    // parallel), then the levels above them are rebuilt
+    void UpdateOccupancyTree();
+
+    // Returns the occupancy tree as of the last UpdateOccupancyTree(), in world positions, for casting rays (Pick in
+    // picker.hlsl) and skipping empty space
+    const OccupancyTree& GetOccupancyTree() const;
+
+    // Width, height, and depth of the chunks Step() is scheduled by, and LabelLiquids() labels on their own
+    static constexpr int chunkSize = ChunkScheduler::chunkSize;
+
+    // Width, height, and depth of world (every axis must be a multiple of 4)
+    const int3 worldSize;
+
+    // Width, height, and depth of stored voxels (world plus border on both sides)
+    const int3 paddedWorldSize;
+
+    // Liquid a full voxel holds (MAX_LIQUID in materials.hlsl). Liquid is counted in whole units, so moving it around
+    // never makes or loses any.
+    static constexpr uint16_t maxLiquid = 256;
+
+    // Steps in a row a voxel can fail to move before it falls asleep (SLEEP_STEPS in simulation.hlsl)
+    static constexpr uint8_t sleepSteps = 15;
+
+    // Fastest a solid falls through air in voxels per step (MAX_FALL_SPEED in simulation.hlsl)
+    static constexpr uint8_t maxFallSpeed = 16;
+
+    // Kernel used to move solids down into air when Layout has contiguous rows, defaults to the fastest the CPU supports
+    FallRowKernel fallKernel = GetFallRowKernel();
+
+    // How liquid levels out sideways, can be changed between steps
+    LiquidSolver liquidSolver = LiquidSolver::Spread;
+
+    // How much the flow through a pipe changes per unit of difference in surface height across it (PIPE_ACCELERATION)
+    static constexpr float pipeAcceleration = 0.4f;
+
+    // Fraction of its flow a pipe keeps into the next step (PIPE_DAMPING), flows are rounded towards 0 to whole units
+    // of liquid, so a pipe with less than one unit flowing stops and liquid settles completely
+    static constexpr float pipeDamping = 0.95f;
+
+    // Voxels of air above a pool it can rise into in one step (PIPE_MAX_RISE)
+    static constexpr int pipeMaxRise = 16;
+
+    // Decides which chunks every Step() runs over. Set chunks.budget to step a bounded number of chunks per step in big
+    // worlds, chunks.focus to the chunk the camera is in, and chunks.lodDistance to step far chunks less often. Solids
+    // falling through air, the column summary and the pipes cover every column of the chunks picked for the step, from
+    // the bottom of the world to the top.
+    ChunkScheduler chunks;
+
+    private:
+
+    // Calls function(blockMin, blockMax) on blocks covering the box from 0 up to count, in parallel when there's a job system
+    template<typename Function>
+    void ForEachBlock(int3 count, int3 grainSize, const Function& function);
+
+    // Picks the columns FallSolids(), SummarizeColumns() and FlowPipes() cover: every column of the chunks in chunkList
+    // (from the bottom of the world to the top), or the whole world when chunkList is null
+    void SelectColumns(const std::vector<uint32_t>* chunkList);
+
+    // Indicates if the column at x and z was picked by the last SelectColumns()
+    bool ColumnSelected(int x, int z) const;
+
+    // Moves every solid with air below it in the selected columns down before the checkerboard runs (FallColumns in
+    // simulation.hlsl). Solids already falling go as far as their speed allows, and when Layout has contiguous rows,
+    // solids that were resting are moved down one with fallKernel, whole runs of selected columns at a time.
+    void FallSolids();
+
+    // Runs every phase of the checkerboard over the chunks in chunkList (the whole world a row at a time when that's
+    // every chunk)
+    void StepCheckerboard(const std::vector<uint32_t>& chunkList);
+
+    // Sets every selected column of the map to exactly what's in it, walking down from the top of the world 64 columns
+    // at a time
+    void SummarizeColumns();
+
+    // Levels out liquid with the virtual pipe model (PipeFlux and PipeApply in simulation.hlsl): every selected column's
+    // pool is found, the pipes between neighboring columns are updated from the height of their surfaces, then every
+    // pool is refilled with what flowed in and out of it
+    void FlowPipes();
+
+    // Finds the pool lying on the topmost solid of the column at x and z (columns must be exact, see SummarizeColumns)
+    LiquidPool FindPool(int x, int z) const;
+
+    // Returns the liquid the pool of the column at x and z takes in this step (see LiquidPool::accepts), from pools
+    uint8_t AcceptedType(int x, int z) const;
+
+    // Updates the flow through the pipe between two pools (positive from pool to neighbor), closing it unless both take
+    // the same liquid
+    void UpdatePipe(const LiquidPool& pool, const LiquidPool& neighbor, int& flow) const;
+
+    // Rewrites the pool of a column to hold the given amount of liquid, full voxels first and whatever is left on top
+    void FillPool(int x, int z, const LiquidPool& pool, uint8_t type, int liquidCount);
+
+    // Labels the liquid voxels of one label chunk by body, numbering the chunk's bodies from 1 (0 isn't liquid), and
+    // finds the chunk's bodies. parents is scratch space for the union-find.
+    void LabelChunk(int3 chunk, std::vector<uint16_t>& parents);
+
+    // Returns where a voxel's label is in chunkLabels
+    uint32_t ChunkLabelIndex(int3 position) const;
+
+    // Moves one solid with air below it down, one voxel further than last step (up to maxFallSpeed)
+    void FallVoxel(int3 voxelPos);
+
+    // Counts how many voxels of air are directly below a position, stopping at limit
+    int FreeBelow(int3 position, int limit) const;
+
+    // Steps a single voxel whose material is of the given class (body of StepSimulation, with no flags checked at runtime)
+    template<MaterialClass Class>
+    void StepVoxelAs(int3 voxelPos);
+
+    // Steps every voxel in a bucket, then empties it
+    template<MaterialClass Class>
+    void StepBucket(std::vector<int3>& bucket);
+
+    template<uint32_t Flags>
+    bool StepLiquid(int3 voxelPos, uint8_t type);
+
+    void React(int3 voxelPos, const Material& material);
+
+    // Pushes the visible faces of every voxel in the row at y and z (Compute in mesh_generation.hlsl, 64 voxels at a time)
+    void MeshRow(int y, int z, std::vector<CpuFace>& faces) const;
+
+    bool Flow(int3 fromPos, int3 toPos);
+
+    bool Displace(int3 fromPos, int3 toPos);
+
+    bool Spread(int3 voxelPos);
+
+    bool Fall(int3 voxelPos);
+
+    bool Slide(int3 voxelPos);
+
+    void SwitchVoxels(int3 position1, int3 position2);
+
+    // Sets a voxel without waking anything (for the wall border, whose neighbors can lie outside the stored voxels)
+    void StoreVoxel(int3 position, CpuVoxel voxel);
+
+    // Wakes a voxel and every voxel around it (Wake in voxel_helpers.hlsl)
+    void Wake(int3 position);
+
+    // Wakes the voxels next to the given bits of a word of the row at y and z (stored positions), the same ones Wake in
+    // voxel_helpers.hlsl wakes around each of them
+    void WakeBits(int y, int z, int word, uint64_t bits);
+
+    // Indicates if a given position is inside the world
+    bool InBounds(int3 position) const;
+
+    // Indicates if the voxel at a given position is Empty, only reads the occupancy bit
+    bool IsEmpty(int3 position) const;
+
+    uint32_t PositionToIndex(int3 position) const;
+
+    // Same pseudorandom function as noise.hlsl
+    static float PseudoRandom(float seed);
+
+    // One entry per stored voxel, indexed by PositionToIndex()
+    std::vector<uint8_t> types;
+
+    std::vector<uint8_t> updated;
+
+    std::vector<uint16_t> liquid;
+
+    // Voxels per step each voxel is falling through air at, 0 when it isn't (fallSpeed on the GPU)
+    std::vector<uint8_t> fallSpeed;
+
+    // Steps in a row each awake voxel has failed to move, it falls asleep when this reaches sleepSteps
+    std::vector<uint8_t> quiet;
+
+    // One bit per stored voxel, kept in sync by SetVoxel() and FallSolids()
+    OccupancyGrid occupancy;
+
+    // One bit per stored voxel, cleared when it falls asleep and set again when something next to it changes
+    // (the GPU keeps this in quietSteps instead), so sleeping voxels are skipped 64 at a time like air
+    OccupancyGrid awake;
+
+    // Occupied voxels of the world (without the border) as a 64-tree, brought up to date by UpdateOccupancyTree()
+    OccupancyTree tree;
+
+    // Topmost solid and liquid of every column (columnBuffer on the GPU)
+    ColumnMap columns;
+
+    // Bits of an occupancy row that are inside the world rather than the wall border, one per word
+    std::vector<uint64_t> insideRow;
+
+    // Set for every column of chunks (chunks.chunkCount.x by chunks.chunkCount.z) picked by the last SelectColumns()
+    std::vector<uint8_t> selectedChunkColumns;
+
+    // Bits of an occupancy row in the selected columns, wordsPerRow words for every row of chunks along z
+    std::vector<uint64_t> selectedRows;
+
+    // Pool of every column, found at the start of FlowPipes
+    std::vector<LiquidPool> pools;
+
+    // Liquid flowing out of every column through its +x and +z side each step (pipeX and pipeZ of Column on the GPU)
+    std::vector<int32_t> pipeX;
+
+    std::vector<int32_t> pipeZ;
+
+    // Label of every voxel inside its label chunk, chunkSize^3 per chunk, see LabelChunk()
+    std::vector<uint16_t> chunkLabels;
+
+    // Bodies found inside every label chunk, in the order of their labels
+    std::vector<std::vector<CpuLiquidBody>> chunkBodies;
+
+    // Set for every label chunk with liquid written since the last LabelLiquids() (atomic, SetVoxel() runs on any thread)
+    std::unique_ptr<std::atomic<uint8_t>[]> dirtyLabelChunks;
+
+    // Set for every chunk with a voxel changed since the last UpdateOccupancyTree() (atomic, like dirtyLabelChunks)
+    std::unique_ptr<std::atomic<uint8_t>[]> dirtyTreeChunks;
+
+    // Where the bodies of every label chunk start in bodyOfChunkLabel
+    std::vector<uint32_t> firstChunkBody;
+
+    // Body (index into liquidBodies) every body of every label chunk is part of
+    std::vector<uint32_t> bodyOfChunkLabel;
+
+    std::vector<CpuLiquidBody> liquidBodies;
+
+    // Adds to the count of voxels changed by the thread running this (one cache line per thread, so threads don't
+    // fight over it), and wakes the chunk of the position that changed
+    void CountChanges(int3 position, uint32_t count);
+
+    // Returns the voxels every thread has changed since the simulation was made
+    uint64_t CountedChanges() const;
+
+    // Voxels changed on each thread, at every changedStride-th entry
+    std::vector<uint64_t> changedVoxels;
+
+    static constexpr uint32_t changedStride = 8;
+
+    // Liquid of every material lost to reactions on each thread, materialCount entries per thread (rarely written, so
+    // threads sharing a cache line doesn't matter)
+    std::vector<uint64_t> reactedLiquid;
+
+    // CountedChanges() at the end of the last Step() and at the last GenerateMesh() that made faces
+    uint64_t changesAtLastStep = 0;
+
+    uint64_t changesAtLastMesh = UINT64_MAX;
+
+    // Voxels changed by the last Step() (and set since the one before it), and steps in a row that changed none
+    uint32_t lastStepChanges = 0;
+
+    uint32_t unchangedSteps = 0;
+
+    // Faces made by the last GenerateMesh()
+    uint32_t faceCount = 0;
+
+    // Voxels waiting to be stepped, materialClassCount buckets per thread (kept between steps so they're only allocated once)
+    std::vector<std::vector<int3>> buckets;
+
+    // Time passed into the current Step()
+    int time = 0;
+
+    JobSystem* jobs = nullptr;
+};
+
+#include "./cpu_simulation.cpp"
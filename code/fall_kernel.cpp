@@ -0,0 +1,132 @@
+#include "fall_kernel.h"
+#include "materials.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FALL_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 instructions inside functions marked with this, MSVC always can
+#if defined(FALL_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// 0xFF for every material that falls through air without holding liquid (liquids are left for the rules in CpuSimulation, since they
+// keep moving after they fall), indexed by type. WALL and anything else past the table doesn't fall.
+alignas(16) static const uint8_t fallsThroughAir[16] =
+{
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) ((flags) & MATERIAL_FALLS) && !((flags) & MATERIAL_LIQUID) ? (uint8_t)0xFF : (uint8_t)0,
+#include "../shaders/materials.def"
+#undef MATERIAL
+};
+
+void FallRowScalar(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (types[i] < 16 && fallsThroughAir[types[i]] && belowTypes[i] == Empty)
+        {
+            uint16_t belowLiquidCount = belowLiquid[i];
+            belowLiquid[i] = liquid[i];
+            liquid[i] = belowLiquidCount;
+
+            belowTypes[i] = types[i];
+            belowUpdated[i] = 1;
+            types[i] = Empty;
+        }
+    }
+}
+
+#ifdef FALL_KERNEL_X86
+
+TARGET_AVX2 void FallRowAvx2(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count)
+{
+    const __m256i empty = _mm256_set1_epi8((char)Empty);
+    const __m256i one = _mm256_set1_epi8(1);
+
+    // Same table in both 16 byte halves, since shuffles only look within a half
+    const __m256i fallTable = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)fallsThroughAir));
+
+    uint32_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i type = _mm256_loadu_si256((const __m256i*)(types + i));
+        __m256i belowType = _mm256_loadu_si256((const __m256i*)(belowTypes + i));
+
+        // Look up every type in the table at once, types of 128 and up (like WALL) come back as 0 from the shuffle,
+        // and types from 16 to 127 are masked off (there are at most 16 materials)
+        __m256i lowTypes = _mm256_cmpeq_epi8(_mm256_and_si256(type, _mm256_set1_epi8(0x70)), _mm256_setzero_si256());
+        __m256i solid = _mm256_and_si256(_mm256_shuffle_epi8(fallTable, type), lowTypes);
+
+        // 0xFF in every lane where a falling solid is sitting on air
+        __m256i falls = _mm256_and_si256(solid, _mm256_cmpeq_epi8(belowType, empty));
+
+        // Settled rows are only read, so they don't cost any write bandwidth
+        if (_mm256_testz_si256(falls, falls)) {continue;}
+
+        __m256i belowUpdate = _mm256_loadu_si256((const __m256i*)(belowUpdated + i));
+
+        // Empty is 0, so clearing the falling lanes of the upper row leaves air behind
+        _mm256_storeu_si256((__m256i*)(types + i), _mm256_andnot_si256(falls, type));
+        _mm256_storeu_si256((__m256i*)(belowTypes + i), _mm256_blendv_epi8(belowType, type, falls));
+        _mm256_storeu_si256((__m256i*)(belowUpdated + i), _mm256_or_si256(belowUpdate, _mm256_and_si256(falls, one)));
+
+        // Widen the mask to 16 bits per lane, one 16 byte half at a time, and switch liquid where voxels fell
+        __m128i fallHalves[2] = {_mm256_castsi256_si128(falls), _mm256_extracti128_si256(falls, 1)};
+
+        for (uint32_t j = 0; j < 2; j++)
+        {
+            __m256i mask = _mm256_cvtepi8_epi16(fallHalves[j]);
+            __m256i upper = _mm256_loadu_si256((const __m256i*)(liquid + i + j * 16));
+            __m256i lower = _mm256_loadu_si256((const __m256i*)(belowLiquid + i + j * 16));
+            _mm256_storeu_si256((__m256i*)(liquid + i + j * 16), _mm256_blendv_epi8(upper, lower, mask));
+            _mm256_storeu_si256((__m256i*)(belowLiquid + i + j * 16), _mm256_blendv_epi8(lower, upper, mask));
+        }
+    }
+
+    // Rows that aren't a multiple of 32 finish one voxel at a time
+    FallRowScalar(types + i, belowTypes + i, belowUpdated + i, liquid + i, belowLiquid + i, count - i);
+}
+
+bool SupportsAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {return false;}
+
+    // AVX2 also needs the OS to save the upper halves of the vector registers (OSXSAVE and XCR0)
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+
+    __cpuidex(info, 7, 0);
+    return osSavesAvx && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+void FallRowAvx2(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count)
+{
+    FallRowScalar(types, belowTypes, belowUpdated, liquid, belowLiquid, count);
+}
+
+bool SupportsAvx2()
+{
+    return false;
+}
+
+#endif
+
+FallRowKernel GetFallRowKernel()
+{
+    static const FallRowKernel kernel = SupportsAvx2() ? FallRowAvx2 : FallRowScalar;
+    return kernel;
+}
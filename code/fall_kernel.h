@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Vectorized part of the Fall rule for the CPU simulation (see cpu_simulation.h).
+// Works on one row of voxel types and the row right below it, both count voxels long and stored contiguously:
+// every voxel whose material falls without holding liquid (sand, stone) with an Empty voxel below switches places with it, and the moved voxel is marked as updated.
+// Liquid switches places too, since Flow() can leave liquid behind in Empty voxels.
+// Only solids moving into air are handled here, everything else (displacing and flowing) is left to the rules in CpuSimulation.
+using FallRowKernel = void (*)(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count);
+
+// One voxel at a time, runs on any CPU
+void FallRowScalar(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count);
+
+// 32 voxels at a time, only call this if SupportsAvx2() is true
+void FallRowAvx2(uint8_t* types, uint8_t* belowTypes, uint8_t* belowUpdated, uint16_t* liquid, uint16_t* belowLiquid, uint32_t count);
+
+// Indicates if the CPU running this code supports AVX2
+bool SupportsAvx2();
+
+// Returns the fastest kernel the CPU running this code supports (checked once, then cached)
+FallRowKernel GetFallRowKernel();
@@ -0,0 +1,186 @@
+#include "job_system.h"
+#include <algorithm>
+
+JobSystem::JobSystem(uint32_t threadCount)
+{
+    threadCount = std::max(threadCount, 1u);
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    // Queue 0 belongs to the calling thread, every other queue gets its own worker
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& job)
+{
+    Fork fork = {};
+    fork.run = RunRange;
+    fork.job = &job;
+    fork.count = count;
+    fork.grainSize = std::max(grainSize, 1u);
+
+    RunAndWait(fork, (count + fork.grainSize - 1) / fork.grainSize);
+}
+
+void JobSystem::ParallelFor(int3 min, int3 max, int3 grainSize, const std::function<void(int3 blockMin, int3 blockMax)>& job)
+{
+    Fork fork = {};
+    fork.run = RunBlock;
+    fork.job = &job;
+    fork.min = min;
+    fork.max = max;
+    fork.blockSize = {std::max(grainSize.x, 1), std::max(grainSize.y, 1), std::max(grainSize.z, 1)};
+
+    int3 extent = {std::max(max.x - min.x, 0), std::max(max.y - min.y, 0), std::max(max.z - min.z, 0)};
+    fork.blocks = {(extent.x + fork.blockSize.x - 1) / fork.blockSize.x, (extent.y + fork.blockSize.y - 1) / fork.blockSize.y, (extent.z + fork.blockSize.z - 1) / fork.blockSize.z};
+
+    RunAndWait(fork, (uint32_t)fork.blocks.x * fork.blocks.y * fork.blocks.z);
+}
+
+uint32_t JobSystem::ThreadCount() const
+{
+    return (uint32_t)queues.size();
+}
+
+uint32_t JobSystem::ThreadIndex()
+{
+    return threadIndex;
+}
+
+void JobSystem::RunRange(const Fork& fork, uint32_t item)
+{
+    uint32_t begin = item * fork.grainSize;
+    uint32_t end = std::min(begin + fork.grainSize, fork.count);
+    (*(const std::function<void(uint32_t, uint32_t)>*)fork.job)(begin, end);
+}
+
+void JobSystem::RunBlock(const Fork& fork, uint32_t item)
+{
+    int3 block = {(int)(item % fork.blocks.x), (int)(item / fork.blocks.x / fork.blocks.z), (int)(item / fork.blocks.x % fork.blocks.z)};
+    int3 blockMin = {fork.min.x + block.x * fork.blockSize.x, fork.min.y + block.y * fork.blockSize.y, fork.min.z + block.z * fork.blockSize.z};
+    int3 blockMax = {std::min(blockMin.x + fork.blockSize.x, fork.max.x), std::min(blockMin.y + fork.blockSize.y, fork.max.y), std::min(blockMin.z + fork.blockSize.z, fork.max.z)};
+    (*(const std::function<void(int3, int3)>*)fork.job)(blockMin, blockMax);
+}
+
+void JobSystem::RunAndWait(Fork& fork, uint32_t itemCount)
+{
+    if (itemCount == 0) {return;}
+
+    uint32_t index = ThreadIndex();
+    uint32_t queueCount = (uint32_t)queues.size();
+    fork.remaining = itemCount;
+
+    // Counted before they're pushed, so a thread taking one never sees the count go below 0
+    queuedJobs += itemCount;
+
+    // Fork: every queue gets a contiguous slice of the items (neighboring items touch neighboring memory), starting
+    // with this thread's own queue, and each queue is locked once
+    for (uint32_t slice = 0; slice < queueCount; slice++)
+    {
+        uint32_t first = (uint32_t)((uint64_t)itemCount * slice / queueCount);
+        uint32_t last = (uint32_t)((uint64_t)itemCount * (slice + 1) / queueCount);
+        if (first == last) {continue;}
+
+        WorkQueue& queue = *queues[(index + slice) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (uint32_t item = first; item < last; item++)
+        {
+            queue.jobs.push_back({&fork, item});
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+
+    // Join: help run jobs (ours, or anyone's) until all of ours are done. Once there's nothing left to take, the rest
+    // of ours are running on other threads, so sleep until the last of them finishes or more jobs are pushed.
+    while (fork.remaining > 0)
+    {
+        if (RunOneJob(index)) {continue;}
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this, &fork]() {return fork.remaining == 0 || queuedJobs > 0;});
+    }
+}
+
+bool JobSystem::RunOneJob(uint32_t index)
+{
+    Job job = {};
+    bool found = false;
+
+    // Newest job from our own queue
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if (!queues[index]->jobs.empty())
+        {
+            job = queues[index]->jobs.back();
+            queues[index]->jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // Otherwise steal the oldest job from another queue
+    for (uint32_t i = 1; i < queues.size() && !found; i++)
+    {
+        WorkQueue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found) {return false;}
+
+    queuedJobs--;
+    job.fork->run(*job.fork, job.item);
+
+    // The fork lives on the stack of the thread joining it, and may be gone once the count reaches 0, so only the
+    // job system is touched after that
+    if (--job.fork->remaining == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_all();
+    }
+
+    return true;
+}
+
+void JobSystem::WorkerLoop(uint32_t index)
+{
+    threadIndex = index;
+
+    while (running)
+    {
+        if (RunOneJob(index)) {continue;}
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() {return queuedJobs > 0 || !running;});
+    }
+}
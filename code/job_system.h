@@ -0,0 +1,107 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs jobs across a fixed set of threads. Every thread owns a deque of jobs: it takes its own newest job first,
+// and steals the oldest job from another thread when it runs out, so there's no shared queue or lock to fight over.
+// ParallelFor() is a fork/join: it deals its jobs out across every thread's deque in contiguous slices (the calling
+// thread gets the first), then helps run jobs and only returns once all of them are done, sleeping while the last
+// ones run elsewhere. A job is just an item number of its fork, so forking allocates nothing per job.
+class JobSystem
+{
+    public:
+
+    // threadCount includes the thread that calls ParallelFor()
+    JobSystem(uint32_t threadCount = std::thread::hardware_concurrency());
+
+    ~JobSystem();
+
+    // Splits [0, count) into ranges of at most grainSize and runs job(begin, end) on each range
+    void ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& job);
+
+    // Splits the box from min up to (not including) max into blocks of at most grainSize, and runs job(blockMin, blockMax) on each block
+    void ParallelFor(int3 min, int3 max, int3 grainSize, const std::function<void(int3 blockMin, int3 blockMax)>& job);
+
+    // Number of threads running jobs (including the calling thread)
+    uint32_t ThreadCount() const;
+
+    // Index of the thread running this code, from 0 up to ThreadCount(); threads outside the job system are 0
+    static uint32_t ThreadIndex();
+
+    private:
+
+    // One call to ParallelFor(), shared by all of its jobs
+    struct Fork
+    {
+        // Runs one item of the fork
+        void (*run)(const Fork& fork, uint32_t item);
+
+        // The job passed to ParallelFor(), either kind
+        const void* job;
+
+        // Range form: items are ranges of grainSize from 0 up to count
+        uint32_t count;
+        uint32_t grainSize;
+
+        // Box form: items are blocks of blockSize from min up to max, blocks.x by blocks.z per layer
+        int3 min;
+        int3 max;
+        int3 blockSize;
+        int3 blocks;
+
+        // Counts down as jobs finish, so the ParallelFor() that created them knows when to return
+        std::atomic<uint32_t> remaining;
+    };
+
+    struct Job
+    {
+        Fork* fork;
+        uint32_t item;
+    };
+
+    // Jobs owned by one thread, the newest job is at the back
+    struct WorkQueue
+    {
+        std::mutex mutex;
+
+        std::deque<Job> jobs;
+    };
+
+    // Runs jobs until the job system is destroyed, sleeping while there are none
+    void WorkerLoop(uint32_t index);
+
+    // Runs this thread's newest job, or steals another thread's oldest job; returns false if there were none
+    bool RunOneJob(uint32_t index);
+
+    // Deals a job per item out across the queues, wakes sleeping workers, and runs jobs until they're all done
+    void RunAndWait(Fork& fork, uint32_t itemCount);
+
+    static void RunRange(const Fork& fork, uint32_t item);
+    static void RunBlock(const Fork& fork, uint32_t item);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::vector<std::thread> workers;
+
+    // Jobs pushed but not taken yet, so idle workers know whether to sleep
+    std::atomic<uint32_t> queuedJobs = 0;
+
+    std::atomic<bool> running = true;
+
+    // Only used to put idle threads to sleep (workers with nothing to run, and joins waiting on jobs running
+    // elsewhere), never while pushing or taking jobs
+    std::mutex sleepMutex;
+
+    std::condition_variable wake;
+
+    static inline thread_local uint32_t threadIndex = 0;
+};
@@ -1,7 +1,15 @@
 #include "application.h"
+#include "voxel.h"
+#include <cstdlib>
 
-int main()
+int main(int argc, char** argv)
 {
+    // World size can be given as "gpu-voxel-sim [x] [y] [z]", otherwise the defaults in settings.h are used
+    if (argc == 4)
+    {
+        VoxelSim::worldSize = {atoi(argv[1]), atoi(argv[2]), atoi(argv[3])};
+    }
+
     Application::Start();
     
     while (Application::IsRunning())
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Material table for the CPU, built from the same materials.def as materials.hlsl
+
+// Types of voxels, one per material (EMPTY, SAND, ... in materials.hlsl)
+enum VoxelType : uint8_t
+{
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) Name = id,
+#include "../shaders/materials.def"
+#undef MATERIAL
+
+    // Immutable voxels filling the border around the world, never stepped so it has no material
+    Wall = 255,
+};
+
+// Everything known about one material (Material in materials.hlsl)
+struct Material
+{
+    const char* name;
+    uint32_t flags;
+    int viscosity;
+    float density;
+    float color[4];
+    uint8_t reactsWith;
+    uint8_t reactionProduct;
+};
+
+// Every material, indexed by VoxelType
+inline constexpr Material materials[] =
+{
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) {#Name, flags, viscosity, density, {r, g, b, a}, reactsWith, reactionProduct},
+#include "../shaders/materials.def"
+#undef MATERIAL
+};
+
+inline constexpr int materialCount = sizeof(materials) / sizeof(materials[0]);
+
+// Types are looked up in 16 entry tables by vectorized code (see fall_kernel.cpp)
+static_assert(materialCount <= 16, "materials.def can hold at most 16 materials");
+
+// Materials grouped by behaviour, the CPU steps each class with its own copy of the rules, where the flags are
+// known at compile time (see CpuSimulation::StepVoxelAs)
+enum class MaterialClass : uint8_t
+{
+    Static,   // No flags (cloud, and walls), only reacts
+    Solid,    // Falls (stone)
+    Granular, // Falls and slides (sand)
+    Liquid,   // Falls, slides and holds liquid (water, lava)
+};
+
+inline constexpr int materialClassCount = 4;
+
+// Flags every material of a class has
+constexpr uint32_t ClassFlags(MaterialClass materialClass)
+{
+    switch (materialClass)
+    {
+        case MaterialClass::Solid: return MATERIAL_FALLS;
+        case MaterialClass::Granular: return MATERIAL_FALLS | MATERIAL_SLIDES;
+        case MaterialClass::Liquid: return MATERIAL_FALLS | MATERIAL_SLIDES | MATERIAL_LIQUID;
+        default: return 0;
+    }
+}
+
+constexpr MaterialClass ClassOf(uint32_t flags)
+{
+    if (flags & MATERIAL_LIQUID) {return MaterialClass::Liquid;}
+    if (flags & MATERIAL_SLIDES) {return MaterialClass::Granular;}
+    if (flags & MATERIAL_FALLS) {return MaterialClass::Solid;}
+    return MaterialClass::Static;
+}
+
+// A material whose flags aren't exactly the flags of a class needs a new class, or it would be stepped wrong
+constexpr bool EveryMaterialFitsAClass()
+{
+    for (const Material& material : materials)
+    {
+        if (ClassFlags(ClassOf(material.flags)) != material.flags) {return false;}
+    }
+    return true;
+}
+
+static_assert(EveryMaterialFitsAClass(), "every material in materials.def must have the flags of one MaterialClass");
+
+// Class of every voxel type, anything that isn't a material (like Wall) is Static
+inline constexpr std::array<MaterialClass, 256> materialClasses = []()
+{
+    std::array<MaterialClass, 256> classes = {};
+    for (int type = 0; type < 256; type++)
+    {
+        classes[type] = (type < materialCount) ? ClassOf(materials[type].flags) : MaterialClass::Static;
+    }
+    return classes;
+}();
+
+// Indicates if voxels of a given type hold liquid
+inline bool IsLiquid(uint8_t type)
+{
+    return type < materialCount && (materials[type].flags & MATERIAL_LIQUID);
+}
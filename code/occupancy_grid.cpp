@@ -0,0 +1,50 @@
+#include "occupancy_grid.h"
+
+OccupancyGrid::OccupancyGrid(int3 size)
+    : wordsPerRow((size.x + 63) / 64), size(size)
+{
+    uint32_t wordCount = (uint32_t)wordsPerRow * size.y * size.z;
+    words = std::make_unique<std::atomic<uint64_t>[]>(wordCount);
+
+    for (uint32_t i = 0; i < wordCount; i++)
+    {
+        words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool OccupancyGrid::Get(int3 position) const
+{
+    uint64_t word = words[WordIndex(position.y, position.z, position.x >> 6)].load(std::memory_order_relaxed);
+    return (word >> (position.x & 63)) & 1;
+}
+
+void OccupancyGrid::Set(int3 position, bool occupied)
+{
+    uint64_t bit = 1ull << (position.x & 63);
+    std::atomic<uint64_t>& word = words[WordIndex(position.y, position.z, position.x >> 6)];
+
+    // Most writes don't change occupancy (liquid levels, updated flags), so skip the atomic in that case
+    if (((word.load(std::memory_order_relaxed) & bit) != 0) == occupied) {return;}
+
+    if (occupied) {word.fetch_or(bit, std::memory_order_relaxed);}
+    else {word.fetch_and(~bit, std::memory_order_relaxed);}
+}
+
+uint64_t OccupancyGrid::Word(int y, int z, int word) const
+{
+    if (word < 0 || word >= wordsPerRow) {return 0;}
+
+    return words[WordIndex(y, z, word)].load(std::memory_order_relaxed);
+}
+
+void OccupancyGrid::Update(int y, int z, int word, uint64_t setBits, uint64_t clearBits)
+{
+    std::atomic<uint64_t>& bits = words[WordIndex(y, z, word)];
+    if (clearBits) {bits.fetch_and(~clearBits, std::memory_order_relaxed);}
+    if (setBits) {bits.fetch_or(setBits, std::memory_order_relaxed);}
+}
+
+uint32_t OccupancyGrid::WordIndex(int y, int z, int word) const
+{
+    return ((uint32_t)y * size.z + z) * wordsPerRow + word;
+}
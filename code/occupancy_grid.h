@@ -0,0 +1,56 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// One bit per voxel, set when the voxel isn't Empty (walls included) for the grid CpuSimulation keeps of occupied
+// voxels (it keeps a second one of awake voxels the same way). Bits are stored in 64-bit words running along
+// x rows, so questions like "which of these 64 voxels have air above them" are a few shifts and ANDs.
+// Positions are stored positions (already offset by WORLD_BORDER), the same as Layout::Index() takes.
+// Bits are changed atomically, so voxels sharing a word can be set from different threads.
+class OccupancyGrid
+{
+    public:
+
+    OccupancyGrid(int3 size);
+
+    bool Get(int3 position) const;
+
+    void Set(int3 position, bool occupied);
+
+    // Returns 64 bits of the row at y and z, bit i is the voxel at x = word * 64 + i (words past the row are 0)
+    uint64_t Word(int y, int z, int word) const;
+
+    // Sets and clears bits in a word at once
+    void Update(int y, int z, int word, uint64_t setBits, uint64_t clearBits);
+
+    // Number of words needed to hold one row
+    const int wordsPerRow;
+
+    // Width, height, and depth of the grid
+    const int3 size;
+
+    private:
+
+    uint32_t WordIndex(int y, int z, int word) const;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+};
+
+// Index of the lowest set bit (bits must not be 0)
+inline int LowestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
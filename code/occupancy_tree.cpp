@@ -0,0 +1,249 @@
+#include "occupancy_tree.h"
+#include <algorithm>
+#include <cmath>
+
+OccupancyTree::OccupancyTree(int3 size)
+    : size(size), levelCount(LevelsFor(size))
+{
+    for (int level = 0; level < levelCount; level++)
+    {
+        int span = 4 << (2 * level);
+        int3 levelSize = {(size.x + span - 1) / span, (size.y + span - 1) / span, (size.z + span - 1) / span};
+        uint32_t wordCount = (uint32_t)levelSize.x * levelSize.y * levelSize.z;
+
+        levelSizes.push_back(levelSize);
+        levels.emplace_back(wordCount, 0);
+        dirty.emplace_back(level > 0 ? wordCount : 0, 0);
+    }
+}
+
+void OccupancyTree::SetBrick(int3 brick, uint64_t bits)
+{
+    uint64_t& word = levels[0][WordIndex(0, brick)];
+    if (word == bits) {return;}
+
+    word = bits;
+    if (levelCount > 1) {dirty[1][WordIndex(1, brick / 4)] = 1;}
+}
+
+uint64_t OccupancyTree::Brick(int3 brick) const
+{
+    return levels[0][WordIndex(0, brick)];
+}
+
+void OccupancyTree::Refresh()
+{
+    for (int level = 1; level < levelCount; level++)
+    {
+        int3 levelSize = levelSizes[level];
+        int3 childSize = levelSizes[level - 1];
+
+        for (int y = 0; y < levelSize.y; y++)
+        {
+            for (int z = 0; z < levelSize.z; z++)
+            {
+                for (int x = 0; x < levelSize.x; x++)
+                {
+                    uint32_t index = WordIndex(level, {x, y, z});
+                    if (!dirty[level][index]) {continue;}
+                    dirty[level][index] = 0;
+
+                    // A bit for each of the 4x4x4 words below that isn't 0 (words past the edge of the level are)
+                    uint64_t bits = 0;
+                    int3 first = int3{x, y, z} * 4;
+                    int3 last = {std::min(first.x + 4, childSize.x), std::min(first.y + 4, childSize.y), std::min(first.z + 4, childSize.z)};
+                    for (int childY = first.y; childY < last.y; childY++)
+                    {
+                        for (int childZ = first.z; childZ < last.z; childZ++)
+                        {
+                            for (int childX = first.x; childX < last.x; childX++)
+                            {
+                                if (levels[level - 1][WordIndex(level - 1, {childX, childY, childZ})] == 0) {continue;}
+
+                                int bit = ((childY - first.y) * 4 + childZ - first.z) * 4 + childX - first.x;
+                                bits |= 1ull << bit;
+                            }
+                        }
+                    }
+
+                    uint64_t& word = levels[level][index];
+                    if (word == bits) {continue;}
+
+                    word = bits;
+                    if (level + 1 < levelCount) {dirty[level + 1][WordIndex(level + 1, {x / 4, y / 4, z / 4})] = 1;}
+                }
+            }
+        }
+    }
+}
+
+bool OccupancyTree::Get(int3 position) const
+{
+    if ((uint32_t)position.x >= (uint32_t)size.x || (uint32_t)position.y >= (uint32_t)size.y || (uint32_t)position.z >= (uint32_t)size.z) {return false;}
+
+    uint64_t brick = levels[0][WordIndex(0, position / 4)];
+    int bit = ((position.y & 3) * 4 + (position.z & 3)) * 4 + (position.x & 3);
+    return (brick >> bit) & 1;
+}
+
+bool OccupancyTree::IsEmpty(int level, int3 position) const
+{
+    int shift = 2 * (level + 1);
+    return levels[level][WordIndex(level, {position.x >> shift, position.y >> shift, position.z >> shift})] == 0;
+}
+
+RayHit OccupancyTree::Raycast(const float origin[3], const float direction[3], float maxDistance) const
+{
+    RayHit result = {false, {0, 0, 0}, {0, 0, 0}, 0.0f, 0};
+    const int boxSize[3] = {size.x, size.y, size.z};
+
+    // Clip the ray to the box, and note the side it came in through
+    float enter = 0.0f;
+    float leave = maxDistance;
+    int enterAxis = -1;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (direction[axis] == 0.0f)
+        {
+            if (origin[axis] < 0.0f || origin[axis] >= (float)boxSize[axis]) {return result;}
+            continue;
+        }
+
+        float near = (0.0f - origin[axis]) / direction[axis];
+        float far = ((float)boxSize[axis] - origin[axis]) / direction[axis];
+        if (near > far) {std::swap(near, far);}
+        if (near > enter) {enter = near; enterAxis = axis;}
+        leave = std::min(leave, far);
+    }
+
+    if (enter > leave) {return result;}
+
+    int cell[3];
+    int normal[3] = {0, 0, 0};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cell[axis] = std::clamp((int)std::floor(origin[axis] + direction[axis] * enter), 0, boxSize[axis] - 1);
+    }
+
+    if (enterAxis >= 0) {normal[enterAxis] = direction[enterAxis] > 0.0f ? -1 : 1;}
+
+    float distance = enter;
+    while (true)
+    {
+        result.steps++;
+
+        int3 position = {cell[0], cell[1], cell[2]};
+        if (Get(position))
+        {
+            result.hit = true;
+            result.position = position;
+            result.normal = {normal[0], normal[1], normal[2]};
+            result.distance = distance;
+            return result;
+        }
+
+        // The biggest empty word around the cell is stepped over at once (a single voxel when its brick isn't empty)
+        int cellSize = 1;
+        for (int level = 0; level < levelCount && IsEmpty(level, position); level++)
+        {
+            cellSize = 4 << (2 * level);
+        }
+
+        // Leave through the side the ray reaches first
+        int cellMin[3];
+        int exitAxis = 0;
+        float exitDistance = INFINITY;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            cellMin[axis] = cell[axis] & ~(cellSize - 1);
+            if (direction[axis] == 0.0f) {continue;}
+
+            float side = (float)(direction[axis] > 0.0f ? cellMin[axis] + cellSize : cellMin[axis]);
+            float sideDistance = (side - origin[axis]) / direction[axis];
+            if (sideDistance < exitDistance) {exitDistance = sideDistance; exitAxis = axis;}
+        }
+
+        if (exitDistance > maxDistance) {return result;}
+
+        // Along the other axes the ray is still inside the cell where it leaves it, which keeps rounding from
+        // skipping over a voxel
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (axis == exitAxis)
+            {
+                cell[axis] = direction[axis] > 0.0f ? cellMin[axis] + cellSize : cellMin[axis] - 1;
+            }
+            else
+            {
+                int reached = (int)std::floor(origin[axis] + direction[axis] * exitDistance);
+                cell[axis] = std::clamp(reached, cellMin[axis], cellMin[axis] + cellSize - 1);
+            }
+
+            if (cell[axis] < 0 || cell[axis] >= boxSize[axis]) {return result;}
+            normal[axis] = 0;
+        }
+
+        normal[exitAxis] = direction[exitAxis] > 0.0f ? -1 : 1;
+        distance = exitDistance;
+    }
+}
+
+void OccupancyTree::Export(std::vector<uint32_t>& words) const
+{
+    words.resize(2 * (size_t)LevelOffset(levelCount));
+
+    size_t next = 0;
+    for (const std::vector<uint64_t>& level : levels)
+    {
+        for (uint64_t word : level)
+        {
+            words[next++] = (uint32_t)word;
+            words[next++] = (uint32_t)(word >> 32);
+        }
+    }
+}
+
+uint32_t OccupancyTree::LevelOffset(int level) const
+{
+    uint32_t offset = 0;
+    for (int i = 0; i < level; i++)
+    {
+        offset += (uint32_t)levels[i].size();
+    }
+
+    return offset;
+}
+
+int3 OccupancyTree::LevelSize(int level) const
+{
+    return levelSizes[level];
+}
+
+size_t OccupancyTree::MemoryUsed() const
+{
+    size_t bytes = 0;
+    for (int level = 0; level < levelCount; level++)
+    {
+        bytes += levels[level].capacity() * sizeof(uint64_t) + dirty[level].capacity();
+    }
+
+    return bytes;
+}
+
+int OccupancyTree::LevelsFor(int3 size)
+{
+    int largest = std::max(size.x, std::max(size.y, size.z));
+    int levels = 1;
+    while ((4 << (2 * (levels - 1))) < largest)
+    {
+        levels++;
+    }
+
+    return levels;
+}
+
+uint32_t OccupancyTree::WordIndex(int level, int3 word) const
+{
+    int3 levelSize = levelSizes[level];
+    return ((uint32_t)word.y * levelSize.z + word.z) * levelSize.x + word.x;
+}
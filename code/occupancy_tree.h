@@ -0,0 +1,88 @@
+#pragma once
+
+#include "voxel_layout.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// What OccupancyTree::Raycast() found
+struct RayHit
+{
+    bool hit;
+
+    // Voxel hit, and the side the ray came in through (pointing back along the ray, 0 if the ray started inside it)
+    int3 position;
+    int3 normal;
+
+    // Distance along the ray to where it entered the voxel, in lengths of the ray's direction
+    float distance;
+
+    // Cells the ray visited, empty ones skipped whole count as one
+    uint32_t steps;
+};
+
+// A 64-tree over a box of voxels, one bit per voxel saying whether it's occupied, so rays and queries can skip empty
+// space in big strides. Level 0 is the voxels themselves in bricks of 4x4x4, one 64-bit word per brick (bit
+// (y * 4 + z) * 4 + x). Every level above has a word per 4x4x4 words of the level below, with a bit set for each of
+// those that isn't 0, so a word at level k covers 4^(k + 1) voxels along every axis and a level 1 word covers one
+// 16x16x16 chunk. The top level is a single word covering the whole box.
+// Bricks are set by the owner of the voxels (CpuSimulation::UpdateTree()), and Refresh() then rebuilds only the words
+// above the bricks that changed. Export() lays every level out for a StructuredBuffer<uint2> on the GPU.
+class OccupancyTree
+{
+    public:
+
+    // size is the box of voxels covered, in voxels
+    OccupancyTree(int3 size);
+
+    // Replaces the voxels of a brick (brick coordinates are voxel coordinates / 4). Bricks of different chunks can be
+    // set from different threads.
+    void SetBrick(int3 brick, uint64_t bits);
+
+    uint64_t Brick(int3 brick) const;
+
+    // Rebuilds the words above every brick set since the last call
+    void Refresh();
+
+    // Indicates if the voxel at a position is occupied (false outside the box)
+    bool Get(int3 position) const;
+
+    // Indicates if every voxel of the box of 4^(level + 1) voxels holding position is empty
+    bool IsEmpty(int level, int3 position) const;
+
+    // Walks a ray through the box from origin along direction until it reaches an occupied voxel, or maxDistance
+    // (in lengths of direction), skipping the biggest empty word around it at every step
+    RayHit Raycast(const float origin[3], const float direction[3], float maxDistance) const;
+
+    // Copies every level into words, finest first, each word as its low then high 32 bits, ordered along x, then z,
+    // then y within a level. Level k starts at word LevelOffset(k) and is LevelSize(k) words along every axis.
+    void Export(std::vector<uint32_t>& words) const;
+
+    uint32_t LevelOffset(int level) const;
+    int3 LevelSize(int level) const;
+
+    // Bytes held by every level and the flags of words to rebuild
+    size_t MemoryUsed() const;
+
+    // Width, height, and depth of the box covered
+    const int3 size;
+
+    // Number of levels, the top one is a single word
+    const int levelCount;
+
+    private:
+
+    // Levels needed for one word to cover size
+    static int LevelsFor(int3 size);
+
+    uint32_t WordIndex(int level, int3 word) const;
+
+    // Words of every level, finest first
+    std::vector<std::vector<uint64_t>> levels;
+
+    // Words along every axis at every level
+    std::vector<int3> levelSizes;
+
+    // Set for every word above level 0 with a word below it that changed, cleared by Refresh()
+    std::vector<std::vector<uint8_t>> dirty;
+};
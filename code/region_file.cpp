@@ -0,0 +1,323 @@
+#include "region_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Describes the error of the last system call that failed
+static std::string SystemError()
+{
+#ifdef _WIN32
+    return "error " + std::to_string(GetLastError());
+#else
+    return strerror(errno);
+#endif
+}
+
+RegionFile::RegionFile(const std::string& path)
+    : path(path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {Fail("couldn't open it: " + SystemError());}
+    file = handle;
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(handle, &size)) {Fail("couldn't read its size: " + SystemError());}
+    fileSize = (size_t)size.QuadPart;
+#else
+    file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file < 0) {Fail("couldn't open it: " + SystemError());}
+
+    struct stat info = {};
+    if (fstat(file, &info) != 0) {Fail("couldn't read its size: " + SystemError());}
+    fileSize = (size_t)info.st_size;
+#endif
+    bool created = fileSize == 0;
+
+    // A new file gets a table with no chunks in it, anything else has to be a region file already
+    if (fileSize == 0)
+    {
+        std::vector<uint8_t> header(headerSize, 0);
+        memcpy(header.data(), &magic, sizeof(magic));
+        memcpy(header.data() + sizeof(magic), &version, sizeof(version));
+        WriteAt(header.data(), headerSize, 0);
+        fileSize = headerSize;
+    }
+
+    Map();
+    if (!created) {CheckHeader();}
+}
+
+RegionFile::~RegionFile()
+{
+#ifdef _WIN32
+    if (mapped) {UnmapViewOfFile(mapped);}
+    if (mapping) {CloseHandle(mapping);}
+    if (file) {CloseHandle(file);}
+#else
+    if (mapped) {munmap((void*)mapped, mappedSize);}
+    if (file >= 0) {close(file);}
+#endif
+}
+
+size_t RegionFile::Read(int index, ChunkPool::Chunk& chunk)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Entry entry = ReadEntry(index);
+    if (entry.size == 0) {return 0;}
+
+    if ((size_t)entry.offset + entry.size > mappedSize) {Map();}
+
+    // Every run is a length, a type and a liquid count
+    const uint8_t* run = mapped + entry.offset;
+    const uint8_t* end = run + entry.size;
+    int voxel = 0;
+    while (run < end && voxel < ChunkPool::chunkVolume)
+    {
+        uint16_t length;
+        uint16_t liquidCount;
+        memcpy(&length, run, sizeof(length));
+        memcpy(&liquidCount, run + 3, sizeof(liquidCount));
+        uint8_t type = run[2];
+        run += 5;
+
+        for (int i = 0; i < length && voxel < ChunkPool::chunkVolume; i++, voxel++)
+        {
+            chunk.types[voxel] = type;
+            chunk.liquidCounts[voxel] = liquidCount;
+        }
+    }
+
+    return entry.size;
+}
+
+void RegionFile::Write(int index, const ChunkPool::Chunk* chunk)
+{
+    std::vector<uint8_t> data;
+    if (chunk)
+    {
+        int voxel = 0;
+        while (voxel < ChunkPool::chunkVolume)
+        {
+            uint8_t type = chunk->types[voxel];
+            uint16_t liquidCount = chunk->liquidCounts[voxel];
+            uint16_t length = 0;
+            while (voxel < ChunkPool::chunkVolume && length < UINT16_MAX && chunk->types[voxel] == type && chunk->liquidCounts[voxel] == liquidCount)
+            {
+                voxel++;
+                length++;
+            }
+
+            uint8_t run[5];
+            memcpy(run, &length, sizeof(length));
+            run[2] = type;
+            memcpy(run + 3, &liquidCount, sizeof(liquidCount));
+            data.insert(data.end(), run, run + 5);
+        }
+
+        // A chunk of nothing but air is stored as no data at all
+        if (data.size() == 5 && data[2] == Empty) {data.clear();}
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The old data stays where it is until the table points past it, so a write cut short leaves the old chunk
+    Entry old = ReadEntry(index);
+    Entry entry = {0, (uint32_t)data.size()};
+    if (!data.empty())
+    {
+        entry.offset = Allocate(entry.size);
+        WriteAt(data.data(), data.size(), entry.offset);
+    }
+
+    // The mapping is shared with the file, so the new table entry shows up in it straight away
+    WriteAt(&entry, sizeof(entry), tableOffset + index * sizeof(Entry));
+    Release(old);
+}
+
+int RegionFile::Index(int3 chunk)
+{
+    int3 local = chunk - RegionOf(chunk) * regionSize;
+    return (local.y * regionSize + local.z) * regionSize + local.x;
+}
+
+int3 RegionFile::RegionOf(int3 chunk)
+{
+    // Rounds down for negative chunks too
+    int3 offset = {chunk.x < 0 ? regionSize - 1 : 0, chunk.y < 0 ? regionSize - 1 : 0, chunk.z < 0 ? regionSize - 1 : 0};
+    return (chunk - offset) / regionSize;
+}
+
+std::string RegionFile::Name(int3 region)
+{
+    return "r." + std::to_string(region.x) + "." + std::to_string(region.y) + "." + std::to_string(region.z) + ".bin";
+}
+
+void RegionFile::CheckHeader()
+{
+    uint32_t fileMagic = 0;
+    uint32_t fileVersion = 0;
+    if (fileSize >= tableOffset)
+    {
+        memcpy(&fileMagic, mapped, sizeof(fileMagic));
+        memcpy(&fileVersion, mapped + sizeof(fileMagic), sizeof(fileVersion));
+    }
+
+    if (fileSize < headerSize || fileMagic != magic) {Fail("it isn't a region file");}
+    if (fileVersion != version) {Fail("it's version " + std::to_string(fileVersion) + ", only version " + std::to_string(version) + " can be read");}
+
+    // Every chunk's data has to be past the table, inside the file, and clear of every other chunk's
+    std::vector<Entry> used;
+    for (int index = 0; index < chunksPerRegion; index++)
+    {
+        Entry entry = ReadEntry(index);
+        if (entry.size == 0) {continue;}
+        if (entry.offset < headerSize || (size_t)entry.offset + entry.size > fileSize) {Fail("chunk " + std::to_string(index) + " points outside the file");}
+        used.push_back(entry);
+    }
+
+    std::sort(used.begin(), used.end(), [](const Entry& a, const Entry& b) {return a.offset < b.offset;});
+
+    size_t free = headerSize;
+    for (const Entry& entry : used)
+    {
+        if (entry.offset < free) {Fail("two chunks point at the same data");}
+        if (entry.offset > free) {freeSpace[(uint32_t)free] = entry.offset - (uint32_t)free;}
+        free = (size_t)entry.offset + entry.size;
+    }
+
+    if (fileSize > free) {Release({(uint32_t)free, (uint32_t)(fileSize - free)});}
+}
+
+RegionFile::Entry RegionFile::ReadEntry(int index) const
+{
+    Entry entry;
+    memcpy(&entry, mapped + tableOffset + index * sizeof(Entry), sizeof(Entry));
+    return entry;
+}
+
+uint32_t RegionFile::Allocate(uint32_t size)
+{
+    for (auto space = freeSpace.begin(); space != freeSpace.end(); space++)
+    {
+        auto [offset, spaceSize] = *space;
+        if (spaceSize < size) {continue;}
+
+        freeSpace.erase(space);
+        if (spaceSize > size) {freeSpace[offset + size] = spaceSize - size;}
+        return offset;
+    }
+
+    // Nothing big enough, so the file grows (starting from the free space at its end, if there is some)
+    size_t offset = fileSize;
+    if (!freeSpace.empty())
+    {
+        auto last = std::prev(freeSpace.end());
+        if ((size_t)last->first + last->second == fileSize)
+        {
+            offset = last->first;
+            freeSpace.erase(last);
+        }
+    }
+
+    if (offset + size > UINT32_MAX) {Fail("it would grow past the 4 GiB its table can point into");}
+
+    fileSize = offset + size;
+    return (uint32_t)offset;
+}
+
+void RegionFile::Release(Entry entry)
+{
+    if (entry.size == 0) {return;}
+
+    auto space = freeSpace.emplace(entry.offset, entry.size).first;
+
+    auto next = std::next(space);
+    if (next != freeSpace.end() && space->first + space->second == next->first)
+    {
+        space->second += next->second;
+        freeSpace.erase(next);
+    }
+
+    if (space != freeSpace.begin())
+    {
+        auto previous = std::prev(space);
+        if (previous->first + previous->second == space->first)
+        {
+            previous->second += space->second;
+            freeSpace.erase(space);
+        }
+    }
+}
+
+void RegionFile::WriteAt(const void* data, size_t size, size_t offset)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0)
+    {
+#ifdef _WIN32
+        OVERLAPPED at = {};
+        at.Offset = (DWORD)offset;
+        at.OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+        DWORD written = 0;
+        if (!WriteFile(file, bytes, (DWORD)std::min(size, (size_t)UINT32_MAX), &written, &at)) {Fail("couldn't write to it: " + SystemError());}
+        if (written == 0) {Fail("couldn't write to it: nothing was written");}
+#else
+        ssize_t written = pwrite(file, bytes, size, (off_t)offset);
+        if (written < 0 && errno == EINTR) {continue;}
+        if (written < 0) {Fail("couldn't write to it: " + SystemError());}
+        if (written == 0) {Fail("couldn't write to it: nothing was written");}
+#endif
+
+        bytes += written;
+        size -= (size_t)written;
+        offset += (size_t)written;
+    }
+}
+
+void RegionFile::Map()
+{
+#ifdef _WIN32
+    // A mapping object can't grow, so a bigger file gets a new one (views stay coherent with WriteFile either way)
+    if (mapped) {UnmapViewOfFile(mapped);}
+    if (mapping) {CloseHandle(mapping);}
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {Fail("couldn't map it: " + SystemError());}
+
+    mapped = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped) {Fail("couldn't map it: " + SystemError());}
+#else
+    if (mapped) {munmap((void*)mapped, mappedSize);}
+
+    void* view = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED) {Fail("couldn't map it: " + SystemError());}
+
+    mapped = (const uint8_t*)view;
+#endif
+    mappedSize = fileSize;
+}
+
+void RegionFile::Fail(const std::string& message) const
+{
+    std::cout << std::endl;
+    std::cout << "ERROR: region file " << path << ": " << message << std::endl;
+    std::cout << std::endl;
+
+    exit(1);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "chunk_pool.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// One file on disk holding the chunks of a region, regionSize chunks wide along every axis, read through a memory
+// mapping of the file. The file starts with a magic number, a version and a table of where every chunk's data is, then
+// the data of each chunk, run length encoded (a run is a voxel repeated up to 65535 times, so a chunk of a single
+// material is 5 bytes). A chunk written again goes into the first free space big enough for it, or the end of the file,
+// and the table is pointed at it before the space it used before is freed, so the file only grows as far as the chunks
+// in it need. A file that isn't a region file, or whose table doesn't fit its data, is refused, and so is anything
+// that would take the file past the 4 GiB the table can point into (printing the error and exiting, like Debug()).
+// Reads and writes can come from different threads.
+class RegionFile
+{
+    public:
+
+    // Opens the file at path, creating it with no chunks in it if it doesn't exist
+    RegionFile(const std::string& path);
+
+    ~RegionFile();
+
+    // Decodes a chunk into chunk, returns the bytes read, or 0 if the chunk isn't in the file (all air)
+    size_t Read(int index, ChunkPool::Chunk& chunk);
+
+    // Adds a chunk to the file, nullptr stores it as all air
+    void Write(int index, const ChunkPool::Chunk* chunk);
+
+    // Returns a chunk's index in the file, for chunk coordinates anywhere in the region
+    static int Index(int3 chunk);
+
+    // Returns the region holding a chunk
+    static int3 RegionOf(int3 chunk);
+
+    // Name of a region's file inside a directory of regions
+    static std::string Name(int3 region);
+
+    // Width, height, and depth of a region in chunks
+    static constexpr int regionSize = 8;
+
+    static constexpr int chunksPerRegion = regionSize * regionSize * regionSize;
+
+    private:
+
+    // Where a chunk's data is in the file, size is 0 for chunks that are all air
+    struct Entry
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    static constexpr uint32_t magic = 0x47525856; // "VXRG"
+    static constexpr uint32_t version = 1;
+    static constexpr size_t tableOffset = 2 * sizeof(uint32_t);
+    static constexpr size_t headerSize = tableOffset + chunksPerRegion * sizeof(Entry);
+
+    // Checks the magic number, version and table of a file that was already there, and notes the space between the
+    // chunks in freeSpace
+    void CheckHeader();
+
+    Entry ReadEntry(int index) const;
+
+    // Finds room for size bytes of chunk data, first fit in freeSpace, then at the end of the file
+    uint32_t Allocate(uint32_t size);
+
+    // Gives back the space of a chunk's old data, merged with the free space on either side of it
+    void Release(Entry entry);
+
+    // Writes all of data at offset, or fails
+    void WriteAt(const void* data, size_t size, size_t offset);
+
+    // Maps the whole file again (called when data was added past the end of the mapping)
+    void Map();
+
+    // Prints what went wrong with the file and exits
+    [[noreturn]] void Fail(const std::string& message) const;
+
+    const std::string path;
+
+#ifdef _WIN32
+    // Handles of the file and of the mapping object mapped is a view of (HANDLE, kept as void* to leave windows.h out)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+
+    const uint8_t* mapped = nullptr;
+    size_t mappedSize = 0;
+    size_t fileSize = 0;
+
+    // Free space between chunks in the file, size by offset, never two touching
+    std::map<uint32_t, uint32_t> freeSpace;
+
+    std::mutex mutex;
+};
@@ -5,3 +5,12 @@
 #define FULLSCREEN false
 #define ANTIALIAS_SAMPLES 1 // Min of 1
 #define ANTIALIAS_QUALITY 0 // Min of 0
+#define WORLD_SIZE_X 128 // Default world size, can be overridden on the command line (each axis must be a multiple of 16)
+#define WORLD_SIZE_Y 128
+#define WORLD_SIZE_Z 128
+#define VOXEL_LAYOUT 0 // 0 = linear, 1 = morton, 2 = tiled (see voxel_layout.hlsl)
+#define LIQUID_SOLVER 0 // 0 = spread, 1 = pipes (see simulation.hlsl)
+#define LABEL_LIQUID_BODIES false // Label connected bodies of liquid after every step (see liquid_labels.hlsl)
+#define CHUNKS_PER_STEP 0 // Most 16x16x16 chunks the checkerboard steps per step, 0 steps them all (see ChunkScheduler)
+#define LOD_DISTANCE 0 // Chunks from the camera stepped every step, further ones every 2nd, 4th or 8th, 0 steps them all
+#define COLLECT_WORLD_STATS true // Count voxels, liquid, moved voxels and faces after every step (see world_stats.hlsl)
@@ -0,0 +1,54 @@
+#ifndef SHADER_PERMUTATION_CPP
+#define SHADER_PERMUTATION_CPP
+
+#include "shader_permutation.h"
+
+template <typename T>
+std::string PermutationCache<T>::Key(const std::string& filePath, const std::string& functionName, const ShaderDefines& defines)
+{
+    // e.g. "../shaders/simulation.hlsl|StepSimulation|VOXEL_LAYOUT=0;WORLD_SIZE_X=128;"
+    std::string key = Escape(filePath) + "|" + Escape(functionName) + "|";
+
+    for (const auto& define : defines)
+    {
+        key += Escape(define.first) + "=" + Escape(define.second) + ";";
+    }
+
+    return key;
+}
+
+template <typename T>
+std::string PermutationCache<T>::Escape(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+
+    for (char c : text)
+    {
+        if (c == '\\' || c == '=' || c == ';' || c == '|') {escaped += '\\';}
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+template <typename T>
+T* PermutationCache<T>::Find(const std::string& key)
+{
+    auto found = permutations.find(key);
+    return (found != permutations.end()) ? &found->second : nullptr;
+}
+
+template <typename T>
+void PermutationCache<T>::Insert(const std::string& key, const T& permutation)
+{
+    permutations[key] = permutation;
+}
+
+template <typename T>
+size_t PermutationCache<T>::Size() const
+{
+    return permutations.size();
+}
+
+#endif
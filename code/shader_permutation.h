@@ -0,0 +1,38 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+// Names and values of preprocessor defines passed to a shader, kept sorted so the same set of defines always builds the same key
+typedef std::map<std::string, std::string> ShaderDefines;
+
+// Holds one compiled shader for every combination of file, entry point and defines that has been requested.
+// Doesn't depend on D3D11, so it can be used and checked on any platform.
+template<typename T>
+class PermutationCache
+{
+    public:
+
+    // Builds a key that's unique to a shader file, entry point and set of defines
+    static std::string Key(const std::string& filePath, const std::string& functionName, const ShaderDefines& defines);
+
+    // Returns the permutation stored under key, or nullptr if it hasn't been compiled yet
+    T* Find(const std::string& key);
+
+    // Stores a compiled permutation under key, replacing any permutation already stored there
+    void Insert(const std::string& key, const T& permutation);
+
+    // Number of permutations stored
+    size_t Size() const;
+
+    private:
+
+    // Puts a backslash before every separator used in keys ('=', ';' and '|') and every backslash, so a name or value
+    // holding one can't make two different permutations build the same key
+    static std::string Escape(const std::string& text);
+
+    std::unordered_map<std::string, T> permutations;
+};
+
+#include "./shader_permutation.cpp"
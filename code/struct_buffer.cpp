@@ -10,6 +10,9 @@ StructBuffer<T>::StructBuffer(StructBufferType type, uint32_t count, T* data)
 {
     uint32_t stride = sizeof(T);
 
+    // ByteWidth is 32 bits, a bigger buffer would silently wrap around to a smaller one
+    if ((uint64_t)stride * count > UINT32_MAX) {Debug("struct buffer is too big for D3D11");}
+
     // Create description for buffer
     D3D11_BUFFER_DESC bufferDesc = {};
     bufferDesc.BindFlags = (type == StructBufferType::Read) ? D3D11_BIND_SHADER_RESOURCE : D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
@@ -17,6 +20,14 @@ StructBuffer<T>::StructBuffer(StructBufferType type, uint32_t count, T* data)
     bufferDesc.ByteWidth = stride * count;
     bufferDesc.StructureByteStride = stride;
 
+    if (type == StructBufferType::Staging)
+    {
+        bufferDesc.Usage = D3D11_USAGE_STAGING;
+        bufferDesc.BindFlags = 0;
+        bufferDesc.MiscFlags = 0;
+        bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    }
+
     // If data passed in
     if (data)
     {
@@ -33,7 +44,7 @@ StructBuffer<T>::StructBuffer(StructBufferType type, uint32_t count, T* data)
     }
     
     // Create SRV
-    if (type != StructBufferType::IndirectArgs)
+    if (type != StructBufferType::IndirectArgs && type != StructBufferType::Staging)
     {
         D3D11_SHADER_RESOURCE_VIEW_DESC standardViewDesc = {};
         standardViewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
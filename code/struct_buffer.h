@@ -11,6 +11,7 @@ enum StructBufferType
     ReadWrite,
     Append,
     IndirectArgs,
+    Staging, // Can't be bound, only copied into on the GPU and mapped for reading on the CPU
 };
 
 template<typename T>
@@ -1,10 +1,61 @@
 #include "voxel.h"
 #include "camera_controller.h"
+#include "debug.h"
+#include <algorithm>
 
 void VoxelSim::Init()
 {
     simulationClock.Start();
 
+    if (worldSize.x <= 0 || worldSize.y <= 0 || worldSize.z <= 0 || worldSize.x % 16 != 0 || worldSize.y % 16 != 0 || worldSize.z % 16 != 0)
+    {
+        Debug("world size must be a positive multiple of 16 on every axis");
+    }
+
+    // Everything else is sized from the world dimensions (in 64 bits until the sizes are known to fit a buffer)
+    paddedWorldSize = worldSize + int3{2 * worldBorder, 2 * worldBorder, 2 * worldBorder};
+    uint64_t worldVoxels = (uint64_t)worldSize.x * worldSize.y * worldSize.z;
+    uint64_t paddedVoxels = (uint64_t)paddedWorldSize.x * paddedWorldSize.y * paddedWorldSize.z;
+    uint64_t surfaceVoxels = 2 * ((uint64_t)worldSize.x * worldSize.y + (uint64_t)worldSize.y * worldSize.z + (uint64_t)worldSize.z * worldSize.x);
+    uint64_t faceCount = std::min<uint64_t>(facesPerSurfaceVoxel * surfaceVoxels, worldVoxels / 2);
+
+    // D3D11 won't make a resource over 2048 MB (and a buffer's ByteWidth is 32 bits), so every buffer that grows with
+    // the world is checked before any of them is made
+    const uint64_t maxBufferBytes = (uint64_t)D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_C_TERM * 1024 * 1024;
+    auto checkBuffer = [&](const char* name, uint64_t count, uint64_t stride)
+    {
+        uint64_t bytes = count * stride;
+        if (bytes <= maxBufferBytes) {return;}
+
+        Debug(std::string(name) + " would take " + std::to_string(bytes / (1024 * 1024)) + " MB for a " + std::to_string(worldSize.x) + "x" + std::to_string(worldSize.y) + "x" + std::to_string(worldSize.z) + " world, over the " + std::to_string(maxBufferBytes / (1024 * 1024)) + " MB D3D11 allows for one buffer, make the world smaller");
+    };
+
+    checkBuffer("voxelBuffer", paddedVoxels, sizeof(Voxel));
+    checkBuffer("faceBuffer", faceCount, sizeof(Face));
+    checkBuffer("the quad index buffer", faceCount * 6, sizeof(uint32_t));
+    checkBuffer("activeCellBuffer", worldVoxels / (checkerboardGap * checkerboardGap * checkerboardGap), sizeof(uint32_t));
+    checkBuffer("columnBuffer", (uint64_t)worldSize.x * worldSize.z, sizeof(Column));
+    if (LABEL_LIQUID_BODIES) {checkBuffer("labelBuffer", worldVoxels + 3, sizeof(uint32_t));}
+
+    uint32_t voxelCount = (uint32_t)worldVoxels;
+    uint32_t paddedVoxelCount = (uint32_t)paddedVoxels;
+    maxFaces = (uint32_t)faceCount;
+
+    shaderDefines = {
+        {"WORLD_SIZE_X", std::to_string(worldSize.x)},
+        {"WORLD_SIZE_Y", std::to_string(worldSize.y)},
+        {"WORLD_SIZE_Z", std::to_string(worldSize.z)},
+        {"VOXEL_LAYOUT", std::to_string(VOXEL_LAYOUT)},
+        {"LIQUID_SOLVER", std::to_string(LIQUID_SOLVER)},
+        {"CHECKERBOARD_GAP", std::to_string(checkerboardGap)},
+        {"MASK_CHUNKS", masksChunks ? "1" : "0"},
+        {"MAX_FACES", std::to_string(maxFaces)},
+    };
+
+    chunkScheduler = new ChunkScheduler(worldSize / ChunkScheduler::chunkSize, false);
+    chunkScheduler->budget = CHUNKS_PER_STEP;
+    chunkScheduler->lodDistance = LOD_DISTANCE;
+
     //-------------------Create Shaders-------------------//
 
     // Input format for vertex shader (required even though we're rendering indirectly)
@@ -17,22 +68,90 @@ void VoxelSim::Init()
     vertexShader->Bind();
     pixelShader->Bind();
 
-    // Compute shaders
-    meshGeneration = new ComputeShader(L"../shaders/mesh_generation.hlsl");
-    resetVertexCount = new ComputeShader(L"../shaders/reset_vertex_count.hlsl", "ResetVertexCount");
-    stepSimulation = new ComputeShader(L"../shaders/simulation.hlsl", "StepSimulation");
-    resetUpdatedStatus = new ComputeShader(L"../shaders/simulation.hlsl", "ResetUpdatedStatus");
-    picker = new ComputeShader(L"../shaders/picker.hlsl", "Pick");
+    // Compute shaders (specialized for this world's size and layout)
+    meshGeneration = new ComputeShader(L"../shaders/mesh_generation.hlsl", "Compute", shaderDefines);
+    prepareMesh = new ComputeShader(L"../shaders/simulation.hlsl", "PrepareMesh", shaderDefines);
+    fallColumns = new ComputeShader(L"../shaders/simulation.hlsl", "FallColumns", shaderDefines);
+    findPools = new ComputeShader(L"../shaders/simulation.hlsl", "FindPools", shaderDefines);
+    pipeFlux = new ComputeShader(L"../shaders/simulation.hlsl", "PipeFlux", shaderDefines);
+    pipeApply = new ComputeShader(L"../shaders/simulation.hlsl", "PipeApply", shaderDefines);
+    stepSimulation = new ComputeShader(L"../shaders/simulation.hlsl", "StepSimulation", shaderDefines);
+    compactActive = new ComputeShader(L"../shaders/simulation.hlsl", "CompactActive", shaderDefines);
+    prepareActiveStep = new ComputeShader(L"../shaders/simulation.hlsl", "PrepareActiveStep", shaderDefines);
+    resetUpdatedStatus = new ComputeShader(L"../shaders/simulation.hlsl", "ResetUpdatedStatus", shaderDefines);
+    picker = new ComputeShader(L"../shaders/picker.hlsl", "Pick", shaderDefines);
+    if (LABEL_LIQUID_BODIES)
+    {
+        initializeLabels = new ComputeShader(L"../shaders/liquid_labels.hlsl", "InitializeLabels", shaderDefines);
+        propagateLabels = new ComputeShader(L"../shaders/liquid_labels.hlsl", "PropagateLabels", shaderDefines);
+        clearLiquidBodies = new ComputeShader(L"../shaders/liquid_labels.hlsl", "ClearBodies", shaderDefines);
+        countLiquidBodies = new ComputeShader(L"../shaders/liquid_labels.hlsl", "CountBodies", shaderDefines);
+        prepareLabels = new ComputeShader(L"../shaders/liquid_labels.hlsl", "PrepareLabels", shaderDefines);
+        finishLabelPass = new ComputeShader(L"../shaders/liquid_labels.hlsl", "FinishLabelPass", shaderDefines);
+    }
+    clearStats = new ComputeShader(L"../shaders/world_stats.hlsl", "ClearStats", shaderDefines);
+    countVoxels = new ComputeShader(L"../shaders/world_stats.hlsl", "CountVoxels", shaderDefines);
     
     //-------------------Create Buffers-------------------//
 
-    // argBuffer and vertexCountBuffer will be initialized to data in arr
-    uint32_t arr[4] = {0, 1, 0, 0};
-    argBuffer = new StructBuffer(IndirectArgs, 4, arr);
-    vertexCountBuffer = new StructBuffer<uint32_t>(ReadWrite, 4, arr);
-    voxelBuffer = new StructBuffer<Voxel>(ReadWrite, worldSize * worldSize * worldSize);
-    triangleBuffer = new StructBuffer<Triangle>(Append, worldSize * worldSize * worldSize);
-    worldSizeBuffer = new ConstBuffer<uint32_t>();
+    // argBuffer and indexCountBuffer will be initialized to data in arr
+    uint32_t arr[5] = {0, 1, 0, 0, 0};
+    argBuffer = new StructBuffer(IndirectArgs, 5, arr);
+    indexCountBuffer = new StructBuffer<uint32_t>(ReadWrite, 5, arr);
+    voxelBuffer = new StructBuffer<Voxel>(ReadWrite, paddedVoxelCount);
+    faceBuffer = new StructBuffer<Face>(Append, maxFaces);
+
+    // Columns start out empty, the first fallColumns dispatch fills them in
+    std::vector<Column> emptyColumns((size_t)worldSize.x * worldSize.z, {-1, -1, 0, 0, -1, -1, 0, 0, 0});
+    columnBuffer = new StructBuffer<Column>(ReadWrite, (uint32_t)emptyColumns.size(), emptyColumns.data());
+
+    // One label per voxel of the world, and the number of bodies after them (only when bodies are labelled, the labels
+    // alone are 4 bytes per voxel)
+    if (LABEL_LIQUID_BODIES)
+    {
+        labelBuffer = new StructBuffer<uint32_t>(ReadWrite, voxelCount + 3);
+        liquidBodyBuffer = new StructBuffer<LiquidBody>(ReadWrite, maxLiquidBodies);
+    }
+
+    // A phase holds one in every gap^3 voxels, and at most all of them need stepping
+    uint32_t phaseVoxelCount = voxelCount / (checkerboardGap * checkerboardGap * checkerboardGap);
+    // (one changed voxel to start with, so the first step meshes the world)
+    uint32_t activeCounts[20] = {0, 1, 1, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0};
+    activeCellBuffer = new StructBuffer<uint32_t>(ReadWrite, phaseVoxelCount);
+    activeCountBuffer = new StructBuffer<uint32_t>(ReadWrite, 20, activeCounts);
+    stepArgBuffer = new StructBuffer<uint32_t>(IndirectArgs, 20, activeCounts);
+
+    // Every chunk is picked until the first step says otherwise
+    const int3& chunkCount = chunkScheduler->chunkCount;
+    std::vector<uint32_t> allChunks(((uint32_t)chunkCount.x * chunkCount.y * chunkCount.z + 31) / 32, 0xFFFFFFFF);
+    chunkMaskBuffer = new StructBuffer<uint32_t>(Read, (uint32_t)allChunks.size(), allChunks.data());
+
+    // Lists of the picked chunks and their columns, filled in by every step (only read when masksChunks is on)
+    scheduledChunkBuffer = new StructBuffer<uint32_t>(Read, (uint32_t)chunkCount.x * chunkCount.y * chunkCount.z);
+    chunkColumnBuffer = new StructBuffer<uint32_t>(Read, (uint32_t)chunkCount.x * chunkCount.z);
+
+    WorldStats noStats = {};
+    statsBuffer = new StructBuffer<WorldStats>(ReadWrite, 1, &noStats);
+    for (uint32_t i = 0; i < statsLatency; i++)
+    {
+        statsReadback[i] = new StructBuffer<WorldStats>(Staging, 1);
+    }
+
+    // Every face is a quad of 4 vertices, drawn as 2 triangles that share 2 of them
+    std::vector<uint32_t> quadIndices;
+    quadIndices.reserve(maxFaces * 6);
+    for (uint32_t face = 0; face < maxFaces; face++)
+    {
+        uint32_t firstVertex = face * 4;
+        quadIndices.push_back(firstVertex + 0);
+        quadIndices.push_back(firstVertex + 1);
+        quadIndices.push_back(firstVertex + 2);
+        quadIndices.push_back(firstVertex + 2);
+        quadIndices.push_back(firstVertex + 1);
+        quadIndices.push_back(firstVertex + 3);
+    }
+    quadIndexBuffer = new IndexBuffer(quadIndices);
+    worldSizeBuffer = new ConstBuffer<int3>();
     simulationOffsetBuffer = new ConstBuffer<int3>();
     timeBuffer = new ConstBuffer<int>();
     pickBuffer = new ConstBuffer<PickInfo>();
@@ -41,9 +160,12 @@ void VoxelSim::Init()
     worldSizeBuffer->SetData(worldSize);
 
     // Bind all buffers needed for our compute shaders
-    Graphics::context->CSSetUnorderedAccessViews(0, 1, triangleBuffer->uav.GetAddressOf(), nullptr);    // u0
+    Graphics::context->CSSetUnorderedAccessViews(0, 1, faceBuffer->uav.GetAddressOf(), nullptr);        // u0
     Graphics::context->CSSetUnorderedAccessViews(1, 1, voxelBuffer->uav.GetAddressOf(), nullptr);       // u1
-    Graphics::context->CSSetUnorderedAccessViews(2, 1, vertexCountBuffer->uav.GetAddressOf(), nullptr); // u2
+    Graphics::context->CSSetUnorderedAccessViews(2, 1, indexCountBuffer->uav.GetAddressOf(), nullptr);  // u2
+    Graphics::context->CSSetUnorderedAccessViews(3, 1, activeCellBuffer->uav.GetAddressOf(), nullptr);  // u3
+    Graphics::context->CSSetUnorderedAccessViews(4, 1, activeCountBuffer->uav.GetAddressOf(), nullptr); // u4
+    Graphics::context->CSSetUnorderedAccessViews(5, 1, columnBuffer->uav.GetAddressOf(), nullptr);      // u5
     Graphics::context->CSSetConstantBuffers(1, 1, worldSizeBuffer->buffer.GetAddressOf());              // b1
     Graphics::context->CSSetConstantBuffers(2, 1, simulationOffsetBuffer->buffer.GetAddressOf());       // b2
     Graphics::context->CSSetConstantBuffers(3, 1, timeBuffer->buffer.GetAddressOf());                   // b3
@@ -51,38 +173,25 @@ void VoxelSim::Init()
 
     //------------------Initialize World-------------------//
 
-    // Initialize world
-    ComputeShader* initializeSimulation = new ComputeShader(L"../shaders/simulation.hlsl", "InitializeSimulation");
-    initializeSimulation->Dispatch(worldSize / 4, worldSize / 4, worldSize / 4);
+    // Initialize world (covers the border too, so it can be filled with walls)
+    ComputeShader* initializeSimulation = new ComputeShader(L"../shaders/simulation.hlsl", "InitializeSimulation", shaderDefines);
+    initializeSimulation->Dispatch(paddedWorldSize.x / 4, paddedWorldSize.y / 4, paddedWorldSize.z / 4);
     Step();
 
-    place = new ComputeShader(L"../shaders/simulation.hlsl", "Place");
+    place = new ComputeShader(L"../shaders/simulation.hlsl", "Place", shaderDefines);
 }
 
 void VoxelSim::Update()
 {
     place->Dispatch(1, 1, 1);
 
-    // Use the below numbers to select what type of voxel to place
-
-    if (Input::GetKeyDown('1'))
-    {
-        typeToPlace = 1;
-    }
-
-    else if (Input::GetKeyDown('2'))
-    {
-        typeToPlace = 2;
-    }
-
-    else if (Input::GetKeyDown('3'))
+    // Use the number keys to select what type of voxel to place (each number is a material id in materials.def)
+    for (int type = 1; type < materialCount && type <= 9; type++)
     {
-        typeToPlace = 3;
-    }
-
-    else if (Input::GetKeyDown('4'))
-    {
-        typeToPlace = 4;
+        if (Input::GetKeyDown('0' + type))
+        {
+            typeToPlace = type;
+        }
     }
 
     // If enough time has passed and it's time to do a step
@@ -100,37 +209,127 @@ void VoxelSim::Update()
 
             pickBuffer->SetData(info);
             picker->Dispatch(1, 1, 1);
+            lastEditStep = statsCopies;
         }
 
-        // Then step simulation
+        // Then step simulation, unless nothing would change (the mesh from the last step is drawn either way)
         simulationClock.Stop();
-        Step();
+        if (!IsIdle()) {Step();}
         simulationClock.Restart();
     }
 
     vertexShader->Bind();
     pixelShader->Bind();
-    Graphics::context->DrawInstancedIndirect(argBuffer->buffer.Get(), 0);
+    quadIndexBuffer->Bind();
+    Graphics::context->DrawIndexedInstancedIndirect(argBuffer->buffer.Get(), 0);
 }
 
 void VoxelSim::Step()
 {
-    // Set triangle buffer as UAV for compute shaders
+    // Unbind face buffer as SRV so it can be used as UAV by compute shaders
     ID3D11ShaderResourceView *blank1 = nullptr;
-    UINT initialCounterValue = 0;
-    Graphics::context->CSSetUnorderedAccessViews(0, 1, triangleBuffer->uav.GetAddressOf(), &initialCounterValue); // u0
+    Graphics::context->VSSetShaderResources(1, 1, &blank1);
 
-    // Set vertex count back to 0
-    resetVertexCount->Dispatch(1, 1, 1);
+    // Set face buffer as UAV for compute shaders
+    UINT initialCounterValue = 0;
+    Graphics::context->CSSetUnorderedAccessViews(0, 1, faceBuffer->uav.GetAddressOf(), &initialCounterValue); // u0
 
     // Update time buffer for simulation
     std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
     std::chrono::duration<float> duration = now - Application::startTime;
     timeBuffer->SetData(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
 
-    int gap = 4;
+    // Pick the chunks this step covers, favoring the ones around the camera (first, so the column kernels only cover
+    // their columns)
+    if (masksChunks)
+    {
+        const float3& cameraPosition = CameraController::cam.GetPosition();
+        int chunkSize = ChunkScheduler::chunkSize;
+        chunkScheduler->focus = {(int)cameraPosition.x / chunkSize, (int)cameraPosition.y / chunkSize, (int)cameraPosition.z / chunkSize};
+        const std::vector<uint32_t>& scheduled = chunkScheduler->Schedule();
+        SetChunkMask(scheduled);
+        SetChunkColumns(scheduled);
+        chunkScheduler->Finish();
+    }
+
+    // Move solids falling through air first, a whole column per thread, so long drops don't need a phase per voxel
+    DispatchColumns(fallColumns);
+
+    // Level out liquid lying on the ground a whole column at a time, while the columns fallColumns wrote are still exact
+    if (LIQUID_SOLVER == 1)
+    {
+        DispatchColumns(findPools);
+        DispatchColumns(pipeFlux);
+        DispatchColumns(pipeApply);
+    }
+
+    StepCheckerboard();
+
+    // Chunks that came close to the camera make up for the steps they missed while far away, one pass at a time
+    // (every pass is a step of its own for them, so their voxels can be updated again)
+    for (int pass = 0; masksChunks && pass < ChunkScheduler::catchUpPasses; pass++)
+    {
+        const std::vector<uint32_t>& behind = chunkScheduler->CatchUp();
+        if (behind.empty()) {break;}
+
+        resetUpdatedStatus->Dispatch(worldSize.x / 4, worldSize.y / 4, worldSize.z / 4);
+        SetChunkMask(behind);
+        StepCheckerboard();
+    }
 
-    // Run simulation in checkerboard pattern
+    resetUpdatedStatus->Dispatch(worldSize.x / 4, worldSize.y / 4, worldSize.z / 4);
+
+    // Generate faces with new voxel data, only if any voxel changed (otherwise no thread groups run, and the faces and
+    // index count from the last mesh are kept)
+    prepareMesh->Dispatch(1, 1, 1);
+    Graphics::context->CopyResource(stepArgBuffer->buffer.Get(), activeCountBuffer->buffer.Get());
+    meshGeneration->DispatchIndirect(stepArgBuffer->buffer.Get(), 7 * sizeof(uint32_t));
+
+    // Copy new index count over to arg buffer
+    Graphics::context->CopyResource(argBuffer->buffer.Get(), indexCountBuffer->buffer.Get());
+
+    // Find every connected body of liquid from scratch, only after a step that changed a voxel (prepareMesh has just
+    // counted them) and only for as many propagation passes as it takes to settle. u6 is shared with statsBuffer, so
+    // it's bound for every step (D3D11.0 compute shaders only have u0-u7)
+    if (LABEL_LIQUID_BODIES)
+    {
+        Graphics::context->CSSetUnorderedAccessViews(6, 1, labelBuffer->uav.GetAddressOf(), nullptr);      // u6
+        Graphics::context->CSSetUnorderedAccessViews(7, 1, liquidBodyBuffer->uav.GetAddressOf(), nullptr); // u7
+        prepareLabels->Dispatch(1, 1, 1);
+        Graphics::context->CopyResource(stepArgBuffer->buffer.Get(), activeCountBuffer->buffer.Get());
+        initializeLabels->DispatchIndirect(stepArgBuffer->buffer.Get(), 10 * sizeof(uint32_t));
+        for (int pass = 0; pass < maxLabelPasses; pass++)
+        {
+            Graphics::context->CopyResource(stepArgBuffer->buffer.Get(), activeCountBuffer->buffer.Get());
+            propagateLabels->DispatchIndirect(stepArgBuffer->buffer.Get(), 13 * sizeof(uint32_t));
+            finishLabelPass->Dispatch(1, 1, 1);
+        }
+        Graphics::context->CopyResource(stepArgBuffer->buffer.Get(), activeCountBuffer->buffer.Get());
+        clearLiquidBodies->DispatchIndirect(stepArgBuffer->buffer.Get(), 16 * sizeof(uint32_t));
+        countLiquidBodies->DispatchIndirect(stepArgBuffer->buffer.Get(), 10 * sizeof(uint32_t));
+    }
+
+    // Sum up the world once it's been meshed, and start it on its way back to the CPU
+    if (COLLECT_WORLD_STATS)
+    {
+        Graphics::context->CSSetUnorderedAccessViews(6, 1, statsBuffer->uav.GetAddressOf(), nullptr); // u6
+        clearStats->Dispatch(1, 1, 1);
+        countVoxels->Dispatch(worldSize.x / 4, worldSize.y / 4, worldSize.z / 4);
+        ReadStats();
+    }
+
+    // Unbind face buffer as UAV for later use as SRV in vertex shader
+    ID3D11UnorderedAccessView *blank = nullptr;
+    Graphics::context->CSSetUnorderedAccessViews(0, 1, &blank, nullptr);
+    Graphics::context->VSSetShaderResources(1, 1, faceBuffer->srv.GetAddressOf()); // t1
+}
+
+void VoxelSim::StepCheckerboard()
+{
+    int gap = checkerboardGap;
+
+    // Run simulation in checkerboard pattern. Most of the world is air, so every phase first lists the voxels that need
+    // stepping, then only launches a thread for each of those (the CPU never needs to know how many there are)
     for (int x = 0; x < gap; x++)
     {
         for (int y = 0; y < gap; y++)
@@ -138,21 +337,106 @@ void VoxelSim::Step()
             for (int z = 0; z < gap; z++)
             {
                 simulationOffsetBuffer->SetData({x, y, z});
-                stepSimulation->Dispatch((worldSize / gap) / 4, (worldSize / gap) / 4, (worldSize / gap) / 4);
+                if (masksChunks)
+                {
+                    // PHASE_GROUPS_PER_CHUNK in simulation.hlsl along every axis of every picked chunk
+                    int groupsPerChunk = ChunkScheduler::chunkSize / gap / 4;
+                    compactActive->Dispatch(groupsPerChunk, groupsPerChunk * scheduledChunkCount, groupsPerChunk);
+                }
+                else
+                {
+                    compactActive->Dispatch((worldSize.x / gap) / 4, (worldSize.y / gap) / 4, (worldSize.z / gap) / 4);
+                }
+                prepareActiveStep->Dispatch(1, 1, 1);
+                Graphics::context->CopyResource(stepArgBuffer->buffer.Get(), activeCountBuffer->buffer.Get());
+                stepSimulation->DispatchIndirect(stepArgBuffer->buffer.Get());
             }
         }
     }
+}
+
+void VoxelSim::SetChunkMask(const std::vector<uint32_t>& chunks)
+{
+    const int3& chunkCount = chunkScheduler->chunkCount;
+    std::vector<uint32_t> chunkMask(((uint32_t)chunkCount.x * chunkCount.y * chunkCount.z + 31) / 32, 0);
+    for (uint32_t chunk : chunks)
+    {
+        chunkMask[chunk / 32] |= 1u << (chunk % 32);
+    }
 
-    resetUpdatedStatus->Dispatch(worldSize / 4, worldSize / 4, worldSize / 4);
+    Graphics::context->UpdateSubresource(chunkMaskBuffer->buffer.Get(), 0, nullptr, chunkMask.data(), 0, 0);
+    Graphics::context->CSSetShaderResources(0, 1, chunkMaskBuffer->srv.GetAddressOf()); // t0
 
-    // Generate triangles with new voxel data
-    meshGeneration->Dispatch(worldSize / 4, worldSize / 4, worldSize / 4);
+    // Only the first scheduledChunkCount entries are read, the rest of the buffer is whatever was there
+    std::vector<uint32_t> chunkList(chunks);
+    chunkList.resize((size_t)chunkCount.x * chunkCount.y * chunkCount.z, 0);
+    scheduledChunkCount = (uint32_t)chunks.size();
 
-    // Copy new vertex count over to arg buffer
-    Graphics::context->CopyResource(argBuffer->buffer.Get(), vertexCountBuffer->buffer.Get());
+    Graphics::context->UpdateSubresource(scheduledChunkBuffer->buffer.Get(), 0, nullptr, chunkList.data(), 0, 0);
+    Graphics::context->CSSetShaderResources(1, 1, scheduledChunkBuffer->srv.GetAddressOf()); // t1
+}
 
-    // Unbind triangle buffer as UAV for later use as SRV in vertex shader
-    ID3D11UnorderedAccessView *blank = nullptr;
-    Graphics::context->CSSetUnorderedAccessViews(0, 1, &blank, nullptr);
-    Graphics::context->VSSetShaderResources(1, 1, triangleBuffer->srv.GetAddressOf()); // t1
+void VoxelSim::SetChunkColumns(const std::vector<uint32_t>& chunks)
+{
+    const int3& chunkCount = chunkScheduler->chunkCount;
+    std::vector<uint8_t> picked((size_t)chunkCount.x * chunkCount.z, 0);
+    for (uint32_t chunk : chunks)
+    {
+        int3 position = chunkScheduler->Position(chunk);
+        picked[position.z * chunkCount.x + position.x] = 1;
+    }
+
+    std::vector<uint32_t> columnList(picked.size(), 0);
+    chunkColumnCount = 0;
+    for (uint32_t column = 0; column < (uint32_t)picked.size(); column++)
+    {
+        if (picked[column]) {columnList[chunkColumnCount++] = column;}
+    }
+
+    Graphics::context->UpdateSubresource(chunkColumnBuffer->buffer.Get(), 0, nullptr, columnList.data(), 0, 0);
+    Graphics::context->CSSetShaderResources(2, 1, chunkColumnBuffer->srv.GetAddressOf()); // t2
+}
+
+void VoxelSim::DispatchColumns(ComputeShader* shader)
+{
+    if (masksChunks)
+    {
+        // ThreadColumn in simulation.hlsl turns the group along y into a column of chunks
+        shader->Dispatch(ChunkScheduler::chunkSize / 4, chunkColumnCount, ChunkScheduler::chunkSize / 4);
+    }
+    else
+    {
+        shader->Dispatch(worldSize.x / 4, 1, worldSize.z / 4);
+    }
+}
+
+void VoxelSim::ReadStats()
+{
+    // Queue a copy of this step's stats, the GPU gets to it whenever it's done with the step
+    Graphics::context->CopyResource(statsReadback[statsCopies % statsLatency]->buffer.Get(), statsBuffer->buffer.Get());
+    statsCopies++;
+
+    // The copy made statsLatency - 1 steps ago is next in the ring, it's only read if it has landed, so this never stalls
+    if (statsCopies < statsLatency) {return;}
+
+    ID3D11Buffer* oldest = statsReadback[statsCopies % statsLatency]->buffer.Get();
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    if (Graphics::context->Map(oldest, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped) == S_OK)
+    {
+        stats = *(WorldStats*)mapped.pData;
+        statsStep = statsCopies - statsLatency;
+        Graphics::context->Unmap(oldest, 0);
+    }
+}
+
+bool VoxelSim::IsIdle()
+{
+    // Needs the stats read back from the GPU, and the ones read have to be from after the last edit
+    if (!COLLECT_WORLD_STATS || statsCopies < statsLatency || statsStep < lastEditStep || stats.unchangedSteps < idleSteps) {return false;}
+
+    // Steps only cover the chunks picked for them, so chunks that weren't picked could still be moving. Every chunk has
+    // to have gone idleSteps of its own steps without a change, so the steps that changed nothing have to hold that
+    // many whole rotations of the scheduler.
+    if (!masksChunks) {return true;}
+    return chunkScheduler->Rotations((int64_t)statsStep - stats.unchangedSteps + 1, statsStep) >= idleSteps;
 }
\ No newline at end of file
@@ -16,34 +16,69 @@
 #include "compute_shader.h"
 #include "struct_buffer.h"
 #include "vertex_buffer.h"
+#include "index_buffer.h"
+#include "voxel_layout.h"
+#include "materials.h"
+#include "settings.h"
+#include "chunk_scheduler.h"
 #include <cstdio>
 #include <chrono>
 
-struct Triangle
+struct Face
 {
-  float3 vertA;
-  float3 vertB;
-  float3 vertC;
-  float3 normal;
+  float3 position;
+  int direction;
   int voxelType;
-  int padding;
-  int padding2;
 };
 
-struct int3
+// What voxelBuffer holds for every voxel (must match Voxel in voxel_struct.hlsl, shared by every shader that binds it)
+struct Voxel
 {
-  int32_t x;
-  int32_t y;
-  int32_t z;
+  int16_t type;
+  uint32_t fallSpeed; // Voxels per step it's falling through air at, 0 when it isn't (FallColumns in simulation.hlsl)
+  uint32_t quietSteps; // Steps in a row the voxel has failed to move, it's asleep at SLEEP_STEPS (simulation.hlsl)
+  bool updatedThisStep;
+  uint32_t liquidCount; // In units of MAX_LIQUID (materials.hlsl)
 };
 
-struct Voxel
+// 4 bytes per field on the GPU (half and bool included), so big worlds fit in one buffer (see VoxelSim::Init)
+static_assert(sizeof(Voxel) == 20, "Voxel has to match the 20 byte stride of Voxel in voxel_struct.hlsl");
+
+// Topmost solid and liquid voxel of a column of the world, -1 when there isn't one, and the liquid flowing out of it
+// through its +x and +z side when LIQUID_SOLVER is pipes (column_map.hlsl)
+struct Column
 {
-  int16_t type;
-  float3 velocity;
-  float lifeTime;
-  bool updatedThisFrame;
-  float fluidCount;
+  int32_t topSolid;
+  int32_t topLiquid;
+  int32_t pipeX;
+  int32_t pipeZ;
+  int32_t poolGround; // Pool found by FindPools in simulation.hlsl, read by PipeFlux and PipeApply
+  int32_t poolTop;
+  int32_t poolType;
+  int32_t poolLiquid;
+  int32_t poolRoom;
+};
+
+// One connected body of liquid, root is the label every voxel of it ends up with (liquid_labels.hlsl)
+struct LiquidBody
+{
+  uint32_t root; // 0xFFFFFFFF when the entry is free
+  uint32_t type;
+  uint32_t voxelCount;
+  uint32_t liquid;
+  int3 min;
+  int3 max;
+};
+
+// Everything world_stats.hlsl counts after a step, read back into VoxelSim::stats a few steps later
+struct WorldStats
+{
+  uint32_t voxelCounts[materialCount]; // Indexed by voxel type
+  uint32_t liquidLow; // Liquid in the world is liquidHigh * 2^32 + liquidLow
+  uint32_t liquidHigh;
+  uint32_t movedVoxels; // Voxels whose type or liquid changed during the step
+  uint32_t faceCount;
+  uint32_t unchangedSteps; // Steps in a row, up to this one, that changed no voxel
 };
 
 struct PickInfo
@@ -67,10 +102,66 @@ class VoxelSim
   // Advances voxel simulation forward once
   static void Step();
 
+  // Runs every phase of the checkerboard, over the chunks in scheduledChunkBuffer when masksChunks is on
+  static void StepCheckerboard();
+
+  // Sets the bits of the given chunks in chunkMaskBuffer and clears the rest, and lists them in scheduledChunkBuffer
+  static void SetChunkMask(const std::vector<uint32_t>& chunks);
+
+  // Lists every column of chunks holding one of the given chunks in chunkColumnBuffer
+  static void SetChunkColumns(const std::vector<uint32_t>& chunks);
+
+  // Dispatches a kernel with a thread per column (4x1x4 groups), over the columns of chunks in chunkColumnBuffer when
+  // masksChunks is on, and over the whole world otherwise
+  static void DispatchColumns(ComputeShader* shader);
+
+  // Copies this step's stats into the readback ring, and reads the oldest copy into stats if the GPU is done with it
+  static void ReadStats();
+
+  // Latest stats read back from the GPU (statsLatency - 1 steps old when the GPU keeps up, older when it doesn't)
+  static inline WorldStats stats = {};
+
+  // Step the stats were collected after, counting from 0 at Init()
+  static inline uint32_t statsStep = 0;
+
+  // Staging buffers in the readback ring, so the stats of a step are read statsLatency - 1 steps after it ran
+  static const inline uint32_t statsLatency = 3;
+
+  // Steps in a row that have to change nothing before the world counts as idle and stops being stepped, longer than
+  // SLEEP_STEPS so anything that could still slide has either moved or fallen asleep by then
+  static const inline uint32_t idleSteps = 16;
+
+  // Value of statsCopies when voxels were last placed, stats from before then can't say the world is idle
+  static inline uint32_t lastEditStep = 0;
+
+  // Indicates if the world is known to have stopped changing since the last edit, so stepping it would do nothing
+  static bool IsIdle();
+
   static inline int typeToPlace = 1;
 
-  // Width, height, and depth of world
-  static const inline uint32_t worldSize = 128;
+  // Width, height, and depth of world; can be changed any time before Init()
+  // (each axis must be a multiple of 16, so the checkerboard dispatches divide evenly into 4x4x4 thread groups)
+  static inline int3 worldSize = {WORLD_SIZE_X, WORLD_SIZE_Y, WORLD_SIZE_Z};
+
+  // Width of the immutable wall border stored around the world, so shaders can read neighbors without bounds checks
+  // (2 keeps the padded size a multiple of the 4x4x4 thread groups)
+  static const inline int32_t worldBorder = WORLD_BORDER;
+
+  // Width, height, and depth of voxelBuffer (world plus border on both sides), set in Init()
+  static inline int3 paddedWorldSize = {0, 0, 0};
+
+  // Distance between voxels updated by the same stepSimulation dispatch
+  static const inline int checkerboardGap = 4;
+
+  // Picks the chunks compactActive lists voxels from when masksChunks is on, closest to the camera first. Nothing is
+  // read back to say which chunks changed, so every chunk is stepped in turn. (set in Init())
+  static inline ChunkScheduler* chunkScheduler = nullptr;
+
+  // Whether the checkerboard only covers the chunks chunkScheduler picks (MASK_CHUNKS in simulation.hlsl)
+  static const inline bool masksChunks = CHUNKS_PER_STEP > 0 || LOD_DISTANCE > 0;
+
+  // Defines every compute shader is compiled with, so world size, layout and gap are constants inside them (set in Init())
+  static inline ShaderDefines shaderDefines = {};
 
   // How many times voxels will update per second (vsync will limit this to 60 or 120)
   static inline uint32_t stepsPerSecond = 120; 
@@ -78,15 +169,72 @@ class VoxelSim
   // Keeps track of when to update simulation
   static inline Timer simulationClock = Timer();
 
-  // Generates triangles for each voxel and places them in the trianglesBuffer (mesh_generation.hlsl)
+  // Most faces the mesh can hold, faces past it are dropped (set in Init(), from facesPerSurfaceVoxel)
+  static inline uint32_t maxFaces = 0;
+
+  // Faces the mesh has room for per voxel of the world's bounding surface (both sides of every axis). Visible faces
+  // follow the surface of what's in the world rather than its volume, so this keeps faceBuffer and the quad indices from
+  // growing with the cube of the world size.
+  static const inline uint32_t facesPerSurfaceVoxel = 8;
+
+  // Generates faces for each voxel and places them in the faceBuffer (mesh_generation.hlsl)
   static inline ComputeShader* meshGeneration = nullptr;
 
-  // Resets the vertex count inside the vertexCountBuffer (reset_vertex_count.hlsl)
-  static inline ComputeShader* resetVertexCount = nullptr;
+  // Writes the thread groups of the mesh generation, none when no voxel changed since the last mesh (simulation.hlsl)
+  static inline ComputeShader* prepareMesh = nullptr;
+
+  // Moves solids falling through air, one thread per column, before the checkerboard runs (simulation.hlsl)
+  static inline ComputeShader* fallColumns = nullptr;
 
-  // Calculates new voxel values from the old values (simulation.hlsl)
+  // Finds the liquid pool of every column for pipeFlux and pipeApply, when LIQUID_SOLVER is pipes (simulation.hlsl)
+  static inline ComputeShader* findPools = nullptr;
+
+  // Updates the pipes between the liquid pools of neighboring columns, when LIQUID_SOLVER is pipes (simulation.hlsl)
+  static inline ComputeShader* pipeFlux = nullptr;
+
+  // Refills every column's pool with the liquid that flowed through its pipes, when LIQUID_SOLVER is pipes (simulation.hlsl)
+  static inline ComputeShader* pipeApply = nullptr;
+
+  // Gives every liquid voxel its own label, when LABEL_LIQUID_BODIES is on (liquid_labels.hlsl)
+  static inline ComputeShader* initializeLabels = nullptr;
+
+  // Merges the labels of touching voxels of the same liquid, until a pass changes nothing (liquid_labels.hlsl)
+  static inline ComputeShader* propagateLabels = nullptr;
+
+  // Frees every entry of liquidBodyBuffer (liquid_labels.hlsl)
+  static inline ComputeShader* clearLiquidBodies = nullptr;
+
+  // Gives the label kernels thread groups only after a step that changed a voxel (liquid_labels.hlsl)
+  static inline ComputeShader* prepareLabels = nullptr;
+
+  // Gives the propagateLabels passes left no thread groups once a pass changed no label (liquid_labels.hlsl)
+  static inline ComputeShader* finishLabelPass = nullptr;
+
+  // Adds up the voxels, liquid and bounds of every labelled body into liquidBodyBuffer (liquid_labels.hlsl)
+  static inline ComputeShader* countLiquidBodies = nullptr;
+
+  // Takes the changed voxels and face count of a step, and clears the rest of statsBuffer (world_stats.hlsl)
+  static inline ComputeShader* clearStats = nullptr;
+
+  // Adds up the voxels of every material and their liquid into statsBuffer (world_stats.hlsl)
+  static inline ComputeShader* countVoxels = nullptr;
+
+  // Most label propagation passes dispatched per step. Passes after the labels have settled run no thread groups, so
+  // this only bounds bodies long and winding enough to need more (labelBuffer says when that happened).
+  static const inline int maxLabelPasses = 128;
+
+  // Entries in liquidBodyBuffer (BODY_TABLE_SIZE in liquid_labels.hlsl)
+  static const inline uint32_t maxLiquidBodies = 1024;
+
+  // Calculates new voxel values from the old values, for every voxel in activeCellBuffer (simulation.hlsl)
   static inline ComputeShader* stepSimulation = nullptr;
 
+  // Lists the voxels of one checkerboard phase that need stepping in activeCellBuffer (simulation.hlsl)
+  static inline ComputeShader* compactActive = nullptr;
+
+  // Turns the number of listed voxels into thread group counts for stepSimulation (simulation.hlsl)
+  static inline ComputeShader* prepareActiveStep = nullptr;
+
   // Resets the updated status for all voxels (changes them all back to updated=false)
   static inline ComputeShader* resetUpdatedStatus = nullptr;
 
@@ -96,30 +244,84 @@ class VoxelSim
   // Runs continuously, 
   static inline ComputeShader* place = nullptr;
   
-  // Renders using the triangles inside the triangleBuffer below (voxel.hlsl)
+  // Renders using the faces inside the faceBuffer below (voxel.hlsl)
   static inline VertexShader* vertexShader = nullptr;
 
   // Fairly simple lighting shader (voxel.hlsl)
   static inline PixelShader* pixelShader = nullptr;
 
-  // Holds required info for every voxel
+  // Holds required info for every voxel, including the wall border around the world
   static inline StructBuffer<Voxel>* voxelBuffer = nullptr;
 
-  // Holds triangles created from voxelGenerator compute shader; these are later read by vertex shader
-  static inline StructBuffer<Triangle>* triangleBuffer = nullptr;
+  // Holds a Column for every (x, z) of the world, written by fallColumns every step and raised by voxel writes
+  static inline StructBuffer<Column>* columnBuffer = nullptr;
 
-  // Keeps track of total vertices for the DrawInstancedIndirect() call later
-  static inline StructBuffer<uint32_t>* vertexCountBuffer = nullptr;
+  // Holds the liquid body label of every voxel of the world, then the number of bodies found, the number left out
+  // because liquidBodyBuffer was full, and 1 if the labels hadn't settled after maxLabelPasses (null unless
+  // LABEL_LIQUID_BODIES is on, like liquidBodyBuffer and the label shaders)
+  static inline StructBuffer<uint32_t>* labelBuffer = nullptr;
 
-  // Holds info passed to the DrawInstancedIndirect call:
-  // argBuffer[0] = vertex count per instance (comes from vertexCountBuffer)
+  // Holds every liquid body found in the last step, as a hash table keyed by root
+  static inline StructBuffer<LiquidBody>* liquidBodyBuffer = nullptr;
+
+  // Holds a bit for every chunk, set for the ones chunkScheduler picked for the current step (t0)
+  static inline StructBuffer<uint32_t>* chunkMaskBuffer = nullptr;
+
+  // The same chunks as a list, compactActive is dispatched over the first scheduledChunkCount of them (t1)
+  static inline StructBuffer<uint32_t>* scheduledChunkBuffer = nullptr;
+
+  static inline uint32_t scheduledChunkCount = 0;
+
+  // Columns of chunks holding a chunk picked for the step, the column kernels are dispatched over the first
+  // chunkColumnCount of them (t2)
+  static inline StructBuffer<uint32_t>* chunkColumnBuffer = nullptr;
+
+  static inline uint32_t chunkColumnCount = 0;
+
+  // Holds the WorldStats of the last step
+  static inline StructBuffer<WorldStats>* statsBuffer = nullptr;
+
+  // Ring of copies of statsBuffer the CPU reads from, the copy of the current step is written to statsReadback[statsCopies % statsLatency]
+  static inline StructBuffer<WorldStats>* statsReadback[statsLatency] = {};
+
+  // Times statsBuffer has been copied into the ring
+  static inline uint32_t statsCopies = 0;
+
+  // Holds faces created from meshGeneration compute shader; these are later read by vertex shader
+  static inline StructBuffer<Face>* faceBuffer = nullptr;
+
+  // Holds indices 0, 1, 2, 2, 1, 3 repeated for every face (offset by 4 each time), shared by all frames
+  static inline IndexBuffer* quadIndexBuffer = nullptr;
+
+  // Keeps track of total indices for the DrawIndexedInstancedIndirect() call later
+  static inline StructBuffer<uint32_t>* indexCountBuffer = nullptr;
+
+  // Holds info passed to the DrawIndexedInstancedIndirect call:
+  // argBuffer[0] = index count per instance (comes from indexCountBuffer)
   // argBuffer[1] = instance count (# of times to draw our verts; will always be 1)
-  // argBuffer[2] = start vertex location (will always be 0)
-  // argBuffer[3] = start instance location (will always be 0)
+  // argBuffer[2] = start index location (will always be 0)
+  // argBuffer[3] = base vertex location (will always be 0)
+  // argBuffer[4] = start instance location (will always be 0)
   static inline StructBuffer<uint32_t>* argBuffer = nullptr;
 
-  // Holds worldsize integer, required for all compute shaders
-  static inline ConstBuffer<uint32_t>* worldSizeBuffer = nullptr;
+  // Positions of the voxels stepSimulation steps in the current phase (one per voxel in a phase at most)
+  static inline StructBuffer<uint32_t>* activeCellBuffer = nullptr;
+
+  // Counts written by compactActive and prepareActiveStep:
+  // activeCountBuffer[0-2] = thread groups for stepSimulation (copied into stepArgBuffer)
+  // activeCountBuffer[3] = voxels listed so far by compactActive
+  // activeCountBuffer[4] = voxels in the list stepSimulation is stepping
+  // activeCountBuffer[5] = voxels changed since prepareMesh last took the count (see CountChangedVoxels in voxel_helpers.hlsl)
+  // activeCountBuffer[6] = voxels changed during the last step
+  // activeCountBuffer[7-9] = thread groups for meshGeneration, written by prepareMesh
+  // activeCountBuffer[10-19] = thread groups for the label kernels and whether a pass changed a label (liquid_labels.hlsl)
+  static inline StructBuffer<uint32_t>* activeCountBuffer = nullptr;
+
+  // Holds the thread group counts passed to every DispatchIndirect() call (a copy of activeCountBuffer)
+  static inline StructBuffer<uint32_t>* stepArgBuffer = nullptr;
+
+  // Holds worldSize, required for all compute shaders
+  static inline ConstBuffer<int3>* worldSizeBuffer = nullptr;
 
   static inline ConstBuffer<int3>* simulationOffsetBuffer = nullptr;
 
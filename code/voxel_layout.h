@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+// Width of the wall border stored around the world (must match WORLD_BORDER in voxel_layout.hlsl)
+#define WORLD_BORDER 2
+
+struct int3
+{
+  int32_t x;
+  int32_t y;
+  int32_t z;
+};
+
+inline int3 operator+(int3 a, int3 b) {return {a.x + b.x, a.y + b.y, a.z + b.z};}
+
+inline int3 operator-(int3 a, int3 b) {return {a.x - b.x, a.y - b.y, a.z - b.z};}
+
+inline int3 operator*(int3 a, int32_t b) {return {a.x * b, a.y * b, a.z * b};}
+
+// Rounds towards 0 like int division, so only use it on positions that aren't negative
+inline int3 operator/(int3 a, int32_t b) {return {a.x / b, a.y / b, a.z / b};}
+
+// Each layout below decides where a voxel lives in memory, and matches one VOXEL_LAYOUT in voxel_layout.hlsl.
+// Positions passed to Index() are already offset by WORLD_BORDER, and every axis of paddedSize is a multiple of 4.
+
+// Rows along x, then z, then y (LAYOUT_LINEAR)
+struct LinearLayout
+{
+    static constexpr const char* name = "linear";
+
+    // Voxels next to each other along x are next to each other in memory
+    static constexpr bool contiguousRows = true;
+
+    static inline uint32_t Index(int3 position, int3 paddedSize)
+    {
+        return (position.y * paddedSize.z * paddedSize.x) + (position.z * paddedSize.x) + position.x;
+    }
+};
+
+// 4x4x4 bricks stored one after another, Z-order inside each brick (LAYOUT_MORTON)
+// Bricks themselves are stored linearly, so the world doesn't need to be padded up to a power of 2
+struct MortonLayout
+{
+    static constexpr const char* name = "morton";
+
+    static constexpr bool contiguousRows = false;
+
+    // Spreads the low 2 bits of a value apart, so bits from the other two axes can be placed between them
+    static inline uint32_t SpreadBits(uint32_t value)
+    {
+        return (value & 1) | ((value & 2) << 2);
+    }
+
+    static inline uint32_t Index(int3 position, int3 paddedSize)
+    {
+        uint32_t bricksX = paddedSize.x / 4;
+        uint32_t bricksZ = paddedSize.z / 4;
+        uint32_t brickIndex = ((position.y >> 2) * bricksZ * bricksX) + ((position.z >> 2) * bricksX) + (position.x >> 2);
+        uint32_t localIndex = SpreadBits(position.x & 3) | (SpreadBits(position.y & 3) << 1) | (SpreadBits(position.z & 3) << 2);
+        return brickIndex * 64 + localIndex;
+    }
+};
+
+// 4x4x4 bricks stored one after another, rows along x inside each brick (LAYOUT_TILED)
+struct TiledLayout
+{
+    static constexpr const char* name = "tiled";
+
+    static constexpr bool contiguousRows = false;
+
+    static inline uint32_t Index(int3 position, int3 paddedSize)
+    {
+        uint32_t bricksX = paddedSize.x / 4;
+        uint32_t bricksZ = paddedSize.z / 4;
+        uint32_t brickIndex = ((position.y >> 2) * bricksZ * bricksX) + ((position.z >> 2) * bricksX) + (position.x >> 2);
+        uint32_t localIndex = ((position.y & 3) * 16) + ((position.z & 3) * 4) + (position.x & 3);
+        return brickIndex * 64 + localIndex;
+    }
+};
@@ -0,0 +1,59 @@
+// This file holds a summary of every (x, z) column of the world, so shaders can answer "is there anything at or
+// above this height" without walking the column. Every shader that reads or writes it includes this file after
+// voxel_layout.hlsl and materials.hlsl, and the CPU port keeps the same summary in ColumnMap (see column_map.h).
+
+#ifndef COLUMN_MAP_HLSL
+#define COLUMN_MAP_HLSL
+
+// Height of the topmost solid voxel in a column, and of the topmost liquid voxel above it (the surface of whatever
+// liquid lies on the ground), -1 when there isn't one. FallColumns writes them exactly every step, and writes after
+// that only ever raise them, so the top of a column can look higher than it is, but never lower.
+// pipeX and pipeZ are the liquid flowing out of the column through its +x and +z side, kept from step to step by the
+// pipe liquid solver (PipeFlux in simulation.hlsl). The pool fields are the Pool lying on the column's ground, written
+// by FindPools before the pipes are updated, so PipeFlux and PipeApply read what every column held at the start of the
+// step rather than voxels another thread is rewriting.
+struct Column
+{
+    int topSolid;
+    int topLiquid;
+    int pipeX;
+    int pipeZ;
+    int poolGround;
+    int poolTop;
+    int poolType;
+    int poolLiquid;
+    int poolRoom;
+};
+
+RWStructuredBuffer<Column> columnBuffer : register (u5);
+
+int ColumnIndex(int x, int z)
+{
+    return (z * worldSize.x) + x;
+}
+
+// Height of the topmost voxel of either kind in the column at x and z, -1 when the column is empty
+int ColumnTop(int x, int z)
+{
+    Column column = columnBuffer[ColumnIndex(x, z)];
+    return max(column.topSolid, column.topLiquid);
+}
+
+// Indicates if nothing in the column at x and z is at or above a position's height
+bool IsAboveColumn(int3 position)
+{
+    return position.y > ColumnTop(position.x, position.z);
+}
+
+// Keeps the column summary above a voxel of the given type that was just written at a position
+void RaiseColumn(int3 position, int type)
+{
+    if (type == EMPTY || type >= MATERIAL_COUNT) {return;}
+
+    int index = ColumnIndex(position.x, position.z);
+
+    if (MATERIALS[type].flags & MATERIAL_LIQUID) {InterlockedMax(columnBuffer[index].topLiquid, position.y);}
+    else {InterlockedMax(columnBuffer[index].topSolid, position.y);}
+}
+
+#endif
@@ -0,0 +1,197 @@
+// This shader labels connected bodies of liquid (voxels of the same liquid touching on a side), and counts the voxels,
+// liquid and bounds of every body. The CPU port does the same in CpuSimulation::LabelLiquids().
+// Every kernel but PrepareLabels and FinishLabelPass is dispatched indirectly with thread group counts from
+// activeCountBuffer, so the world is only labelled again after a step that changed a voxel, and label propagation stops
+// as soon as a pass changes nothing, without the CPU reading anything back.
+
+#include "voxel_struct.hlsl"
+
+// One connected body of liquid, root is the label of every voxel in it (NO_LABEL while the entry is free)
+struct LiquidBody
+{
+    uint root;
+    uint type;
+    uint voxelCount;
+    uint liquid;
+    int3 min;
+    int3 max;
+};
+
+RWStructuredBuffer<Voxel> voxelBuffer : register (u1);
+
+// [10-12] thread groups for InitializeLabels and CountBodies, [13-15] thread groups for the next PropagateLabels pass,
+// [16-18] thread groups for ClearBodies (every x is 0 when the labels from before still hold), [19] set by a
+// PropagateLabels pass that changed a label (the rest is simulation.hlsl's)
+RWStructuredBuffer<uint> activeCountBuffer : register (u4);
+
+// Label of every voxel of the world (not the border), then the number of bodies CountBodies found, the number it had
+// no room for in bodyBuffer, and 1 if the passes ran out before every label settled (bodies can be split then)
+RWStructuredBuffer<uint> labelBuffer : register (u6);
+
+// Every body found by CountBodies, in a hash table keyed by root
+RWStructuredBuffer<LiquidBody> bodyBuffer : register (u7);
+
+#include "voxel_layout.hlsl"
+#include "materials.hlsl"
+
+// Label of voxels that aren't liquid, and of free entries in bodyBuffer
+#define NO_LABEL 0xFFFFFFFF
+
+// Entries in bodyBuffer (must match VoxelSim::maxLiquidBodies), bodies past this many are only counted as dropped
+#define BODY_TABLE_SIZE 1024
+
+// Where the results after the labels start in labelBuffer
+#define BODIES_FOUND ((uint)worldSize.x * worldSize.y * worldSize.z)
+#define BODIES_DROPPED (BODIES_FOUND + 1)
+#define LABELS_UNSETTLED (BODIES_FOUND + 2)
+
+// Index of a voxel in labelBuffer, which is also the label it starts with
+uint LabelIndex(int3 position)
+{
+    return (uint)position.x + (uint)worldSize.x * ((uint)position.z + (uint)worldSize.z * (uint)position.y);
+}
+
+int TypeAt(int3 position)
+{
+    return voxelBuffer[PositionToIndex(position)].type;
+}
+
+// Decides whether the world needs labelling again after a step (after PrepareMesh, which counts the changed voxels):
+// only when some voxel changed, otherwise every labelling kernel gets no thread groups and the bodies from before stay
+[numthreads(1, 1, 1)]
+void PrepareLabels (uint3 id : SV_DispatchThreadID)
+{
+    bool changed = activeCountBuffer[6] > 0;
+
+    activeCountBuffer[10] = changed ? (uint)worldSize.x / 4 : 0;
+    activeCountBuffer[11] = (uint)worldSize.y / 4;
+    activeCountBuffer[12] = (uint)worldSize.z / 4;
+    activeCountBuffer[13] = activeCountBuffer[10];
+    activeCountBuffer[14] = activeCountBuffer[11];
+    activeCountBuffer[15] = activeCountBuffer[12];
+    activeCountBuffer[16] = changed ? BODY_TABLE_SIZE / 64 : 0;
+    activeCountBuffer[17] = 1;
+    activeCountBuffer[18] = 1;
+    activeCountBuffer[19] = 0;
+}
+
+// Gives every liquid voxel its own index as a label, and everything else NO_LABEL
+[numthreads(4, 4, 4)]
+void InitializeLabels (uint3 id : SV_DispatchThreadID)
+{
+    int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z);
+    int type = TypeAt(voxelPos);
+    bool isLiquid = type != EMPTY && type < MATERIAL_COUNT && (MATERIALS[type].flags & MATERIAL_LIQUID);
+
+    labelBuffer[LabelIndex(voxelPos)] = isLiquid ? LabelIndex(voxelPos) : NO_LABEL;
+}
+
+// Frees every entry of bodyBuffer and resets the counts, noting if propagation was still changing labels when the
+// passes ran out (FinishLabelPass only stops it once a pass changes nothing)
+[numthreads(64, 1, 1)]
+void ClearBodies (uint3 id : SV_DispatchThreadID)
+{
+    if (id.x == 0)
+    {
+        labelBuffer[BODIES_FOUND] = 0;
+        labelBuffer[BODIES_DROPPED] = 0;
+        labelBuffer[LABELS_UNSETTLED] = (activeCountBuffer[13] != 0) ? 1 : 0;
+    }
+
+    if (id.x >= BODY_TABLE_SIZE) {return;}
+
+    LiquidBody body;
+    body.root = NO_LABEL;
+    body.type = EMPTY;
+    body.voxelCount = 0;
+    body.liquid = 0;
+    body.min = int3(0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF);
+    body.max = int3(-1, -1, -1);
+    bodyBuffer[id.x] = body;
+}
+
+// One pass of label propagation: every liquid voxel takes the smallest label of its neighbors of the same liquid, then
+// jumps to the label that one points at. The voxel its old label came from is pointed at the new label too (hooking),
+// so whole runs of labels merge at once. Labels only ever shrink, so passes can race, and once no pass changes anything
+// every voxel of a body holds the smallest index in it. VoxelSim::Step() dispatches up to VoxelSim::maxLabelPasses
+// passes, and FinishLabelPass gives the rest no thread groups once one changes nothing.
+[numthreads(4, 4, 4)]
+void PropagateLabels (uint3 id : SV_DispatchThreadID)
+{
+    int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z);
+    uint index = LabelIndex(voxelPos);
+    uint label = labelBuffer[index];
+    if (label == NO_LABEL) {return;}
+
+    int type = TypeAt(voxelPos);
+    uint smallest = label;
+
+    // Neighbors past the edge of the world are WALL voxels, which are never the same type
+    int3 neighbors[6] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 1, 0), int3(0, -1, 0), int3(0, 0, 1), int3(0, 0, -1)};
+    for (int i = 0; i < 6; i++)
+    {
+        int3 neighborPos = voxelPos + neighbors[i];
+        if (TypeAt(neighborPos) == type) {smallest = min(smallest, labelBuffer[LabelIndex(neighborPos)]);}
+    }
+
+    smallest = min(smallest, labelBuffer[smallest]);
+
+    if (smallest < label)
+    {
+        InterlockedMin(labelBuffer[index], smallest);
+        InterlockedMin(labelBuffer[label], smallest);
+        activeCountBuffer[19] = 1;
+    }
+}
+
+// Runs after every PropagateLabels pass: once a pass has changed no label, every label has settled, so the passes left
+// get no thread groups
+[numthreads(1, 1, 1)]
+void FinishLabelPass (uint3 id : SV_DispatchThreadID)
+{
+    if (activeCountBuffer[19] == 0) {activeCountBuffer[13] = 0;}
+    activeCountBuffer[19] = 0;
+}
+
+// Adds every liquid voxel to the body of its label, the first voxel of a body to arrive claims an entry for it
+[numthreads(4, 4, 4)]
+void CountBodies (uint3 id : SV_DispatchThreadID)
+{
+    int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z);
+    uint root = labelBuffer[LabelIndex(voxelPos)];
+    if (root == NO_LABEL) {return;}
+
+    Voxel voxel = voxelBuffer[PositionToIndex(voxelPos)];
+
+    // Linear probing from a hash of the root
+    uint slot = (root * 2654435761u) % BODY_TABLE_SIZE;
+    for (uint probe = 0; probe < BODY_TABLE_SIZE; probe++)
+    {
+        uint previous;
+        InterlockedCompareExchange(bodyBuffer[slot].root, NO_LABEL, root, previous);
+
+        if (previous == NO_LABEL)
+        {
+            bodyBuffer[slot].type = voxel.type;
+            InterlockedAdd(labelBuffer[BODIES_FOUND], 1);
+        }
+
+        if (previous == NO_LABEL || previous == root)
+        {
+            InterlockedAdd(bodyBuffer[slot].voxelCount, 1);
+            InterlockedAdd(bodyBuffer[slot].liquid, voxel.liquidCount);
+            InterlockedMin(bodyBuffer[slot].min.x, voxelPos.x);
+            InterlockedMin(bodyBuffer[slot].min.y, voxelPos.y);
+            InterlockedMin(bodyBuffer[slot].min.z, voxelPos.z);
+            InterlockedMax(bodyBuffer[slot].max.x, voxelPos.x);
+            InterlockedMax(bodyBuffer[slot].max.y, voxelPos.y);
+            InterlockedMax(bodyBuffer[slot].max.z, voxelPos.z);
+            return;
+        }
+
+        slot = (slot + 1) % BODY_TABLE_SIZE;
+    }
+
+    // bodyBuffer is full, so the body is only counted as dropped, once, by the voxel whose index is its label
+    if (root == LabelIndex(voxelPos)) {InterlockedAdd(labelBuffer[BODIES_DROPPED], 1);}
+}
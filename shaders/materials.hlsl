@@ -0,0 +1,41 @@
+// This file builds the material table from materials.def, so every shader sees the same materials as the CPU (see materials.h).
+// Rules branch on the flags of a material rather than on its type, so adding a material only means adding a row.
+
+#ifndef MATERIALS_HLSL
+#define MATERIALS_HLSL
+
+// Everything known about one material, indexed by voxel type
+struct Material
+{
+    int flags;
+    int viscosity;
+    float density;
+    float4 color;
+    int reactsWith;
+    int reactionProduct;
+};
+
+// One constant per material (EMPTY, SAND, WATER, ...)
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) static const int NAME = id;
+#include "materials.def"
+#undef MATERIAL
+
+#define WALL 255 // Immutable voxels filling the border around the world, never stepped so it has no material
+
+static const int MATERIAL_COUNT = 0
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) + 1
+#include "materials.def"
+#undef MATERIAL
+;
+
+static const Material MATERIALS[MATERIAL_COUNT] =
+{
+#define MATERIAL(NAME, Name, id, flags, viscosity, density, r, g, b, a, reactsWith, reactionProduct) {flags, viscosity, density, float4(r, g, b, a), reactsWith, reactionProduct},
+#include "materials.def"
+#undef MATERIAL
+};
+
+// Most liquid a single voxel can hold. Liquid is counted in whole units, so moving it around never makes or loses any.
+static const uint MAX_LIQUID = 256;
+
+#endif
@@ -1,85 +1,84 @@
-// This file generates all voxel meshes and then pushes those triangles to the triangleBuffer.
-// This triangleBuffer is then accessed during an indirect draw call.
+// This file generates all voxel meshes and then pushes those faces to the faceBuffer.
+// This faceBuffer is then accessed during an indexed indirect draw call.
 
 #include "noise.hlsl"
+#include "voxel_struct.hlsl"
 
-struct Voxel
+// One visible side of a voxel, expanded into 4 vertices by voxel.hlsl
+struct Face
 {
-  half type;
-  float3 velocity;
-  float lifeTime;
-  bool updatedThisStep;
-  float fluidCount;
-};
-
-struct Triangle
-{
-  float3 vertA;
-  float3 vertB;
-  float3 vertC;
-  float3 normal;
+  float3 position;
+  int direction;
   int voxelType;
-  int2 padding;
 };
 
-static float3 voxelVertices[8] =
-{
-  float3(-.5f, -.5f,  .5f),  // p0
-  float3(-.5f, -.5f, -.5f),  // p1
-  float3( .5f, -.5f,  .5f),  // p2
-  float3( .5f, -.5f, -.5f),  // p3
-  float3(-.5f,  .5f,  .5f),  // p4
-  float3(-.5f,  .5f, -.5f),  // p5
-  float3( .5f,  .5f,  .5f),  // p6
-  float3( .5f,  .5f, -.5f),  // p7
-};
+// Directions a face can point in, used to index faceCorners and faceNormals in voxel.hlsl
+#define FACE_X_POS 0
+#define FACE_X_NEG 1
+#define FACE_Y_POS 2
+#define FACE_Y_NEG 3
+#define FACE_Z_POS 4
+#define FACE_Z_NEG 5
 
-AppendStructuredBuffer<Triangle> triangleBuffer : register (u0);
+AppendStructuredBuffer<Face> faceBuffer : register (u0);
 RWStructuredBuffer<Voxel> voxelBuffer : register (u1);
-RWStructuredBuffer<uint> vertexCountBuffer : register (u2);
+RWStructuredBuffer<uint> indexCountBuffer : register (u2);
 
-cbuffer worldSizeBuffer : register(b1)
-{
-  int worldSize;
-}; 
+#include "voxel_layout.hlsl"
+#include "materials.hlsl"
+#include "column_map.hlsl"
 
-int PositionToIndex(int3 position)
+// Most faces faceBuffer holds (VoxelSim::maxFaces), faces past it are dropped
+#ifndef MAX_FACES
+#define MAX_FACES 65536
+#endif
+
+// Sides facing air or the world border are visible
+bool IsVisibleThrough(int neighborType)
 {
-  return (position.y * worldSize * worldSize) + (position.z * worldSize) + position.x;
+  return neighborType == EMPTY || neighborType == WALL;
 }
 
-void PushTriangle(int index1, int index2, int index3, float3 normal, int3 voxelPos)
+void PushFace(int direction, int3 voxelPos, int voxelType)
 {
-  Voxel voxel = voxelBuffer[PositionToIndex(voxelPos)];
-
-  Triangle T = (Triangle)0;
-  T.normal = normal;
-  T.voxelType = voxel.type;
+  // Each face is drawn as 2 triangles through the shared quad index buffer (0, 1, 2, 2, 1, 3). Its indices are
+  // reserved first, and given back if the mesh is already full, so the count never ends up past MAX_FACES.
+  uint firstIndex;
+  InterlockedAdd(indexCountBuffer[0], 6, firstIndex);
+  if (firstIndex >= (uint)MAX_FACES * 6)
+  {
+    InterlockedAdd(indexCountBuffer[0], (uint)-6);
+    return;
+  }
 
-  T.vertA = voxelVertices[index1] + voxelPos;
-  T.vertB = voxelVertices[index2] + voxelPos;
-  T.vertC = voxelVertices[index3] + voxelPos;
+  Face F = (Face)0;
+  F.position = voxelPos;
+  F.direction = direction;
+  F.voxelType = voxelType;
   
-  triangleBuffer.Append(T);
-  InterlockedAdd(vertexCountBuffer[0], 3);
+  faceBuffer.Append(F);
 
   // NOTE: It's inefficient to use both AppendStructBuffer and
-  // InterlockedAdd. Ideally, the counter value of triangleBuffer
-  // would be copied into vertexCountBuffer with a call of
+  // InterlockedAdd. Ideally, the counter value of faceBuffer
+  // would be copied into indexCountBuffer with a call of
   // CopyStructureCount() on CPU, and then another compute shader
-  // would triple that value. This works too though.
+  // would multiply that value by 6. This works too though.
 }
 
 [numthreads(4, 4, 4)]
 void Compute (uint3 id : SV_DispatchThreadID)
 {   
   int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z);
+
+  // Nothing to draw above the top of a column (most of the world is air above the ground)
+  if (IsAboveColumn(voxelPos)) {return;}
+
   int index = PositionToIndex(voxelPos);
   int voxelType = voxelBuffer[index].type;
 
-  if (voxelType != 0)
+  if (voxelType != EMPTY)
   {
-    // Types of adjacent voxels
+    // Types of adjacent voxels (voxels along the world edge read the WALL border)
     int right = voxelBuffer[PositionToIndex(voxelPos + int3(1, 0, 0))].type;
     int left = voxelBuffer[PositionToIndex(voxelPos + int3(-1, 0, 0))].type;
     int up = voxelBuffer[PositionToIndex(voxelPos + int3(0, 1, 0))].type;
@@ -87,47 +86,35 @@ void Compute (uint3 id : SV_DispatchThreadID)
     int forward = voxelBuffer[PositionToIndex(voxelPos + int3(0, 0, 1))].type;
     int backward = voxelBuffer[PositionToIndex(voxelPos + int3(0, 0, -1))].type;
 
-    // Check to see if any sides are visible, or if any are along world edge
-    if (right == 0 || voxelPos.x == worldSize - 1)
+    // Check to see if any sides are visible
+    if (IsVisibleThrough(right))
     {
-      // x +
-      PushTriangle(3, 7, 2, float3(1, 0, 0), voxelPos);
-      PushTriangle(2, 7, 6, float3(1, 0, 0), voxelPos);
+      PushFace(FACE_X_POS, voxelPos, voxelType);
     }
 
-    if (left == 0 || voxelPos.x == 0)
+    if (IsVisibleThrough(left))
     {
-      // x-
-      PushTriangle(0, 4, 1, float3(0, 0, 0), voxelPos);
-      PushTriangle(1, 4, 5, float3(0, 0, 0), voxelPos);
+      PushFace(FACE_X_NEG, voxelPos, voxelType);
     }
       
-    if (up == 0 || voxelPos.y == worldSize - 1)
+    if (IsVisibleThrough(up))
     {
-      // y +
-      PushTriangle(4, 6, 5, float3(0, 1, 0), voxelPos);
-      PushTriangle(5, 6, 7, float3(0, 1, 0), voxelPos);
+      PushFace(FACE_Y_POS, voxelPos, voxelType);
     }
       
-    if (down == 0 || voxelPos.y == 0)
+    if (IsVisibleThrough(down))
     {
-      // y -
-      PushTriangle(2, 0, 3, float3(0, 0, 0), voxelPos);
-      PushTriangle(3, 0, 1, float3(0, 0, 0), voxelPos);
+      PushFace(FACE_Y_NEG, voxelPos, voxelType);
     }
       
-    if (forward == 0 || voxelPos.z == worldSize - 1)
+    if (IsVisibleThrough(forward))
     {
-      // z +
-      PushTriangle(2, 6, 0, float3(0, 0, 1), voxelPos);
-      PushTriangle(0, 6, 4, float3(0, 0, 1), voxelPos);
+      PushFace(FACE_Z_POS, voxelPos, voxelType);
     }
 
-    if (backward == 0 || voxelPos.z == 0)
+    if (IsVisibleThrough(backward))
     {
-      // z -
-      PushTriangle(1, 5, 3, float3(0, 0, 0), voxelPos);
-      PushTriangle(3, 5, 7, float3(0, 0, 0), voxelPos);
+      PushFace(FACE_Z_NEG, voxelPos, voxelType);
     }
   }
 }
\ No newline at end of file
@@ -1,21 +1,15 @@
 // This shader is called when the user wants to place voxels.
 
-struct Voxel
-{
-    half type;
-    float3 velocity;
-    float lifeTime;
-    bool updatedThisStep;
-    float liquidCount;
-};
+#include "voxel_struct.hlsl"
 
 RWStructuredBuffer<Voxel> voxelBuffer : register (u1);
 
-// Width, height, and depth of world
-cbuffer worldSizeBuffer : register(b1)
-{
-  int worldSize;
-}; 
+// [5] voxels changed since the last step (see CountChangedVoxels in voxel_helpers.hlsl), so the next step remeshes
+RWStructuredBuffer<uint> activeCountBuffer : register (u4);
+
+#include "voxel_layout.hlsl"
+#include "materials.hlsl"
+#include "column_map.hlsl"
 
 cbuffer pickBuffer : register(b4)
 {
@@ -25,30 +19,19 @@ cbuffer pickBuffer : register(b4)
   int voxelType;
 }; 
 
-// Indicates if a given position is inside the game world
+// Indicates if a given position is inside the game world (rays and brushes can reach past the WALL border)
 bool InBounds(int3 position)
 {
-    return !(
-        position.x > worldSize - 1 ||
-        position.x < 0 ||
-        position.y > worldSize - 1 ||
-        position.y < 0 ||
-        position.z > worldSize - 1 ||
-        position.z < 0
-    );
-}
-
-// Given a position, finds that position's index in the voxel buffer
-int PositionToIndex(int3 position)
-{
-    return (position.y * worldSize * worldSize) + (position.z * worldSize) + position.x;
+    // Negative positions wrap around to huge unsigned values, so one compare per axis covers both ends
+    return all((uint3)position < (uint3)worldSize);
 }
 
-// Sets a voxel at a given position
+// Sets a voxel at a given position, and keeps its column's summary above it
 void SetVoxel(int3 voxelPos, Voxel voxel)
 {
     int index = PositionToIndex(voxelPos);
     voxelBuffer[index] = voxel;
+    RaiseColumn(voxelPos, voxel.type);
 }
 
 // Returns a voxel at a given position
@@ -67,7 +50,8 @@ void Pick (uint3 id : SV_DispatchThreadID)
     {
         int3 voxelPos = int3((int)pos.x, (int)pos.y, (int)pos.z);
 
-        if (InBounds(voxelPos) && GetVoxel(voxelPos).type != 0)
+        // Positions above everything in their column can't be hit, so the voxel isn't read there
+        if (InBounds(voxelPos) && !IsAboveColumn(voxelPos) && GetVoxel(voxelPos).type != EMPTY)
         {
             float3 backup = cameraForwardVec;
             backup.x = (backup.x > 0) ? 1 : -1;
@@ -77,8 +61,9 @@ void Pick (uint3 id : SV_DispatchThreadID)
             voxelPos -= backup;
             Voxel voxel = (Voxel)0;
             voxel.type = voxelType;
-            voxel.liquidCount = (voxelType == 2 || voxelType == 4) ? 16.0f : 0;
+            voxel.liquidCount = (MATERIALS[voxelType].flags & MATERIAL_LIQUID) ? MAX_LIQUID : 0;
             voxel.updatedThisStep = true;
+            uint placed = 0;
 
             for (int x = 0; x < brushSize; x++)
             {
@@ -86,14 +71,16 @@ void Pick (uint3 id : SV_DispatchThreadID)
                 {
                     for (int z = 0; z < brushSize; z++)
                     {
-                        if (InBounds(voxelPos + int3(x, y, z)) && GetVoxel(voxelPos + int3(x, y, z)).type == 0)
+                        if (InBounds(voxelPos + int3(x, y, z)) && GetVoxel(voxelPos + int3(x, y, z)).type == EMPTY)
                         {
                             SetVoxel(voxelPos + int3(x, y, z), voxel);
+                            placed++;
                         }
                     }
                 }
             }
 
+            if (placed > 0) {InterlockedAdd(activeCountBuffer[5], placed);}
             return;
         }
 
@@ -5,26 +5,35 @@
 
 /////////////////////////////////// STRUCTS ///////////////////////////////////
 
-// Holds all info for each voxel
-struct Voxel
-{
-    half type;
-    float3 velocity;
-    float lifeTime;
-    bool updatedThisStep;
-    float liquidCount;
-};
+#include "voxel_struct.hlsl"
 
 /////////////////////////////////// BUFFERS ///////////////////////////////////
 
 // Holds a 3D array of all voxels
 RWStructuredBuffer<Voxel> voxelBuffer : register (u1);
 
-// Width, height, and depth of world
-cbuffer worldSizeBuffer : register(b1)
-{
-  int worldSize;
-}; 
+// [0] indices written by the mesh generation, only reset by PrepareMesh when the world is meshed again
+RWStructuredBuffer<uint> indexCountBuffer : register (u2);
+
+// Voxels of the current checkerboard phase that need stepping, written by CompactActive (see PackPosition)
+RWStructuredBuffer<uint> activeCellBuffer : register (u3);
+
+// [0-2] thread groups for StepSimulation, [3] voxels listed so far by CompactActive, [4] voxels StepSimulation steps,
+// [5] voxels changed since the last PrepareMesh (see CountChangedVoxels), [6] voxels changed during the last step,
+// [7-9] thread groups for the mesh generation (0 when nothing changed, so the mesh from before is kept), [10-19] used by
+// liquid_labels.hlsl
+RWStructuredBuffer<uint> activeCountBuffer : register (u4);
+
+// One bit per 16x16x16 chunk of the world (see ChunkScheduler::Index), set for the chunks VoxelSim::chunkScheduler
+// picked for the current pass of the checkerboard, only bound when MASK_CHUNKS is on
+StructuredBuffer<uint> chunkMaskBuffer : register (t0);
+
+// Indices of the same chunks, CompactActive is dispatched over these rather than the whole world (MASK_CHUNKS only)
+StructuredBuffer<uint> scheduledChunkBuffer : register (t1);
+
+// Every column of chunks (chunk x + chunk z * chunks along x) holding a chunk picked for the step, FallColumns,
+// FindPools, PipeFlux and PipeApply are dispatched over these rather than the whole world (MASK_CHUNKS only)
+StructuredBuffer<uint> chunkColumnBuffer : register (t2);
 
 // Specifies which part of checkerboard we are simulating this step
 cbuffer simulationOffsetBuffer : register(b2)
@@ -40,34 +49,58 @@ cbuffer timeBuffer : register(b3)
 
 /////////////////////////////////// CONSTANTS ///////////////////////////////////
 
-static float MAX_LIQUID = 16;
-static float MIN_LIQUID = 1.0f/16.0f;
+// Voxel types, viscosities and the rest of each material's behaviour live in materials.def
+#include "materials.hlsl"
 
-static float VISCOSITIES[4] = 
-{
-    0,     // Sand
-    1.0f,  // Water
-    0,     // Stone
-    14.0f, // Lava
-};
+// Steps in a row a voxel can fail to move before it falls asleep, and stops being stepped until a neighbor changes
+// (Slide picks a random direction every step, so this has to be long enough that a voxel that can slide usually has)
+#define SLEEP_STEPS 15
 
-static float DENSITIES[4] = 
-{
-    1,     // Sand
-    .5f,   // Water
-    1,     // Stone
-    .8f,   // Lava
-};
+// Fastest a solid falls through air in voxels per step, it speeds up by one voxel per step every step it keeps falling
+#define MAX_FALL_SPEED 16
+
+// How liquid levels out sideways: 0 spreads every liquid voxel with its neighbors when it's stepped (Spread), 1 moves
+// liquid lying on the ground between whole columns through virtual pipes (PipeFlux and PipeApply) and only spreads
+// liquid under something
+#ifndef LIQUID_SOLVER
+#define LIQUID_SOLVER 0
+#endif
 
-#define EMPTY 0
-#define SAND 1
-#define WATER 2
-#define STONE 3
-#define LAVA 4
-#define CLOUD 5
+// How much the flow through a pipe changes per unit of difference in surface height across it
+#define PIPE_ACCELERATION 0.4f
+
+// Fraction of its flow a pipe keeps into the next step, the closer to 1 the longer liquid sloshes around. Flows are
+// rounded towards 0 to whole units of liquid, so a pipe with less than one unit flowing stops and liquid settles completely.
+#define PIPE_DAMPING 0.95f
+
+// Voxels of air above a pool it can rise into in one step
+#define PIPE_MAX_RISE 16
+
+// Distance between voxels updated by the same StepSimulation dispatch (must match VoxelSim::checkerboardGap)
+#ifndef CHECKERBOARD_GAP
+#define CHECKERBOARD_GAP 4
+#endif
+
+// Whether the checkerboard only steps the chunks in chunkMaskBuffer, and falling through air and pipes only cover the
+// columns of those chunks, on when CHUNKS_PER_STEP or LOD_DISTANCE is set
+#ifndef MASK_CHUNKS
+#define MASK_CHUNKS 0
+#endif
+
+// Width, height, and depth of the chunks in chunkMaskBuffer (ChunkScheduler::chunkSize)
+#define CHUNK_SIZE 16
+
+// Thread groups of CompactActive along every axis of a chunk, when it's dispatched over scheduledChunkBuffer
+#define PHASE_GROUPS_PER_CHUNK (CHUNK_SIZE / CHECKERBOARD_GAP / 4)
+
+#if MASK_CHUNKS && PHASE_GROUPS_PER_CHUNK * CHECKERBOARD_GAP * 4 != CHUNK_SIZE
+#error "a chunk's voxels in a checkerboard phase must fill whole 4x4x4 thread groups"
+#endif
 
 /////////////////////////////////// INCLUDES ///////////////////////////////////
 
+#include "voxel_layout.hlsl"
+#include "column_map.hlsl"
 #include "voxel_helpers.hlsl"
 #include "noise.hlsl"
 
@@ -82,23 +115,20 @@ bool Flow(int3 fromPos, int3 toPos)
     Voxel toVoxel = (Voxel)0;
     toVoxel = GetVoxel(toPos);
 
-    // If either position is out of bounds, flow fails
-    if (!InBounds(fromPos) || !InBounds(toPos)) {return false;}
-
     // If fromVoxel doesn't contain liquid, flow fails
     if (fromVoxel.liquidCount == 0) {return false;}
 
-    // If toVoxel isn't empty, and isn't same liquid type, flow fails
+    // If toVoxel isn't empty, and isn't same liquid type, flow fails (this includes WALL voxels)
     if (toVoxel.type != 0 && toVoxel.type != fromVoxel.type) {return false;}
     
-    float combinedLiquid = fromVoxel.liquidCount + toVoxel.liquidCount;
+    uint combinedLiquid = fromVoxel.liquidCount + toVoxel.liquidCount;
+    toVoxel.type = fromVoxel.type;
 
     // If their combined fluid is above max allowable per voxel
     if (combinedLiquid > MAX_LIQUID)
     {
         // Put max liquid into toVoxel
         toVoxel.liquidCount = MAX_LIQUID;
-        toVoxel.type = fromVoxel.type;
         
         SetVoxel(toPos, toVoxel);
         
@@ -175,19 +205,18 @@ bool Spread(int3 voxelPos)
 {
     Voxel voxel = GetVoxel(voxelPos);
 
-    // If liquid level isn't sufficient, don't spread
-    if (voxel.liquidCount < VISCOSITIES[voxel.type - 1]) {return false;}
+    // If liquid level isn't sufficient, don't spread (the liquid may have already moved, air's viscosity stops it here)
+    if (voxel.liquidCount < MATERIALS[voxel.type].viscosity) {return false;}
 
-    int3 neighborPositions[5] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1), int3(0, 0, 0)}; // Adjacent positions (including current position)
-    float neighborLiquid = 0; // Total liquid among current and all adjacent voxels (counts air as 0 liquid)
-    int validNeighbors = 0; // How many liquid and air voxels are adjacent (includes current voxel)
+    int3 neighborPositions[5] = {int3(0, 0, 0), int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)}; // Current position first, then adjacent positions
+    uint neighborLiquid = 0; // Total liquid among current and all adjacent voxels (counts air as 0 liquid)
+    uint validNeighbors = 0; // How many liquid and air voxels are adjacent (includes current voxel)
+    uint lowestLiquid = MAX_LIQUID; // Least and most liquid in any of them
+    uint highestLiquid = 0;
 
-    // Count all liquid in current and adjacent voxels
+    // Count all liquid in current and adjacent voxels (WALL voxels are neither liquid nor empty, so they're ignored)
     for (int i = 0; i < 5; i++)
     {
-        // If adjacent voxel is out of bounds, ignore it
-        if (!InBounds(voxelPos + neighborPositions[i])) {continue;}
-        
         // Get adjacent voxel (might also be current voxel)
         Voxel curVoxel = GetVoxel(voxelPos + neighborPositions[i]);
         
@@ -196,31 +225,36 @@ bool Spread(int3 voxelPos)
         {
             // Increment validNeighbors and add adjacent voxel's liquid count to neighborLiquid
             validNeighbors += 1;
-            neighborLiquid += curVoxel.liquidCount > 0 ? curVoxel.liquidCount : 0.0f;
+            neighborLiquid += curVoxel.liquidCount;
+            lowestLiquid = min(lowestLiquid, curVoxel.liquidCount);
+            highestLiquid = max(highestLiquid, curVoxel.liquidCount);
         }
     }
 
-    // Find the average liquid among current and adjacent voxel
-    float averageLiquid = neighborLiquid / validNeighbors;
+    // Levels a unit apart are as even as whole units get, spreading them would only move the leftover around forever
+    if (highestLiquid - lowestLiquid <= 1) {return false;}
 
-    // If averaged liquid is enough
-    if (averageLiquid > MIN_LIQUID)
+    // Find the average liquid among current and adjacent voxel, and what's left over after it's shared out evenly
+    uint averageLiquid = neighborLiquid / validNeighbors;
+    uint leftover = neighborLiquid % validNeighbors;
+
+    // If every voxel gets some liquid
+    if (averageLiquid > 0)
     {
-        // Set that as the liquid value for all adjacent liquid voxels (and current voxel)
+        // Set that as the liquid value for all adjacent liquid voxels (and current voxel), with one more unit in each
+        // of the first ones until the leftover runs out
         for (i = 0; i < 5; i++)
         {
-            // If adjacent voxel is out of bounds, ignore it
-            if (!InBounds(voxelPos + neighborPositions[i])) {continue;}
-
             // Get adjacent voxel (might also be current voxel)
             Voxel curVoxel = GetVoxel(voxelPos + neighborPositions[i]);
             
             // If adjacent voxel is same liquid type, or is empty
             if (curVoxel.type == voxel.type || curVoxel.type == EMPTY)
             {
-                curVoxel.type = voxel.type;                          // Set voxel to liquid type
-                curVoxel.liquidCount = averageLiquid;                // Set average liquid
-                SetVoxel(voxelPos + neighborPositions[i], curVoxel); // Set voxel
+                curVoxel.type = voxel.type;                                        // Set voxel to liquid type
+                curVoxel.liquidCount = averageLiquid + (leftover > 0 ? 1 : 0);     // Set average liquid
+                leftover = leftover > 0 ? leftover - 1 : 0;
+                SetVoxel(voxelPos + neighborPositions[i], curVoxel);               // Set voxel
             }
         }
         return true;
@@ -232,17 +266,11 @@ bool Spread(int3 voxelPos)
 // Voxel will drop one position down if it's empty; returns true if successful
 bool Fall(int3 voxelPos)
 {
-    Voxel voxel = (Voxel)0;
-    voxel = GetVoxel(voxelPos);
-    
     Voxel below = (Voxel)0;
     below = GetVoxel(voxelPos + int3(0, -1, 0));
 
-    // If below is out of bounds, fall fails
-    if (!InBounds(voxelPos + int3(0, -1, 0))) {return false;}
-
-    // If below is empty, voxel moves there
-    if (GetVoxel(voxelPos + int3(0, -1, 0)).type == EMPTY)
+    // If below is empty, voxel moves there (below the world is WALL, so fall fails there)
+    if (below.type == EMPTY)
     {
         SwitchVoxels(voxelPos, voxelPos + int3(0, -1, 0));
         return true;
@@ -272,8 +300,8 @@ bool Slide(int3 voxelPos)
     int3 belowAdjacent[4] = {int3(1, -1, 0), int3(-1, -1, 0), int3(0, -1, 1), int3(0, -1, -1)}; // Positions to slide to
     int3 adjacent[4] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)}; // Adjacent voxel must be empty to slide
 
-    // If belowAdjacent isn't in bounds, or adjacent isn't empty, slide fails
-    if (!InBounds(voxelPos + belowAdjacent[rand]) || GetVoxel(voxelPos + adjacent[rand]).type != 0)
+    // If adjacent isn't empty, slide fails (outside the world is WALL, so it's never empty)
+    if (GetVoxel(voxelPos + adjacent[rand]).type != EMPTY)
     {
         return false;
     }
@@ -294,34 +322,471 @@ bool Slide(int3 voxelPos)
     return false;
 }
 
+// Moves a liquid down and sideways, and spreads it out; returns false if the liquid has moved away or run out
+bool StepLiquid(int3 voxelPos, int type, Material material)
+{
+    if (material.flags & MATERIAL_FALLS) {Fall(voxelPos);}
+
+    if (material.flags & MATERIAL_SLIDES) {Slide(voxelPos);}
+
+    // The pipe solver levels out liquid lying on the ground in PipeApply, liquid under anything is still spread
+    if (LIQUID_SOLVER == 0 || voxelPos.y < columnBuffer[ColumnIndex(voxelPos.x, voxelPos.z)].topSolid) {Spread(voxelPos);}
+
+    // Get updated liquid value, stop if no liquid left
+    if (GetVoxel(voxelPos).liquidCount == 0) {return false;}
+
+    // Move voxel to each adjacent position and try to slide from there
+    int3 adjacent[4] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
+
+    // Below must not be the same liquid
+    if (GetVoxel(voxelPos + int3(0, -1, 0)).type != type)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (GetVoxel(voxelPos + adjacent[i]).type == EMPTY)
+            {
+                // The trial move is written directly and undone when the slide fails, so only a slide that worked wakes anything
+                int index = PositionToIndex(voxelPos);
+                int adjacentIndex = PositionToIndex(voxelPos + adjacent[i]);
+                Voxel voxel = voxelBuffer[index];
+                Voxel empty = voxelBuffer[adjacentIndex];
+
+                voxelBuffer[adjacentIndex] = voxel;
+                voxelBuffer[index] = empty;
+                if (Slide(voxelPos + adjacent[i]))
+                {
+                    // The slide woke around where the liquid went, but not where it came from
+                    Wake(voxelPos);
+                    return false;
+                }
+
+                voxelBuffer[adjacentIndex] = empty;
+                voxelBuffer[index] = voxel;
+            }
+        }
+    }
+
+    // Get updated liquid value, stop if no liquid left
+    return GetVoxel(voxelPos).liquidCount != 0;
+}
+
+// Turns neighbors the material reacts with into its reaction product, or the voxel itself with equal chance
+void React(int3 voxelPos, Material material)
+{
+    if (material.reactsWith == EMPTY) {return;}
+
+    int3 adjacentAndUpDown[6] = {int3(0, 1, 0), int3(0, -1, 0), int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (GetVoxel(voxelPos + adjacentAndUpDown[i]).type == material.reactsWith)
+        {
+            float rand = PseudoRandom(time);
+            Voxel product = (Voxel)0;
+            product.type = material.reactionProduct;
+
+            if (rand < .5f) {SetVoxel(voxelPos + adjacentAndUpDown[i], product);}
+            else {SetVoxel(voxelPos, product);}
+        }
+    }
+}
+
+// Steps a single voxel, what it does only depends on the flags of its material (see materials.def)
+void StepVoxel(int3 voxelPos)
+{
+    Voxel voxel = GetVoxel(voxelPos);
+    
+    // If the current voxel is air, has already been updated, or is asleep, ignore it
+    if (voxel.type == EMPTY || voxel.updatedThisStep || voxel.quietSteps >= SLEEP_STEPS) {return;}
+
+    // Mark current voxel as updated (written directly, so it doesn't wake its neighbors)
+    int index = PositionToIndex(voxelPos);
+    voxelBuffer[index].updatedThisStep = true;
+
+    Material material = MATERIALS[voxel.type];
+
+    // Liquids (water, lava)
+    if (material.flags & MATERIAL_LIQUID)
+    {
+        if (!StepLiquid(voxelPos, voxel.type, material)) {return;}
+    }
+
+    // Everything else (sand, stone), HLSL doesn't short-circuit && so every flag gets its own if
+    else
+    {
+        if (material.flags & MATERIAL_FALLS)
+        {
+            if (Fall(voxelPos)) {return;}
+        }
+
+        if (material.flags & MATERIAL_SLIDES)
+        {
+            if (Slide(voxelPos)) {return;}
+        }
+
+        // The voxel couldn't move, count towards falling asleep (static voxels are only stepped to react, so they don't)
+        if (material.flags)
+        {
+            voxelBuffer[index].quietSteps = min(voxel.quietSteps + 1, SLEEP_STEPS);
+        }
+    }
+
+    React(voxelPos, material);
+}
+
+// The liquid lying on the topmost solid of a column, which the pipe solver moves between columns (LiquidPool in the CPU port)
+struct Pool
+{
+    int ground;   // Height of the topmost solid (-1 when there isn't one), the pool starts right above it
+    int top;      // Height of the topmost voxel of the pool, ground when the column is dry
+    int type;     // Liquid the pool is made of, EMPTY when the column is dry
+    int liquid;   // Liquid in the pool
+    int room;     // Room left for more liquid in the pool and in the air right above it
+};
+
+// Finds the pool lying on the topmost solid of the column at x and z (topSolid must be exact, see FallColumns)
+Pool FindPool(int x, int z)
+{
+    Pool pool = (Pool)0;
+    pool.ground = columnBuffer[ColumnIndex(x, z)].topSolid;
+    pool.top = pool.ground;
+    pool.type = EMPTY;
+
+    // Liquid voxels right above the ground, until the first voxel that isn't more of the same liquid
+    int y = pool.ground + 1;
+    for (; y < worldSize.y; y++)
+    {
+        Voxel voxel = GetVoxel(int3(x, y, z));
+        if (!(MATERIALS[voxel.type].flags & MATERIAL_LIQUID) || (pool.type != EMPTY && voxel.type != pool.type)) {break;}
+
+        pool.top = y;
+        pool.type = voxel.type;
+        pool.liquid += (int)voxel.liquidCount;
+        pool.room += (int)(MAX_LIQUID - voxel.liquidCount);
+    }
+
+    // Then the air above it, which the pool can rise into
+    for (int rise = 0; rise < PIPE_MAX_RISE && y < worldSize.y && GetVoxel(int3(x, y, z)).type == EMPTY; rise++)
+    {
+        pool.room += MAX_LIQUID;
+        y++;
+    }
+
+    return pool;
+}
+
+// Returns the pool FindPools found in the column at x and z this step
+Pool LoadPool(int x, int z)
+{
+    Column column = columnBuffer[ColumnIndex(x, z)];
+
+    Pool pool;
+    pool.ground = column.poolGround;
+    pool.top = column.poolTop;
+    pool.type = column.poolType;
+    pool.liquid = column.poolLiquid;
+    pool.room = column.poolRoom;
+    return pool;
+}
+
+// Returns the column a thread of FallColumns, FindPools, PipeFlux or PipeApply covers. With MASK_CHUNKS they're
+// dispatched with CHUNK_SIZE / 4 groups along x and z for every column of chunks in chunkColumnBuffer (id.y picks
+// which), otherwise over the whole world.
+int2 ThreadColumn(uint3 id)
+{
+#if MASK_CHUNKS
+    uint chunkColumn = chunkColumnBuffer[id.y];
+    uint chunksX = (uint)worldSize.x / CHUNK_SIZE;
+    return int2((int)((chunkColumn % chunksX) * CHUNK_SIZE + id.x), (int)((chunkColumn / chunksX) * CHUNK_SIZE + id.z));
+#else
+    return int2((int)id.x, (int)id.z);
+#endif
+}
+
+// Indicates if the column at x and z is covered by the column kernels this step. The rest keep their pools and pipes
+// from the last step they were covered, and pipes to them stay closed, like pipes past the edge of the world.
+bool ColumnScheduled(int x, int z)
+{
+#if MASK_CHUNKS
+    int3 chunkCount = worldSize / CHUNK_SIZE;
+    for (int chunkY = 0; chunkY < chunkCount.y; chunkY++)
+    {
+        uint chunkIndex = (chunkY * chunkCount.z + z / CHUNK_SIZE) * chunkCount.x + x / CHUNK_SIZE;
+        if (chunkMaskBuffer[chunkIndex / 32] & (1u << (chunkIndex % 32))) {return true;}
+    }
+
+    return false;
+#else
+    return true;
+#endif
+}
+
+// Returns the liquid the pool of the column at x and z takes in this step: its own, or for a dry column the liquid of the
+// neighboring pool with the highest surface, so two liquids never flow into the same dry column at once (EMPTY when
+// none can). Every thread asking about the same column gets the same answer, since it only reads FindPools' snapshot.
+int AcceptedType(int x, int z)
+{
+    Pool pool = LoadPool(x, z);
+    if (pool.type != EMPTY) {return pool.type;}
+
+    // Ties go to the first neighbor in this order
+    int2 neighbors[4] = {int2(x - 1, z), int2(x, z - 1), int2(x + 1, z), int2(x, z + 1)};
+    int type = EMPTY;
+    int highest = -2147483647;
+    for (int i = 0; i < 4; i++)
+    {
+        int2 neighbor = neighbors[i];
+        if (neighbor.x < 0 || neighbor.x >= worldSize.x || neighbor.y < 0 || neighbor.y >= worldSize.z) {continue;}
+        if (!ColumnScheduled(neighbor.x, neighbor.y)) {continue;}
+
+        Pool neighborPool = LoadPool(neighbor.x, neighbor.y);
+        int height = (neighborPool.ground + 1) * (int)MAX_LIQUID + neighborPool.liquid;
+        if (neighborPool.type != EMPTY && height > highest)
+        {
+            highest = height;
+            type = neighborPool.type;
+        }
+    }
+
+    return type;
+}
+
+// Returns the new flow through the pipe between two pools (positive from pool to neighbor), given what it was last step
+// and the liquid each takes (see AcceptedType)
+int UpdatePipe(Pool pool, Pool neighbor, int accepts, int neighborAccepts, int flow)
+{
+    // Pipes only join pools taking the same liquid, a dry column only takes one liquid per step
+    if (accepts == EMPTY || accepts != neighborAccepts) {return 0;}
+
+    // Height of each surface, in the same units as liquid (MAX_LIQUID per voxel)
+    int height = (pool.ground + 1) * (int)MAX_LIQUID + pool.liquid;
+    int neighborHeight = (neighbor.ground + 1) * (int)MAX_LIQUID + neighbor.liquid;
+
+    // Flow speeds up towards the lower surface, and keeps most of what it had, so surfaces level out like a wave
+    // rather than a voxel at a time. Both sides move the same whole units, so none is made or lost.
+    flow = (int)(PIPE_DAMPING * flow + PIPE_ACCELERATION * (height - neighborHeight));
+
+    // No pipe takes more than a quarter of the liquid on its side, or fills more than a quarter of the room on the other,
+    // so no pool ever goes below empty or above the room it has, whatever its other pipes do
+    if (flow > 0) {flow = min(flow, min(pool.liquid, neighbor.room) / 4);}
+    else {flow = max(flow, -min(neighbor.liquid, pool.room) / 4);}
+
+    return flow;
+}
+
+// Packs a world position into a single uint for activeCellBuffer
+uint PackPosition(int3 position)
+{
+    return (uint)position.x + (uint)worldSize.x * ((uint)position.z + (uint)worldSize.z * (uint)position.y);
+}
+
+int3 UnpackPosition(uint packed)
+{
+    int3 position;
+    position.x = packed % worldSize.x;
+    packed /= worldSize.x;
+    position.z = packed % worldSize.z;
+    position.y = packed / worldSize.z;
+    return position;
+}
+
 /////////////////////////////////// DISPATCH THREADS ///////////////////////////////////
 
-// Will repeatedly spawn water and sand in sandbox
+// Will repeatedly spawn water and sand in sandbox (if the world is big enough to hold them)
 [numthreads(1, 1, 1)]
 void Place (uint3 id : SV_DispatchThreadID)
 {   
     int3 voxelPos = int3(32, 50, 32);
     Voxel v = (Voxel)0;
     v.type = SAND;
-    SetVoxel(voxelPos, v);
+    if (InBounds(voxelPos)) {SetVoxel(voxelPos, v);}
 
     voxelPos = int3(14, 50, 14);
     v.type = WATER;
     v.liquidCount = MAX_LIQUID;
-    SetVoxel(voxelPos, v);
+    if (InBounds(voxelPos)) {SetVoxel(voxelPos, v);}
+
+    CountChangedVoxels();
+}
+
+// Moves every solid falling through air, one thread per column walking up from the bottom, before the checkerboard runs.
+// A falling voxel keeps its speed in fallSpeed and speeds up every step, so it can move several voxels at once. Each
+// thread keeps a running count of the air below the voxel it's at, so it knows how far one can go without scanning.
+// Only this thread writes inside its column, so nothing races (apart from waking neighbors, which only ever writes 0).
+// Since it sees the whole column, it also writes the column's exact summary to columnBuffer.
+[numthreads(4, 1, 4)]
+void FallColumns (uint3 id : SV_DispatchThreadID)
+{
+    int2 column = ThreadColumn(id);
+    int freeBelow = 0;
+    int topSolid = -1;
+    int topLiquid = -1;
+
+    for (int y = 0; y < worldSize.y; y++)
+    {
+        int3 voxelPos = int3(column.x, y, column.y);
+        Voxel voxel = GetVoxel(voxelPos);
+
+        if (voxel.type == EMPTY)
+        {
+            freeBelow++;
+            continue;
+        }
+
+        // Liquids keep moving after they fall, so they're left for StepSimulation
+        uint flags = MATERIALS[voxel.type].flags;
+        if (freeBelow == 0 || !(flags & MATERIAL_FALLS) || (flags & MATERIAL_LIQUID))
+        {
+            if (flags & MATERIAL_LIQUID) {topLiquid = y;}
+            else {topSolid = y; topLiquid = -1;}
+
+            freeBelow = 0;
+            continue;
+        }
+
+        int speed = min((int)voxel.fallSpeed + 1, MAX_FALL_SPEED);
+        int distance = min(speed, freeBelow);
+        int3 toPos = voxelPos - int3(0, distance, 0);
+
+        // It keeps its speed unless it landed on something
+        voxel.fallSpeed = (distance < freeBelow) ? speed : 0;
+        voxel.updatedThisStep = true;
+        voxel.quietSteps = 0;
+
+        // Switch places with the air, which can hold liquid left behind by Flow()
+        Voxel air = GetVoxel(toPos);
+        voxelBuffer[PositionToIndex(toPos)] = voxel;
+        voxelBuffer[PositionToIndex(voxelPos)] = air;
+
+        Wake(voxelPos);
+        Wake(toPos);
+        changedVoxels += 2;
+
+        // Everything from where it landed up to here is air now (and nothing visited so far is above where it landed)
+        freeBelow = distance;
+        topSolid = toPos.y;
+        topLiquid = -1;
+    }
+
+    // Pipes are left alone, they're kept from step to step
+    int index = ColumnIndex(column.x, column.y);
+    columnBuffer[index].topSolid = topSolid;
+    columnBuffer[index].topLiquid = topLiquid;
+
+    CountChangedVoxels();
+}
+
+// Finds the pool of every column and keeps it in columnBuffer for PipeFlux and PipeApply (LIQUID_SOLVER 1). Runs right
+// after FallColumns, while every column's topSolid is exact.
+[numthreads(4, 1, 4)]
+void FindPools (uint3 id : SV_DispatchThreadID)
+{
+    int2 column = ThreadColumn(id);
+    int index = ColumnIndex(column.x, column.y);
+    Pool pool = FindPool(column.x, column.y);
+
+    columnBuffer[index].poolGround = pool.ground;
+    columnBuffer[index].poolTop = pool.top;
+    columnBuffer[index].poolType = pool.type;
+    columnBuffer[index].poolLiquid = pool.liquid;
+    columnBuffer[index].poolRoom = pool.room;
+}
+
+// Updates the pipes on the +x and +z side of every column from the height of the liquid surfaces on either side of them
+// (LIQUID_SOLVER 1), from the pools FindPools found, and only writes its own pipes.
+[numthreads(4, 1, 4)]
+void PipeFlux (uint3 id : SV_DispatchThreadID)
+{
+    int2 column = ThreadColumn(id);
+    int x = column.x;
+    int z = column.y;
+    int index = ColumnIndex(x, z);
+    Pool pool = LoadPool(x, z);
+
+    // Pipes past the edge of the world, or to columns not covered this step, stay closed
+    int pipeX = 0;
+    int pipeZ = 0;
+    int accepts = AcceptedType(x, z);
+    if (x + 1 < worldSize.x && ColumnScheduled(x + 1, z)) {pipeX = UpdatePipe(pool, LoadPool(x + 1, z), accepts, AcceptedType(x + 1, z), columnBuffer[index].pipeX);}
+    if (z + 1 < worldSize.z && ColumnScheduled(x, z + 1)) {pipeZ = UpdatePipe(pool, LoadPool(x, z + 1), accepts, AcceptedType(x, z + 1), columnBuffer[index].pipeZ);}
+
+    columnBuffer[index].pipeX = pipeX;
+    columnBuffer[index].pipeZ = pipeZ;
 }
 
-// Initializes the bottom 3 layers of the world to sand
+// Refills the pool of every column with the liquid that flowed in and out through its 4 pipes (LIQUID_SOLVER 1),
+// full voxels first and whatever is left on top. Only this thread writes inside its column, like FallColumns.
+[numthreads(4, 1, 4)]
+void PipeApply (uint3 id : SV_DispatchThreadID)
+{
+    int2 column = ThreadColumn(id);
+    int x = column.x;
+    int z = column.y;
+    Pool pool = LoadPool(x, z);
+
+    // Liquid flowing in from each neighbor (the pipes of columns not covered this step are left from an earlier step)
+    int inflow[4] =
+    {
+        x > 0 && ColumnScheduled(x - 1, z) ? columnBuffer[ColumnIndex(x - 1, z)].pipeX : 0,
+        z > 0 && ColumnScheduled(x, z - 1) ? columnBuffer[ColumnIndex(x, z - 1)].pipeZ : 0,
+        -columnBuffer[ColumnIndex(x, z)].pipeX,
+        -columnBuffer[ColumnIndex(x, z)].pipeZ,
+    };
+
+    // Pipes are only open between pools taking the same liquid, so whatever flowed in is that liquid (worked out from
+    // FindPools' snapshot, since the neighbors' voxels may already be rewritten, or drained, by their own threads)
+    int flow = inflow[0] + inflow[1] + inflow[2] + inflow[3];
+    int type = AcceptedType(x, z);
+
+    if (flow == 0 || type == EMPTY) {return;}
+
+    // Goes up from the ground until the liquid runs out and every voxel of the old pool has been rewritten
+    int liquidCount = pool.liquid + flow;
+    for (int y = pool.ground + 1; y < worldSize.y; y++)
+    {
+        if (liquidCount <= 0 && y > pool.top) {break;}
+
+        int3 voxelPos = int3(x, y, z);
+        Voxel voxel = GetVoxel(voxelPos);
+        int amount = min(liquidCount, (int)MAX_LIQUID);
+        liquidCount -= amount;
+
+        Voxel filled = (Voxel)0;
+        filled.updatedThisStep = voxel.updatedThisStep;
+        if (amount > 0)
+        {
+            filled.type = type;
+            filled.liquidCount = (uint)amount;
+        }
+
+        if (filled.type != voxel.type || filled.liquidCount != voxel.liquidCount) {SetVoxel(voxelPos, filled);}
+    }
+
+    CountChangedVoxels();
+}
+
+// Fills the border around the world with walls, and initializes the bottom 3 layers of the world to sand
+// (dispatched over the whole padded buffer, not just the world)
 [numthreads(4, 4, 4)]
 void InitializeSimulation (uint3 id : SV_DispatchThreadID)
 {   
-    int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z);
-    
-    if (voxelPos.y < 3)
+    int3 voxelPos = int3((int)id.x, (int)id.y, (int)id.z) - WORLD_BORDER;
+
+    // Written directly rather than through SetVoxel(), the border has no neighbors to wake (and some lie outside the buffer)
+    int index = PositionToIndex(voxelPos);
+
+    if (!InBounds(voxelPos))
+    {
+        Voxel wall = (Voxel)0;
+        wall.type = WALL;
+        voxelBuffer[index] = wall;
+    }
+
+    else if (voxelPos.y < 3)
     {
         Voxel v = (Voxel)0;
         v.type = SAND;
-        SetVoxel(voxelPos, v);
+        voxelBuffer[index] = v;
     }
 }
 
@@ -334,123 +799,97 @@ void ResetUpdatedStatus (uint3 id : SV_DispatchThreadID)
     voxelBuffer[index].updatedThisStep = false;
 }
 
-// Step every voxel
+// Prefix sum of how many voxels each thread of a CompactActive group lists
+groupshared uint groupOffsets[64];
+
+// Where in activeCellBuffer a CompactActive group's voxels start
+groupshared uint groupStart;
+
+// Lists every voxel of the current checkerboard phase that isn't air, asleep, or updated this step in
+// activeCellBuffer (dispatched over the phase, like StepSimulation used to be). With MASK_CHUNKS it's only dispatched
+// over the chunks picked for this pass, PHASE_GROUPS_PER_CHUNK groups along every axis of every chunk in
+// scheduledChunkBuffer (id.y / PHASE_GROUPS_PER_CHUNK picks which), so voxels of the other chunks wait for a later
+// pass without costing a thread. Each group finds where its voxels go with a prefix sum in groupshared memory, then
+// reserves room for all of them with a single atomic add.
 [numthreads(4, 4, 4)]
-void StepSimulation (uint3 id : SV_DispatchThreadID)
-{   
-    int gap = 4;
+void CompactActive (uint3 id : SV_DispatchThreadID, uint3 groupId : SV_GroupID, uint3 groupThreadId : SV_GroupThreadID, uint groupIndex : SV_GroupIndex)
+{
+    int gap = CHECKERBOARD_GAP;
+#if MASK_CHUNKS
+    int3 chunkCount = worldSize / CHUNK_SIZE;
+    int chunkIndex = (int)scheduledChunkBuffer[groupId.y / PHASE_GROUPS_PER_CHUNK];
+    int3 chunk = int3(chunkIndex % chunkCount.x, chunkIndex / (chunkCount.x * chunkCount.z), (chunkIndex / chunkCount.x) % chunkCount.z);
+    int3 cell = int3(groupId.x, groupId.y % PHASE_GROUPS_PER_CHUNK, groupId.z) * 4 + (int3)groupThreadId;
+    int3 voxelPos = chunk * CHUNK_SIZE + cell * gap + simulationOffset;
+#else
     int3 voxelPos = int3(id.x * gap, id.y * gap, id.z * gap) + simulationOffset;
+#endif
     Voxel voxel = GetVoxel(voxelPos);
-    
-    // If the current voxel is air or has already been updated, ignore it
-    if (voxel.type == EMPTY || voxel.updatedThisStep) {return;}
 
-    // Mark current voxel as updated
-    voxel.updatedThisStep = true;
-    SetVoxel(voxelPos, voxel);
+    uint active = (voxel.type != EMPTY && !voxel.updatedThisStep && voxel.quietSteps < SLEEP_STEPS) ? 1 : 0;
+    groupOffsets[groupIndex] = active;
+    GroupMemoryBarrierWithGroupSync();
 
-    // Sand
-    if (voxel.type == SAND)
+    // Inclusive scan, every pass adds the value offset places back
+    for (uint offset = 1; offset < 64; offset <<= 1)
     {
-        if (Fall(voxelPos)) {return;}
+        uint sum = groupOffsets[groupIndex];
+        if (groupIndex >= offset) {sum += groupOffsets[groupIndex - offset];}
+        GroupMemoryBarrierWithGroupSync();
 
-        if (Slide(voxelPos)) {return;}
+        groupOffsets[groupIndex] = sum;
+        GroupMemoryBarrierWithGroupSync();
     }
 
-    // Water
-    else if (voxel.type == WATER)
-    {   
-        Fall(voxelPos);
-
-        Slide(voxelPos);
-
-        Spread(voxelPos);
-
-        // Get updated liquid value
-        voxel = GetVoxel(voxelPos);
-
-        // Move voxel to each adjacent position and try to slide from there
-        int3 adjacent[4] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
-        
-        // Below must not be water
-        if (GetVoxel(voxelPos + int3(0, -1, 0)).type != WATER)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                if (GetVoxel(voxelPos + adjacent[i]).type == EMPTY)
-                {
-                    SwitchVoxels(voxelPos, voxelPos + adjacent[i]);
-                    if (Slide(voxelPos + adjacent[i]))
-                    {
-                        return;
-                    }
-                    
-                    SwitchVoxels(voxelPos, voxelPos + adjacent[i]);
-                }
-            }
-        }
-    }
-
-    // Stone
-    else if (voxel.type == STONE)
+    // The last thread holds the group's total
+    if (groupIndex == 63)
     {
-        Fall(voxelPos);
+        InterlockedAdd(activeCountBuffer[3], groupOffsets[63], groupStart);
     }
+    GroupMemoryBarrierWithGroupSync();
 
-    // Lava
-    else if (voxel.type == LAVA)
+    if (active)
     {
+        activeCellBuffer[groupStart + groupOffsets[groupIndex] - 1] = PackPosition(voxelPos);
+    }
+}
 
-        Fall(voxelPos);
-
-        Slide(voxelPos);
-
-        Spread(voxelPos);
+// Turns the voxels listed by CompactActive into thread groups for StepSimulation, and resets the count for the next phase
+[numthreads(1, 1, 1)]
+void PrepareActiveStep (uint3 id : SV_DispatchThreadID)
+{
+    uint count = activeCountBuffer[3];
 
-        // Get updated liquid value, stop if no liquid left
-        voxel = GetVoxel(voxelPos);
-        if (voxel.liquidCount == 0) {return;}
+    activeCountBuffer[0] = (count + 63) / 64;
+    activeCountBuffer[1] = 1;
+    activeCountBuffer[2] = 1;
+    activeCountBuffer[3] = 0;
+    activeCountBuffer[4] = count;
+}
 
-        // Move voxel to each adjacent position and try to slide from there
-        int3 adjacent[4] = {int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
-        
-        // Bottom must not be same type
-        if (GetVoxel(voxelPos + int3(0, -1, 0)).type != LAVA)
-        {
-            for (int i = 0; i < 4; i++)
-            {
-                if (GetVoxel(voxelPos + adjacent[i]).type == EMPTY)
-                {
-                    SwitchVoxels(voxelPos, voxelPos + adjacent[i]);
-                    if (Slide(voxelPos + adjacent[i]))
-                    {
-                        return;
-                    }
-                    
-                    SwitchVoxels(voxelPos, voxelPos + adjacent[i]);
-                }
-            }
-        }
+// Decides whether the world needs meshing again after a step: only when some voxel changed since the last mesh (a step,
+// an edit, or Place). Otherwise the mesh generation is dispatched with no thread groups, and the faces and index count
+// from before are drawn again.
+[numthreads(1, 1, 1)]
+void PrepareMesh (uint3 id : SV_DispatchThreadID)
+{
+    uint changed = activeCountBuffer[5];
 
-        // Get updated liquid value, stop if no liquid left
-        voxel = GetVoxel(voxelPos);
-        if (voxel.liquidCount == 0) {return;}
+    activeCountBuffer[5] = 0;
+    activeCountBuffer[6] = changed;
+    activeCountBuffer[7] = (changed > 0) ? (uint)worldSize.x / 4 : 0;
+    activeCountBuffer[8] = (uint)worldSize.y / 4;
+    activeCountBuffer[9] = (uint)worldSize.z / 4;
 
-        // If a neighbor is water, solidify it into stone
-        int3 adjacentAndUpDown[6] = {int3(0, 1, 0), int3(0, -1, 0), int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
+    if (changed > 0) {indexCountBuffer[0] = 0;}
+}
 
-        for (int i = 0; i < 6; i++)
-        {
-            if (GetVoxel(voxelPos + adjacentAndUpDown[i]).type == 2)
-            {
-                float rand = PseudoRandom(time);
-                Voxel stone = (Voxel)0;
-                stone.type = 3;
+// Steps every voxel listed in activeCellBuffer (dispatched indirectly, with the groups from PrepareActiveStep)
+[numthreads(64, 1, 1)]
+void StepSimulation (uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= activeCountBuffer[4]) {return;}
 
-                // Equal chance to replace water with stone, rather than lava with stone
-                if (rand < .5f) {SetVoxel(voxelPos + adjacentAndUpDown[i], stone);}
-                else {SetVoxel(voxelPos, stone);}
-            }
-        }
-    }
-}
\ No newline at end of file
+    StepVoxel(UnpackPosition(activeCellBuffer[id.x]));
+    CountChangedVoxels();
+}
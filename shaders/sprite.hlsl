@@ -13,16 +13,6 @@ struct VertexOutput
   float2 uv : TEX;
 };
 
-// Holds all info for each voxel
-struct Voxel
-{
-  half type;
-  float3 velocity;
-  float lifeTime;
-  bool updatedThisStep;
-  float liquidCount;
-};
-
 /////////////////////////////////// BUFFERS ///////////////////////////////////
 
 cbuffer pickBuffer : register(b4)
@@ -35,7 +25,7 @@ cbuffer pickBuffer : register(b4)
 
 cbuffer worldSizeBuffer : register(b1)
 {
-  int worldSize;
+  int3 worldSize;
 }; 
 
 /////////////////////////////////// INCLUDES ///////////////////////////////////
@@ -1,13 +1,11 @@
 // This file contains the vertex and fragment shaders which run on the voxel meshes
 
-struct Triangle
+// One visible side of a voxel, written by mesh_generation.hlsl
+struct Face
 {
-  float3 vertA;
-  float3 vertB;
-  float3 vertC;
-  float3 normal;
+  float3 position;
+  int direction;
   int voxelType;
-  int2 padding;
 };
 
 struct VertexOutput
@@ -25,47 +23,69 @@ cbuffer mvpBuffer : register(b0)
 
 cbuffer worldSizeBuffer : register(b1)
 {
-  int worldSize;
+  int3 worldSize;
 }; 
 
-static float4 voxelColors[5] = 
+// Voxel colors come from the material table
+#include "materials.hlsl"
+
+static float3 voxelVertices[8] =
+{
+  float3(-.5f, -.5f,  .5f),  // p0
+  float3(-.5f, -.5f, -.5f),  // p1
+  float3( .5f, -.5f,  .5f),  // p2
+  float3( .5f, -.5f, -.5f),  // p3
+  float3(-.5f,  .5f,  .5f),  // p4
+  float3(-.5f,  .5f, -.5f),  // p5
+  float3( .5f,  .5f,  .5f),  // p6
+  float3( .5f,  .5f, -.5f),  // p7
+};
+
+// Corners of each face (indexes into voxelVertices), ordered to match the quad index pattern (0, 1, 2, 2, 1, 3)
+static int faceCorners[6][4] =
 {
-  float4(1, 1, 0, 1),
-  float4(0, .2f, .8f, .3f),
-  float4(.2f, .2f, .2f, 1),
-  float4(1, .2f, .2f, 1),
-  float4(.8, .8, .8, 1),
+  {3, 7, 2, 6}, // x+
+  {0, 4, 1, 5}, // x-
+  {4, 6, 5, 7}, // y+
+  {2, 0, 3, 1}, // y-
+  {2, 6, 0, 4}, // z+
+  {1, 5, 3, 7}, // z-
 };
 
-StructuredBuffer<Triangle> trianglesBuffer : register(t1);
+// Normal of each face, negative faces have no normal so they only receive ambient light
+static float3 faceNormals[6] =
+{
+  float3(1, 0, 0), // x+
+  float3(0, 0, 0), // x-
+  float3(0, 1, 0), // y+
+  float3(0, 0, 0), // y-
+  float3(0, 0, 1), // z+
+  float3(0, 0, 0), // z-
+};
+
+StructuredBuffer<Face> facesBuffer : register(t1);
 
 VertexOutput Vertex(uint vertexID : SV_VertexID)
 {
   VertexOutput output = (VertexOutput)0;
 
-  // Read the triangle data from the buffer using the vertexID
-  Triangle tri = trianglesBuffer[vertexID / 3];
+  // Every face owns 4 consecutive vertices, the shared index buffer turns them into 2 triangles
+  Face face = facesBuffer[vertexID / 4];
+  uint corner = vertexID % 4;
 
-  // Determine the vertex index within the current triangle
-  uint vertexIndex = vertexID % 3;
+  float3 position = voxelVertices[faceCorners[face.direction][corner]] + face.position;
+  output.position_clip = mul(float4(position, 1.0f), mvp);
 
-  // Assign the position and normal based on the vertex index
-  if (vertexIndex == 0)
-  {
-    output.position_clip = mul(float4(tri.vertA, 1.0f), mvp);
-  }
-  else if (vertexIndex == 1)
-  {
-    output.position_clip = mul(float4(tri.vertB, 1.0f), mvp);
-  }
-  else
+  // Highest point of the face, so every vertex of a face gets the same height
+  float faceHeight = face.position.y - .5f;
+  for (int i = 0; i < 4; i++)
   {
-    output.position_clip = mul(float4(tri.vertC, 1.0f), mvp);
+    faceHeight = max(faceHeight, voxelVertices[faceCorners[face.direction][i]].y + face.position.y);
   }
 
-  output.normal = tri.normal;
-  output.voxelType = tri.voxelType;
-  output.voxelHeight = max(tri.vertA.y, max(tri.vertB.y, tri.vertC.y));
+  output.normal = faceNormals[face.direction];
+  output.voxelType = face.voxelType;
+  output.voxelHeight = faceHeight;
 
   return output;
 }
@@ -75,7 +95,7 @@ float4 Pixel(VertexOutput input) : SV_TARGET
   float3 lightDirection = normalize(float3(.5f, .8f, 1)); // Assuming a directional light from (1, 1, 1)
   float intensity = max(0, dot(input.normal, lightDirection)); // Calculate the dot product between the normal and light direction
 
-  float4 diffuseColor = voxelColors[max(0, input.voxelType - 1)]; // Fetch the original color
+  float4 diffuseColor = MATERIALS[input.voxelType].color; // Fetch the original color
 
   float ambientIntensity = 0.3; // Adjust the ambient intensity as desired (0.0 - 1.0)
 
@@ -1,32 +1,69 @@
-// This file contains helper functions for simulation.hlsl
+// This file contains helper functions for simulation.hlsl (PositionToIndex lives in voxel_layout.hlsl, and RaiseColumn in
+// column_map.hlsl)
 
 #ifndef VOXEL_HELPERS
 #define VOXEL_HELPERS
 
-// Given a position, finds that position's index in the voxel buffer
-int PositionToIndex(int3 position)
+// Indicates if a given position is inside the game world
+// (rules don't need this, any neighbor they read is either inside the world or a WALL voxel)
+bool InBounds(int3 position)
 {
-    return (position.y * worldSize * worldSize) + (position.z * worldSize) + position.x;
+    // Negative positions wrap around to huge unsigned values, so one compare per axis covers both ends
+    return all((uint3)position < (uint3)worldSize);
 }
 
-// Indicates if a given position is inside the game world
-bool InBounds(int3 position)
+// Wakes every sleeping voxel that could be freed by a change at a position, so they're stepped again.
+// Only solids sleep, and they only look at their own layer and the one below, so that's the voxels beside this one
+// and above it (voxels still counting towards sleep keep their count, the same as the CPU port's awake bits).
+void Wake(int3 position)
 {
-    return !(
-        position.x > worldSize - 1 ||
-        position.x < 0 ||
-        position.y > worldSize - 1 ||
-        position.y < 0 ||
-        position.z > worldSize - 1 ||
-        position.z < 0
-    );
+    int3 offsets[5] = {int3(0, 0, 0), int3(1, 0, 0), int3(-1, 0, 0), int3(0, 0, 1), int3(0, 0, -1)};
+
+    for (int y = 0; y <= 1; y++)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            int index = PositionToIndex(position + offsets[i] + int3(0, y, 0));
+
+            // Most neighbors are already awake, so only write the ones that aren't
+            if (voxelBuffer[index].quietSteps >= SLEEP_STEPS) {voxelBuffer[index].quietSteps = 0;}
+        }
+    }
 }
 
-// Sets a voxel at a given position
+// Voxels this thread has changed the type or liquid of, every kernel that writes voxels adds it to activeCountBuffer[5]
+// once at the end (see CountChangedVoxels), rather than using an atomic per write. PrepareMesh only remeshes the world
+// when that count isn't 0.
+static uint changedVoxels = 0;
+
+// Sets a voxel at a given position, and wakes its neighbors if it changed in a way that might let them move again
+// (a different type, or liquid appearing or running out; liquid levels changing alone can't free a sleeping voxel)
 void SetVoxel(int3 voxelPos, Voxel voxel)
 {
     int index = PositionToIndex(voxelPos);
-    voxelBuffer[index] = voxel;
+    Voxel previous = voxelBuffer[index];
+
+    if (previous.type != voxel.type || previous.liquidCount != voxel.liquidCount) {changedVoxels++;}
+
+    if (previous.type != voxel.type || (previous.liquidCount == 0) != (voxel.liquidCount == 0))
+    {
+        // Whatever is here now starts counting again, and is no longer falling freely (see FallColumns)
+        voxel.quietSteps = 0;
+        voxel.fallSpeed = 0;
+        voxelBuffer[index] = voxel;
+        Wake(voxelPos);
+        RaiseColumn(voxelPos, voxel.type);
+    }
+    else
+    {
+        voxelBuffer[index] = voxel;
+    }
+}
+
+// Adds the voxels this thread changed to the count PrepareMesh reads after the step
+void CountChangedVoxels()
+{
+    if (changedVoxels > 0) {InterlockedAdd(activeCountBuffer[5], changedVoxels);}
 }
 
 // Returns a voxel at a given position
@@ -0,0 +1,61 @@
+// This file decides where each voxel lives inside voxelBuffer. Every shader that reads voxels includes it.
+// The layout is picked with VOXEL_LAYOUT, and must match the layout used by the CPU (see voxel_layout.h).
+
+#ifndef VOXEL_LAYOUT_HLSL
+#define VOXEL_LAYOUT_HLSL
+
+#define LAYOUT_LINEAR 0 // Rows along x, then z, then y
+#define LAYOUT_MORTON 1 // 4x4x4 bricks stored one after another, Z-order inside each brick
+#define LAYOUT_TILED 2  // 4x4x4 bricks stored one after another, rows along x inside each brick
+
+#ifndef VOXEL_LAYOUT
+#define VOXEL_LAYOUT LAYOUT_LINEAR
+#endif
+
+// Width of the WALL border around the world, so neighbors of any voxel can be read without bounds checks
+#define WORLD_BORDER 2
+
+// Width, height, and depth of world (each axis can be a different size)
+// When compiled with WORLD_SIZE_X/Y/Z defined (see ComputeShader), they're baked in as constants so all index math
+// folds into immediates, shifts and masks, otherwise they're read from worldSizeBuffer
+#ifdef WORLD_SIZE_X
+static const int3 worldSize = int3(WORLD_SIZE_X, WORLD_SIZE_Y, WORLD_SIZE_Z);
+#else
+cbuffer worldSizeBuffer : register(b1)
+{
+  int3 worldSize;
+};
+#endif
+
+// Spreads the low 2 bits of a value apart, so bits from the other two axes can be placed between them
+int SpreadBits(int value)
+{
+    return (value & 1) | ((value & 2) << 2);
+}
+
+// Given a position, finds that position's index in the voxel buffer (positions inside the wall border are valid)
+int PositionToIndex(int3 position)
+{
+    int3 paddedSize = worldSize + 2 * WORLD_BORDER;
+    position += WORLD_BORDER;
+
+#if VOXEL_LAYOUT == LAYOUT_LINEAR
+    return (position.y * paddedSize.z * paddedSize.x) + (position.z * paddedSize.x) + position.x;
+#else
+    // Padded size is always a multiple of 4, so the buffer divides evenly into bricks
+    int3 bricks = paddedSize / 4;
+    int3 brick = position >> 2;
+    int3 local = position & 3;
+    int brickIndex = (brick.y * bricks.z * bricks.x) + (brick.z * bricks.x) + brick.x;
+
+#if VOXEL_LAYOUT == LAYOUT_MORTON
+    int localIndex = SpreadBits(local.x) | (SpreadBits(local.y) << 1) | (SpreadBits(local.z) << 2);
+#else
+    int localIndex = (local.y * 16) + (local.z * 4) + local.x;
+#endif
+
+    return brickIndex * 64 + localIndex;
+#endif
+}
+
+#endif
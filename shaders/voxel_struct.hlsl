@@ -0,0 +1,16 @@
+// This file holds what voxelBuffer stores for every voxel. Every shader that binds voxelBuffer includes it, and it must
+// match Voxel in voxel.h, which the CPU uses to size and fill the buffer.
+
+#ifndef VOXEL_STRUCT_HLSL
+#define VOXEL_STRUCT_HLSL
+
+struct Voxel
+{
+    half type;
+    uint fallSpeed;         // Voxels per step it's falling through air at, 0 when it isn't (FallColumns in simulation.hlsl)
+    uint quietSteps;        // Steps in a row the voxel has failed to move, it's asleep at SLEEP_STEPS (simulation.hlsl)
+    bool updatedThisStep;
+    uint liquidCount;       // In units of MAX_LIQUID (materials.hlsl)
+};
+
+#endif
@@ -0,0 +1,83 @@
+// This shader sums up the world after every step into statsBuffer, which the CPU reads back a few steps later without
+// waiting on the GPU (VoxelSim::ReadStats). The CPU port collects the same numbers in CpuSimulation::CollectStats().
+
+#include "voxel_struct.hlsl"
+
+RWStructuredBuffer<Voxel> voxelBuffer : register (u1);
+
+// [0] indices written by the mesh generation
+RWStructuredBuffer<uint> indexCountBuffer : register (u2);
+
+// [6] voxels changed during the last step (see PrepareMesh in simulation.hlsl)
+RWStructuredBuffer<uint> activeCountBuffer : register (u4);
+
+#include "voxel_layout.hlsl"
+#include "materials.hlsl"
+
+// Everything counted after a step. Liquid can add up past what a uint holds in big worlds, so it's kept in two halves
+// (liquidHigh * 2^32 + liquidLow).
+struct WorldStats
+{
+    uint voxelCounts[MATERIAL_COUNT];
+    uint liquidLow;
+    uint liquidHigh;
+    uint movedVoxels;
+    uint faceCount;
+    uint unchangedSteps;
+};
+
+RWStructuredBuffer<WorldStats> statsBuffer : register (u6);
+
+// Voxels and liquid of each material in a CountVoxels group, added to statsBuffer once per group
+groupshared uint groupCounts[MATERIAL_COUNT];
+groupshared uint groupLiquid;
+
+// Starts a new set of stats: takes the changed voxels and the face count of the step that just ran, counts how many
+// steps in a row haven't changed anything (VoxelSim stops stepping once that's long enough), and clears the rest for
+// CountVoxels
+[numthreads(1, 1, 1)]
+void ClearStats (uint3 id : SV_DispatchThreadID)
+{
+    for (int type = 0; type < MATERIAL_COUNT; type++)
+    {
+        statsBuffer[0].voxelCounts[type] = 0;
+    }
+
+    statsBuffer[0].liquidLow = 0;
+    statsBuffer[0].liquidHigh = 0;
+    statsBuffer[0].movedVoxels = activeCountBuffer[6];
+    statsBuffer[0].faceCount = indexCountBuffer[0] / 6;
+    statsBuffer[0].unchangedSteps = (activeCountBuffer[6] == 0) ? statsBuffer[0].unchangedSteps + 1 : 0;
+}
+
+// Counts every voxel of the world by material and adds up its liquid. Each group sums its 64 voxels in groupshared
+// memory first, so statsBuffer only takes one atomic add per material per group.
+[numthreads(4, 4, 4)]
+void CountVoxels (uint3 id : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    if (groupIndex < (uint)MATERIAL_COUNT) {groupCounts[groupIndex] = 0;}
+    if (groupIndex == 0) {groupLiquid = 0;}
+    GroupMemoryBarrierWithGroupSync();
+
+    Voxel voxel = voxelBuffer[PositionToIndex(int3((int)id.x, (int)id.y, (int)id.z))];
+    int type = voxel.type;
+    if (type < MATERIAL_COUNT)
+    {
+        InterlockedAdd(groupCounts[type], 1);
+        if (MATERIALS[type].flags & MATERIAL_LIQUID) {InterlockedAdd(groupLiquid, voxel.liquidCount);}
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (groupIndex < (uint)MATERIAL_COUNT && groupCounts[groupIndex] > 0)
+    {
+        InterlockedAdd(statsBuffer[0].voxelCounts[groupIndex], groupCounts[groupIndex]);
+    }
+
+    // A group holds at most 64 * MAX_LIQUID, so the low half wraps at most once per add, and carries into the high half
+    if (groupIndex == 0 && groupLiquid > 0)
+    {
+        uint previous;
+        InterlockedAdd(statsBuffer[0].liquidLow, groupLiquid, previous);
+        if (previous + groupLiquid < previous) {InterlockedAdd(statsBuffer[0].liquidHigh, 1);}
+    }
+}